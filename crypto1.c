@@ -0,0 +1,251 @@
+#include "crypto1.h"
+#include <string.h>
+
+// Lookup tables for filter function
+const uint8_t lookup1[256] = {
+    0, 0,  16, 16, 0,  16, 0,  0,  0, 16, 0,  0,  16, 16, 16, 16, 0, 0,  16, 16, 0,  16, 0,  0,
+    0, 16, 0,  0,  16, 16, 16, 16, 0, 0,  16, 16, 0,  16, 0,  0,  0, 16, 0,  0,  16, 16, 16, 16,
+    8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24, 8, 8,  24, 24, 8,  24, 8,  8,
+    8, 24, 8,  8,  24, 24, 24, 24, 8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24,
+    0, 0,  16, 16, 0,  16, 0,  0,  0, 16, 0,  0,  16, 16, 16, 16, 0, 0,  16, 16, 0,  16, 0,  0,
+    0, 16, 0,  0,  16, 16, 16, 16, 8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24,
+    0, 0,  16, 16, 0,  16, 0,  0,  0, 16, 0,  0,  16, 16, 16, 16, 0, 0,  16, 16, 0,  16, 0,  0,
+    0, 16, 0,  0,  16, 16, 16, 16, 8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24,
+    8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24, 0, 0,  16, 16, 0,  16, 0,  0,
+    0, 16, 0,  0,  16, 16, 16, 16, 8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24,
+    8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24};
+
+const uint8_t lookup2[256] = {
+    0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4,
+    4, 4, 4, 2, 2, 6, 6, 2, 6, 2, 2, 2, 6, 2, 2, 6, 6, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2, 2, 6,
+    2, 2, 6, 6, 6, 6, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 2, 2, 6, 6, 2, 6, 2,
+    2, 2, 6, 2, 2, 6, 6, 6, 6, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 0, 0, 4, 4,
+    0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 2,
+    2, 6, 6, 2, 6, 2, 2, 2, 6, 2, 2, 6, 6, 6, 6, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4,
+    4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 2, 2, 6, 6, 2, 6, 2, 2, 2, 6, 2,
+    2, 6, 6, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2, 2, 6, 2, 2, 6, 6, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2,
+    2, 6, 2, 2, 6, 6, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2, 2, 6, 2, 2, 6, 6, 6, 6};
+
+// Filter output for every 20-bit input, one bit per input. For an even x, bits
+// x and x + 1 give filter(x) and filter(x | 1) with a single byte read (128 KiB).
+uint8_t filter_table[1 << 17];
+
+uint8_t crypto1_forward_table[7][256];
+uint8_t crypto1_rollback_table[7][256];
+
+// Bits shifted in (forward) or out (rollback) over 8 steps from a state with a
+// single bit set, stepped with the bit-serial routines
+static uint8_t byte_step_basis(int bit, bool rollback) {
+    struct Crypto1State s = {0, 0};
+    uint8_t in = 0;
+    if(bit < 24) {
+        s.odd = 1 << bit;
+    } else if(bit < 48) {
+        s.even = 1 << (bit - 24);
+    } else {
+        in = 1 << (bit - 48);
+    }
+
+    if(rollback) {
+        for(int j = 7; j >= 0; j--) {
+            napi_lfsr_rollback_bit(&s, BIT(in, j), 0);
+        }
+        return (s.odd >> 20 & 0xf) << 4 | (s.even >> 20 & 0xf);
+    }
+    for(int j = 0; j < 8; j++) {
+        crypt_bit(&s, BIT(in, j), 0);
+    }
+    return (s.odd & 0xf) << 4 | (s.even & 0xf);
+}
+
+static bool recover64_init(void);
+static bool recover64_ready = false;
+
+void crypto1_init_tables(void) {
+    for(uint32_t x = 0; x < (1 << 20); x += 8) {
+        uint8_t bits = 0;
+        for(int i = 0; i < 8; i++) {
+            bits |= filter(x + i) << i;
+        }
+        filter_table[x >> 3] = bits;
+    }
+
+    // Both directions are linear without feedback, so every entry is the XOR of
+    // the basis entries of its set bits
+    for(int table = 0; table < 7; table++) {
+        uint8_t forward[8], rollback[8];
+        for(int i = 0; i < 8; i++) {
+            forward[i] = byte_step_basis(table * 8 + i, false);
+            rollback[i] = byte_step_basis(table * 8 + i, true);
+        }
+        for(int v = 0; v < 256; v++) {
+            uint8_t f = 0, r = 0;
+            for(int i = 0; i < 8; i++) {
+                if(BIT(v, i)) {
+                    f ^= forward[i];
+                    r ^= rollback[i];
+                }
+            }
+            crypto1_forward_table[table][v] = f;
+            crypto1_rollback_table[table][v] = r;
+        }
+    }
+
+    // Built here rather than on first use so that threads never race on it
+    recover64_ready = recover64_init();
+}
+
+void crypto1_get_lfsr(struct Crypto1State* state, MfClassicKey* lfsr) {
+    int i;
+    uint64_t lfsr_value = 0;
+    for(i = 23; i >= 0; --i) {
+        lfsr_value = lfsr_value << 1 | BIT(state->odd, i ^ 3);
+        lfsr_value = lfsr_value << 1 | BIT(state->even, i ^ 3);
+    }
+
+    for(i = 0; i < 6; ++i) {
+        lfsr->data[i] = (lfsr_value >> ((5 - i) * 8)) & 0xFF;
+    }
+}
+
+void crypto1_set_lfsr(struct Crypto1State* state, const MfClassicKey* lfsr) {
+    int i;
+    uint64_t lfsr_value = 0;
+    for(i = 0; i < 6; ++i) {
+        lfsr_value = lfsr_value << 8 | lfsr->data[i];
+    }
+
+    state->odd = state->even = 0;
+    for(i = 0; i < 24; ++i) {
+        state->odd |= (uint32_t)BIT(lfsr_value, 2 * i + 1) << (i ^ 3);
+        state->even |= (uint32_t)BIT(lfsr_value, 2 * i) << (i ^ 3);
+    }
+}
+
+// crypto1_recover64() enumerates the odd register at every even step, which is
+// a 20-bit filter window sliding over a bit sequence: the 20 low odd bits of the
+// initial state followed by one feedback bit per two steps. 28 feedback bits and
+// the 20 initial bits are linear in the 48-bit state, so once a sequence passes
+// the filter checks the state is solved from it with a precomputed inverse.
+#define RECOVER64_WINDOW  20
+#define RECOVER64_SOLVE   28 // Extensions whose bits are used to solve the state
+#define RECOVER64_EXTEND  31 // Extensions checked against the keystream
+
+// recover64_inverse[i] selects the sequence bits whose parity is state bit i
+// (bits 0..23 odd, 24..47 even)
+static uint64_t recover64_inverse[48];
+
+// Express the solve sequence in terms of the initial state and invert it
+static bool recover64_init(void) {
+    uint64_t odd[24], even[24], rows[48];
+    for(int i = 0; i < 24; i++) {
+        odd[i] = 1ULL << i;
+        even[i] = 1ULL << (24 + i);
+    }
+
+    // Sequence bit j is bit j of the value after RECOVER64_SOLVE extensions:
+    // the newest feedback bit is bit 0, the initial odd bits are on top
+    int count = 0;
+    for(int i = RECOVER64_WINDOW - 1; i >= 0; i--) {
+        rows[47 - count++] = odd[i];
+    }
+    for(int step = 0; count < 48; step++) {
+        uint64_t feedback = 0;
+        for(int i = 0; i < 24; i++) {
+            if(BIT(LF_POLY_ODD, i)) feedback ^= odd[i];
+            if(BIT(LF_POLY_EVEN, i)) feedback ^= even[i];
+        }
+        for(int i = 23; i > 0; i--) {
+            even[i] = even[i - 1];
+        }
+        even[0] = feedback;
+        for(int i = 0; i < 24; i++) {
+            uint64_t t = odd[i];
+            odd[i] = even[i];
+            even[i] = t;
+        }
+        // After an odd step the new bit lands in the odd register
+        if(step & 1) {
+            rows[47 - count++] = feedback;
+        }
+    }
+
+    // Gauss-Jordan elimination of [rows | identity]
+    uint64_t inverse[48];
+    for(int j = 0; j < 48; j++) {
+        inverse[j] = 1ULL << j;
+    }
+    for(int col = 0; col < 48; col++) {
+        int pivot = col;
+        while(pivot < 48 && !BIT(rows[pivot], col)) pivot++;
+        if(pivot == 48) {
+            return false;
+        }
+        uint64_t t = rows[pivot];
+        rows[pivot] = rows[col];
+        rows[col] = t;
+        t = inverse[pivot];
+        inverse[pivot] = inverse[col];
+        inverse[col] = t;
+        for(int j = 0; j < 48; j++) {
+            if(j != col && BIT(rows[j], col)) {
+                rows[j] ^= rows[col];
+                inverse[j] ^= inverse[col];
+            }
+        }
+    }
+    memcpy(recover64_inverse, inverse, sizeof(inverse));
+    return true;
+}
+
+int crypto1_recover64(uint32_t ks2, uint32_t ks3, Crypto1StateCallback on_state, void* user) {
+    if(!recover64_ready) {
+        return 0;
+    }
+
+    // Keystream bits seen by the odd register, one per two steps
+    uint8_t ks[RECOVER64_EXTEND + 1];
+    for(int k = 0; k <= RECOVER64_EXTEND; k++) {
+        ks[k] = k < 16 ? BEBIT(ks2, 2 * k) : BEBIT(ks3, 2 * k - 32);
+    }
+
+    int found = 0;
+    uint64_t stack[2 * (RECOVER64_EXTEND + 1)];
+    uint8_t depth[2 * (RECOVER64_EXTEND + 1)];
+    for(uint32_t window = 0; window < (1 << RECOVER64_WINDOW); window++) {
+        if(filter_fast(window) != ks[0]) continue;
+
+        int top = 0;
+        stack[top] = window;
+        depth[top++] = 0;
+        while(top > 0) {
+            uint64_t v = stack[--top];
+            int k = depth[top];
+            if(k == RECOVER64_EXTEND) {
+                uint64_t sequence = v >> (RECOVER64_EXTEND - RECOVER64_SOLVE);
+                struct Crypto1State state = {0, 0};
+                for(int i = 0; i < 24; i++) {
+                    state.odd |= (uint32_t)__builtin_parityll(recover64_inverse[i] & sequence) << i;
+                    state.even |= (uint32_t)__builtin_parityll(recover64_inverse[24 + i] & sequence) << i;
+                }
+                struct Crypto1State check = state;
+                if(crypt_word(&check) != ks2 || crypt_word(&check) != ks3) continue;
+                found++;
+                if(on_state(user, &state)) {
+                    return found;
+                }
+                continue;
+            }
+            int extension = classify_extension((uint32_t)(v << 1), ks[k + 1]);
+            if(extension & EXTEND_BIT0) {
+                stack[top] = v << 1;
+                depth[top++] = k + 1;
+            }
+            if(extension & EXTEND_BIT1) {
+                stack[top] = v << 1 | 1;
+                depth[top++] = k + 1;
+            }
+        }
+    }
+    return found;
+}
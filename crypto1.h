@@ -0,0 +1,514 @@
+#ifndef CRYPTO1_H
+#define CRYPTO1_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mfkey.h"
+
+// Crypto1 constants
+#define LF_POLY_ODD  (0x29CE5C)
+#define LF_POLY_EVEN (0x870804)
+#define CONST_M1_1   (LF_POLY_EVEN << 1 | 1)
+#define CONST_M2_1   (LF_POLY_ODD << 1)
+#define CONST_M1_2   (LF_POLY_ODD)
+#define CONST_M2_2   (LF_POLY_EVEN << 1 | 1)
+#define BIT(x, n)    ((x) >> (n) & 1)
+#define BEBIT(x, n)  BIT(x, (n) ^ 24)
+#define SWAPENDIAN(x) \
+    ((x) = ((x) >> 8 & 0xff00ff) | ((x) & 0xff00ff) << 8, (x) = (x) >> 16 | (x) << 16)
+
+struct Crypto1State {
+    uint32_t odd, even;
+};
+
+// Lookup tables for filter function
+extern const uint8_t lookup1[256];
+extern const uint8_t lookup2[256];
+
+// Build the tables computed at startup (filter_table, byte-step and recover64
+// tables). Call it before using crypto1 from several threads.
+void crypto1_init_tables(void);
+
+static inline uint8_t evenparity32(uint32_t x) {
+    return __builtin_parity(x);
+}
+
+static inline int filter(uint32_t const x) {
+    uint32_t f;
+    f = lookup1[x & 0xff] | lookup2[(x >> 8) & 0xff];
+    f |= 0x0d938 >> (x >> 16 & 0xf) & 1;
+    return BIT(0xEC57E80A, f);
+}
+
+// Filter output for every 20-bit input, one bit per input. For an even x, bits
+// x and x + 1 give filter(x) and filter(x | 1) with a single byte read (128 KiB).
+extern uint8_t filter_table[1 << 17];
+
+static inline int filter_fast(uint32_t const x) {
+    return filter_table[(x & 0xfffff) >> 3] >> (x & 7) & 1;
+}
+
+// Extension classes of a state shifted left by one, against one keystream bit
+enum {
+    EXTEND_DEAD = 0, // No low bit matches the keystream bit
+    EXTEND_BIT0 = 1, // Only low bit 0 matches
+    EXTEND_BIT1 = 2, // Only low bit 1 matches
+    EXTEND_BOTH = 3, // Both low bits match
+};
+
+// Class of a shifted state x (bit 0 clear) in one table lookup. The filter pair
+// (filter(x), filter(x | 1)) selects a 2-bit class from a 16-bit constant:
+// for keystream bit 0, pairs 0..3 map to BOTH, BIT1, BIT0, DEAD; for bit 1 to
+// DEAD, BIT0, BIT1, BOTH.
+static inline int classify_extension(uint32_t const x, int const ks_bit) {
+    int pair = filter_table[(x & 0xfffff) >> 3] >> (x & 6) & 3;
+    return 0xE41B >> (ks_bit << 3 | pair << 1) & 3;
+}
+
+static inline uint8_t get_nth_byte(uint32_t value, int n) {
+    if(n < 0 || n > 3) {
+        return 0;
+    }
+    return (value >> (8 * (3 - n))) & 0xFF;
+}
+
+static inline uint8_t nfc_util_even_parity8(uint8_t data) {
+    return __builtin_parity(data);
+}
+
+static inline uint8_t crypt_bit(struct Crypto1State* s, uint8_t in, int is_encrypted) {
+    uint32_t feedin, t;
+    uint8_t ret = filter(s->odd);
+    feedin = ret & !!is_encrypted;
+    feedin ^= !!in;
+    feedin ^= LF_POLY_ODD & s->odd;
+    feedin ^= LF_POLY_EVEN & s->even;
+    s->even = s->even << 1 | evenparity32(feedin);
+    t = s->odd, s->odd = s->even, s->even = t;
+    return ret;
+}
+
+static inline void update_contribution(unsigned int data[], int item, int mask1, int mask2) {
+    int p = data[item] >> 25;
+    p = p << 1 | evenparity32(data[item] & mask1);
+    p = p << 1 | evenparity32(data[item] & mask2);
+    data[item] = p << 24 | (data[item] & 0xffffff);
+}
+
+// Reference bit-serial word operations
+
+static inline uint32_t crypt_word_par_bitwise(
+    struct Crypto1State* s,
+    uint32_t in,
+    int is_encrypted,
+    uint32_t nt_plain,
+    uint8_t* parity_keystream_bits) {
+    uint32_t ret = 0;
+    *parity_keystream_bits = 0;
+
+    for(int i = 0; i < 32; i++) {
+        uint8_t bit = crypt_bit(s, BEBIT(in, i), is_encrypted);
+        ret |= bit << (24 ^ i);
+        // Save keystream parity bit
+        if((i + 1) % 8 == 0) {
+            *parity_keystream_bits |=
+                (filter(s->odd) ^ nfc_util_even_parity8(get_nth_byte(nt_plain, i / 8)))
+                << (3 - (i / 8));
+        }
+    }
+    return ret;
+}
+
+static inline uint32_t crypt_word_bitwise(struct Crypto1State* s) {
+    uint32_t res_ret = 0;
+    uint32_t feedin, t;
+    for(int i = 0; i <= 31; i++) {
+        res_ret |= (filter(s->odd) << (24 ^ i));
+        feedin = LF_POLY_EVEN & s->even;
+        feedin ^= LF_POLY_ODD & s->odd;
+        s->even = s->even << 1 | (evenparity32(feedin));
+        t = s->odd, s->odd = s->even, s->even = t;
+    }
+    return res_ret;
+}
+
+static inline void crypt_word_noret_bitwise(struct Crypto1State* s, uint32_t in, int x) {
+    uint8_t ret;
+    uint32_t feedin, t, next_in;
+    for(int i = 0; i <= 31; i++) {
+        next_in = BEBIT(in, i);
+        ret = filter(s->odd);
+        feedin = ret & (!!x);
+        feedin ^= LF_POLY_EVEN & s->even;
+        feedin ^= LF_POLY_ODD & s->odd;
+        feedin ^= !!next_in;
+        s->even = s->even << 1 | (evenparity32(feedin));
+        t = s->odd, s->odd = s->even, s->even = t;
+    }
+}
+
+static inline uint32_t crypt_word_ret_bitwise(struct Crypto1State* s, uint32_t in, int x) {
+    uint32_t ret = 0;
+    uint32_t feedin, t, next_in;
+    uint8_t next_ret;
+    for(int i = 0; i <= 31; i++) {
+        next_in = BEBIT(in, i);
+        next_ret = filter(s->odd);
+        feedin = next_ret & (!!x);
+        feedin ^= LF_POLY_EVEN & s->even;
+        feedin ^= LF_POLY_ODD & s->odd;
+        feedin ^= !!next_in;
+        s->even = s->even << 1 | (evenparity32(feedin));
+        t = s->odd, s->odd = s->even, s->even = t;
+        ret |= next_ret << (24 ^ i);
+    }
+    return ret;
+}
+
+static inline void rollback_word_noret_bitwise(struct Crypto1State* s, uint32_t in, int x) {
+    uint8_t ret;
+    uint32_t feedin, t, next_in;
+    for(int i = 31; i >= 0; i--) {
+        next_in = BEBIT(in, i);
+        s->odd &= 0xffffff;
+        t = s->odd, s->odd = s->even, s->even = t;
+        ret = filter(s->odd);
+        feedin = ret & (!!x);
+        feedin ^= s->even & 1;
+        feedin ^= LF_POLY_EVEN & (s->even >>= 1);
+        feedin ^= LF_POLY_ODD & s->odd;
+        feedin ^= !!next_in;
+        s->even |= (evenparity32(feedin)) << 23;
+    }
+}
+
+static inline uint8_t napi_lfsr_rollback_bit(struct Crypto1State* s, uint32_t in, int fb) {
+    int out;
+    uint8_t ret;
+    uint32_t t;
+    s->odd &= 0xffffff;
+    t = s->odd, s->odd = s->even, s->even = t;
+
+    out = s->even & 1;
+    out ^= LF_POLY_EVEN & (s->even >>= 1);
+    out ^= LF_POLY_ODD & s->odd;
+    out ^= !!in;
+    out ^= (ret = filter(s->odd)) & !!fb;
+
+    s->even |= evenparity32(out) << 23;
+    return ret;
+}
+
+static inline uint32_t napi_lfsr_rollback_word_bitwise(struct Crypto1State* s, uint32_t in, int fb) {
+    int i;
+    uint32_t ret = 0;
+    for(i = 31; i >= 0; --i)
+        ret |= napi_lfsr_rollback_bit(s, BEBIT(in, i), fb) << (i ^ 24);
+    return ret;
+}
+
+// Byte-stepping Crypto1. Without keystream feedback the LFSR is linear, so the
+// 8 bits shifted in over 8 steps (or shifted out over 8 rolled-back steps) are
+// the XOR of one table entry per byte of the 48-bit state and of the input byte.
+// An entry packs 4 bits per half: odd in the high nibble, even in the low one.
+// Tables [0..2] take the odd bytes, [3..5] the even bytes and [6] the input byte
+// (bit j is the input of step j). Operations with feedback (x = 1) stay bit-serial.
+extern uint8_t crypto1_forward_table[7][256];
+extern uint8_t crypto1_rollback_table[7][256];
+
+static inline uint8_t crypto1_table_bits(const uint8_t table[7][256], uint32_t odd, uint32_t even, uint8_t in) {
+    return table[0][odd & 0xff] ^ table[1][(odd >> 8) & 0xff] ^ table[2][(odd >> 16) & 0xff] ^
+           table[3][even & 0xff] ^ table[4][(even >> 8) & 0xff] ^ table[5][(even >> 16) & 0xff] ^
+           table[6][in];
+}
+
+// Keystream of 8 steps from the halves extended by the 4 bits they gain (odd_x = odd << 4 | new)
+static inline uint8_t crypto1_byte_keystream(uint32_t odd_x, uint32_t even_x) {
+    return filter(odd_x >> 4) | filter(even_x >> 3) << 1 | filter(odd_x >> 3) << 2 | filter(even_x >> 2) << 3 |
+           filter(odd_x >> 2) << 4 | filter(even_x >> 1) << 5 | filter(odd_x >> 1) << 6 | filter(even_x) << 7;
+}
+
+// Advance 8 steps without feedback; returns the keystream (bit j = step j)
+static inline uint8_t crypt_byte(struct Crypto1State* s, uint8_t in) {
+    uint32_t odd = s->odd & 0xffffff, even = s->even & 0xffffff;
+    uint8_t bits = crypto1_table_bits(crypto1_forward_table, odd, even, in);
+    uint32_t odd_x = odd << 4 | bits >> 4, even_x = even << 4 | (bits & 0xf);
+    s->odd = odd_x & 0xffffff;
+    s->even = even_x & 0xffffff;
+    return crypto1_byte_keystream(odd_x, even_x);
+}
+
+// Roll back 8 steps without feedback; returns the keystream of those steps
+static inline uint8_t rollback_byte(struct Crypto1State* s, uint8_t in) {
+    uint32_t odd = s->odd & 0xffffff, even = s->even & 0xffffff;
+    uint8_t bits = crypto1_table_bits(crypto1_rollback_table, odd, even, in);
+    uint32_t odd_x = odd | (uint32_t)(bits >> 4) << 24, even_x = even | (uint32_t)(bits & 0xf) << 24;
+    s->odd = odd_x >> 4;
+    s->even = even_x >> 4;
+    return crypto1_byte_keystream(odd_x, even_x);
+}
+
+// Word operations, byte by byte where there is no feedback (bit-exact with the
+// *_bitwise versions on the low 24 bits of each half, see --bench crypto1)
+static inline uint32_t crypt_word_ret(struct Crypto1State* s, uint32_t in, int x) {
+    if(x) return crypt_word_ret_bitwise(s, in, x);
+    uint32_t ret = 0;
+    for(int shift = 24; shift >= 0; shift -= 8) {
+        ret |= (uint32_t)crypt_byte(s, in >> shift) << shift;
+    }
+    return ret;
+}
+
+static inline void crypt_word_noret(struct Crypto1State* s, uint32_t in, int x) {
+    if(x) {
+        crypt_word_noret_bitwise(s, in, x);
+        return;
+    }
+    for(int shift = 24; shift >= 0; shift -= 8) {
+        crypt_byte(s, in >> shift);
+    }
+}
+
+static inline uint32_t crypt_word(struct Crypto1State* s) {
+    return crypt_word_ret(s, 0, 0);
+}
+
+static inline uint32_t crypt_word_par(
+    struct Crypto1State* s,
+    uint32_t in,
+    int is_encrypted,
+    uint32_t nt_plain,
+    uint8_t* parity_keystream_bits) {
+    if(is_encrypted) return crypt_word_par_bitwise(s, in, is_encrypted, nt_plain, parity_keystream_bits);
+    uint32_t ret = 0;
+    *parity_keystream_bits = 0;
+    for(int n = 0; n < 4; n++) {
+        int shift = 24 - 8 * n;
+        ret |= (uint32_t)crypt_byte(s, in >> shift) << shift;
+        // Save keystream parity bit
+        *parity_keystream_bits |= (filter(s->odd) ^ nfc_util_even_parity8(get_nth_byte(nt_plain, n))) << (3 - n);
+    }
+    return ret;
+}
+
+static inline void rollback_word_noret(struct Crypto1State* s, uint32_t in, int x) {
+    if(x) {
+        rollback_word_noret_bitwise(s, in, x);
+        return;
+    }
+    for(int shift = 0; shift <= 24; shift += 8) {
+        rollback_byte(s, in >> shift);
+    }
+}
+
+static inline uint32_t napi_lfsr_rollback_word(struct Crypto1State* s, uint32_t in, int fb) {
+    if(fb) return napi_lfsr_rollback_word_bitwise(s, in, fb);
+    uint32_t ret = 0;
+    for(int shift = 0; shift <= 24; shift += 8) {
+        ret |= (uint32_t)rollback_byte(s, in >> shift) << shift;
+    }
+    return ret;
+}
+
+// Early-exit word checks for the leaf verifiers: the keystream of each byte is
+// compared as soon as it is produced and the check stops at the first mismatch.
+// *bits is increased by the number of keystream and parity bits examined.
+
+// Roll back a word without feedback, checking its keystream (last byte first)
+static inline bool rollback_word_check(struct Crypto1State* s, uint32_t in, uint32_t ks, int* bits) {
+    for(int shift = 0; shift <= 24; shift += 8) {
+        *bits += 8;
+        if(rollback_byte(s, in >> shift) != (uint8_t)(ks >> shift)) return false;
+    }
+    return true;
+}
+
+// Advance a word without feedback, checking its keystream (first byte first)
+static inline bool crypt_word_check(struct Crypto1State* s, uint32_t in, uint32_t ks, int* bits) {
+    for(int shift = 24; shift >= 0; shift -= 8) {
+        *bits += 8;
+        if(crypt_byte(s, in >> shift) != (uint8_t)(ks >> shift)) return false;
+    }
+    return true;
+}
+
+// Roll back a word without feedback, also checking the parity keystream bits of
+// nt_plain (par bit 3 - n follows byte n, as in crypt_word_par). The state before
+// rolling back a byte is the state at its boundary, so each parity bit is checked
+// right before the keystream of its byte.
+static inline bool rollback_word_par_check(
+    struct Crypto1State* s,
+    uint32_t in,
+    uint32_t ks,
+    uint32_t nt_plain,
+    uint8_t par,
+    int* bits) {
+    for(int n = 3; n >= 0; n--) {
+        int shift = 24 - 8 * n;
+        *bits += 1;
+        if((filter(s->odd) ^ nfc_util_even_parity8(get_nth_byte(nt_plain, n))) != ((par >> (3 - n)) & 1)) {
+            return false;
+        }
+        *bits += 8;
+        if(rollback_byte(s, in >> shift) != (uint8_t)(ks >> shift)) return false;
+    }
+    return true;
+}
+
+// Bitsliced Crypto1: 64 states at once, bit l of every plane belongs to lane l.
+// The LFSR is kept as its bit sequence a[]: the state at time u is a[u .. u + 47],
+// with odd bit k = a[u + 47 - 2k] and even bit k = a[u + 46 - 2k]. Rolling back a
+// step prepends a bit and stepping forward appends one, so planes never move.
+// Crypto1Slice holds 48 bits plus 3 words of rollback; the state is loaded at
+// time CRYPTO1_SLICE_LOAD and word operations move u back and forth from there,
+// never past the load time.
+#define CRYPTO1_SLICE_LOAD 96
+#define CRYPTO1_SLICE_SPAN (CRYPTO1_SLICE_LOAD + 48)
+
+typedef struct {
+    uint64_t a[CRYPTO1_SLICE_SPAN];
+    int u;
+} Crypto1Slice;
+
+// Transpose a 64x64 bit matrix: bit c of row r moves to bit r of row c
+static inline void crypto1_transpose64(uint64_t m[64]) {
+    uint64_t mask = 0x00000000ffffffffULL;
+    for(int j = 32; j != 0; j >>= 1, mask ^= mask << j) {
+        for(int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            uint64_t t = ((m[k] >> j) ^ m[k | j]) & mask;
+            m[k] ^= t << j;
+            m[k | j] ^= t;
+        }
+    }
+}
+
+// Load count (at most 64) states into the lanes; unused lanes hold the zero state
+static inline void crypto1_slice_load(Crypto1Slice* s, const struct Crypto1State* states, int count) {
+    uint64_t m[64];
+    for(int l = 0; l < 64; l++) {
+        m[l] = l < count ? (states[l].odd & 0xffffff) | (uint64_t)(states[l].even & 0xffffff) << 32 : 0;
+    }
+    crypto1_transpose64(m);
+    s->u = CRYPTO1_SLICE_LOAD;
+    for(int k = 0; k < 24; k++) {
+        s->a[CRYPTO1_SLICE_LOAD + 47 - 2 * k] = m[k];
+        s->a[CRYPTO1_SLICE_LOAD + 46 - 2 * k] = m[32 + k];
+    }
+}
+
+// Filter subfunctions in boolean form. Inputs are given most significant first:
+// fa(x3, x2, x1, x0) has truth table 0xd938, fb(x3, x2, x1, x0) 0xf22c and
+// fc(x0, .., x4) 0xEC57E80A, matching the lookup tables of filter().
+static inline uint64_t crypto1_slice_fa(uint64_t a, uint64_t b, uint64_t c, uint64_t d) {
+    return ((a | b) ^ (a & d)) ^ (c & ((a ^ b) | d));
+}
+
+static inline uint64_t crypto1_slice_fb(uint64_t a, uint64_t b, uint64_t c, uint64_t d) {
+    return ((a & b) | c) ^ ((a ^ b) & (c | d));
+}
+
+static inline uint64_t crypto1_slice_fc(uint64_t a, uint64_t b, uint64_t c, uint64_t d, uint64_t e) {
+    return (a | ((b | e) & (d ^ e))) ^ ((a ^ (b & d)) & ((c ^ d) | (b & e)));
+}
+
+// Keystream bit of the state at time u (filter of odd bits 0..19, odd bit k = a[u + 47 - 2k])
+static inline uint64_t crypto1_slice_filter(const uint64_t* a, int u) {
+    const uint64_t* x = a + u + 47;
+    return crypto1_slice_fc(
+        crypto1_slice_fa(x[-38], x[-36], x[-34], x[-32]),
+        crypto1_slice_fb(x[-30], x[-28], x[-26], x[-24]),
+        crypto1_slice_fb(x[-22], x[-20], x[-18], x[-16]),
+        crypto1_slice_fa(x[-14], x[-12], x[-10], x[-8]),
+        crypto1_slice_fb(x[-6], x[-4], x[-2], x[0]));
+}
+
+// XOR of the feedback taps (LF_POLY_ODD and LF_POLY_EVEN) of the state at time u
+static inline uint64_t crypto1_slice_taps(const uint64_t* a, int u) {
+    const uint64_t* x = a + u;
+    return x[0] ^ x[5] ^ x[9] ^ x[10] ^ x[12] ^ x[14] ^ x[15] ^ x[17] ^ x[19] ^ x[24] ^ x[25] ^ x[27] ^
+           x[29] ^ x[35] ^ x[39] ^ x[41] ^ x[42] ^ x[43];
+}
+
+// Step a word forward (like crypt_word_ret) while lanes of alive are left, dropping
+// the lanes whose keystream differs from ks when check is set. Adds the number
+// of keystream bits compared over all live lanes to *bits; returns the live lanes.
+static inline __attribute__((always_inline)) uint64_t crypto1_slice_crypt_word(
+    Crypto1Slice* s,
+    uint32_t in,
+    int fb,
+    bool check,
+    uint32_t ks,
+    uint64_t alive,
+    int* bits) {
+    uint64_t* a = s->a;
+    for(int i = 0; i < 32; i++, s->u++) {
+        int u = s->u;
+        uint64_t out = (check || fb) ? crypto1_slice_filter(a, u) : 0;
+        a[u + 48] = crypto1_slice_taps(a, u) ^ -(uint64_t)BEBIT(in, i) ^ (fb ? out : 0);
+        if(check) {
+            *bits += __builtin_popcountll(alive);
+            alive &= ~(out ^ -(uint64_t)BEBIT(ks, i));
+            if(!alive) return 0;
+        }
+    }
+    return alive;
+}
+
+// Roll a word back (like napi_lfsr_rollback_word), checking its keystream if check
+// is set, and the parity keystream bits of nt_plain against par if parity is set
+// (each right before the byte it follows is rolled back, as in rollback_word_par_check)
+static inline __attribute__((always_inline)) uint64_t crypto1_slice_rollback_word(
+    Crypto1Slice* s,
+    uint32_t in,
+    int fb,
+    bool check,
+    uint32_t ks,
+    bool parity,
+    uint32_t nt_plain,
+    uint8_t par,
+    uint64_t alive,
+    int* bits) {
+    uint64_t* a = s->a;
+    for(int i = 31; i >= 0; i--) {
+        if(parity && (i & 7) == 7) {
+            int n = i >> 3;
+            uint64_t expected = -(uint64_t)((par >> (3 - n) & 1) ^ nfc_util_even_parity8(get_nth_byte(nt_plain, n)));
+            *bits += __builtin_popcountll(alive);
+            alive &= ~(crypto1_slice_filter(a, s->u) ^ expected);
+            if(!alive) return 0;
+        }
+        int u = --s->u;
+        uint64_t out = (check || fb) ? crypto1_slice_filter(a, u) : 0;
+        a[u] = 0;
+        a[u] = crypto1_slice_taps(a, u) ^ a[u + 48] ^ -(uint64_t)BEBIT(in, i) ^ (fb ? out : 0);
+        if(check) {
+            *bits += __builtin_popcountll(alive);
+            alive &= ~(out ^ -(uint64_t)BEBIT(ks, i));
+            if(!alive) return 0;
+        }
+    }
+    return alive;
+}
+
+// Card PRNG state n steps after x
+static inline uint32_t prng_successor(uint32_t x, uint32_t n) {
+    SWAPENDIAN(x);
+    while(n--) x = x >> 1 | (x >> 16 ^ x >> 18 ^ x >> 19 ^ x >> 21) << 31;
+    return SWAPENDIAN(x);
+}
+
+// Extract the 48-bit key from an LFSR state
+void crypto1_get_lfsr(struct Crypto1State* state, MfClassicKey* lfsr);
+
+// Load a 48-bit key into an LFSR state (the inverse of crypto1_get_lfsr)
+void crypto1_set_lfsr(struct Crypto1State* state, const MfClassicKey* lfsr);
+
+// Called for every recovered state; returns true to stop the search
+typedef bool (*Crypto1StateCallback)(void* user, const struct Crypto1State* state);
+
+// Recover the LFSR states that produce 64 consecutive keystream bits ks2 || ks3
+// without input (e.g. the ar and at words of an authentication). Each state is
+// the one before the first keystream bit. Returns the number of states reported.
+int crypto1_recover64(uint32_t ks2, uint32_t ks3, Crypto1StateCallback on_state, void* user);
+
+#endif // CRYPTO1_H
@@ -0,0 +1,2306 @@
+#include "mfkey.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "crypto1.h"
+#include "mfkey_cpu.h"
+#include "mfkey_cache.h"
+#include "mfkey_dict.h"
+#include "mfkey_dictattack.h"
+#include "mfkey_governor.h"
+#include "mfkey_hardnested.h"
+#include "mfkey_results.h"
+#include "mfkey_trace.h"
+
+// state_loop() doubles at most once per round over 12 rounds, and peeks one past the tail
+#define STATES_BUFFER_SIZE ((1 << 12) + 1)
+
+// old_recover() extends a table at most three times, each time at most doubling
+// a sub-range and writing the result from its start on, so a table of n states
+// needs room for 8 * n entries
+#define TABLE_GROWTH 8
+
+// Entries a vectorized extend_table() may read past the copy of its sub-range
+#define EXTEND_SLACK 16
+
+// Variable-length MSB buckets of one side, stored contiguously (CSR layout).
+// Bucket i holds count[i] states at states + start[i], followed by headroom so
+// old_recover() can extend it in place.
+struct MsbBuckets {
+    unsigned int* states;
+    size_t capacity;
+    int start[256];
+    int count[256];
+    unsigned int* collected; // States in range, gathered by the enumeration pass
+    size_t collected_count;
+    size_t collected_capacity;
+};
+
+// Leaf states waiting for the bitsliced check, gathered across leaf cross products
+// so that the 64 lanes stay full
+struct LeafBatch {
+    struct Crypto1State lanes[64];
+    int count;
+};
+
+// Per-recovery scratch memory
+struct MfkeyScratch {
+    unsigned int* states_buffer;
+    struct MsbBuckets even;
+    unsigned int* odd_work; // Odd bucket copied out of the (read-only) odd table
+    size_t odd_work_capacity;
+    unsigned int* extend_work; // Copy of the sub-range being extended by old_recover()
+    size_t extend_work_capacity;
+};
+
+struct KernelVariant;
+
+struct MfkeyContext {
+    MfkeyConfig config;
+    MfkeyCallbacks callbacks;
+    MfkeyCancelToken* cancel;
+    const struct KernelVariant* kernels;
+
+    // Found keys and candidate keys (static_encrypted), without duplicates
+    MfClassicKey* found_keys;
+    int found_key_count;
+    MfClassicKey* candidate_keys;
+    int candidate_key_count;
+    uint64_t* candidate_index; // Open-addressing set of packed candidates + 1 (0 = empty)
+    size_t candidate_index_size;
+
+    // Candidates of the running recovery, for the result database
+    MfClassicKey* nonce_candidates;
+    int nonce_candidate_count;
+    int nonce_candidate_capacity;
+    bool nonce_candidates_lost; // An allocation failed: the result is not stored
+    bool capture_candidates;    // Also record them without a result database (cross-check)
+
+    // Reference engine context and scratch for config.cross_check, created on first use
+    MfkeyContext* reference;
+    MfkeyScratch* reference_scratch;
+
+    MfkeyStats stats;
+};
+
+void mfkey_config_init(MfkeyConfig* config) {
+    config->msb_limit = MFKEY_DEFAULT_MSB_LIMIT;
+    config->cache_dir = NULL;
+    config->force_isa = NULL;
+    config->results_dir = NULL;
+    config->search_threads = 0;
+    config->governor = NULL;
+    config->cross_check = 0;
+}
+
+// Threads of a hardnested search
+static int search_threads(const MfkeyConfig* config) {
+    if(config->search_threads > 0) {
+        return config->search_threads;
+    }
+    return config->governor ? config->governor->workers : mfkey_cpu_budget()->usable;
+}
+
+void mfkey_cancel(MfkeyCancelToken* token) {
+    __atomic_store_n(&token->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+bool mfkey_cancel_requested(const MfkeyCancelToken* token) {
+    return __atomic_load_n(&token->cancelled, __ATOMIC_RELAXED) != 0;
+}
+
+static inline bool context_cancelled(const MfkeyContext* ctx) {
+    return ctx->cancel && mfkey_cancel_requested(ctx->cancel);
+}
+
+static void report_progress(MfkeyContext* ctx, const MfClassicNonce* n, int msb_round, float round_progress) {
+    if(!ctx->callbacks.on_progress) {
+        return;
+    }
+    MfkeyProgress progress = {n, msb_round, 256 / ctx->config.msb_limit, round_progress};
+    ctx->callbacks.on_progress(ctx->callbacks.user, &progress);
+}
+
+// Append a key to a key list unless it is already there. Returns true if added.
+// Only used for found keys, which are few.
+static bool add_unique_key(MfClassicKey** keys, int* count, const MfClassicKey* key) {
+    for(int i = 0; i < *count; i++) {
+        if(memcmp((*keys)[i].data, key->data, MF_CLASSIC_KEY_SIZE) == 0) {
+            return false; // Already found
+        }
+    }
+
+    MfClassicKey* grown = realloc(*keys, sizeof(MfClassicKey) * (*count + 1));
+    if(!grown) {
+        return false;
+    }
+    *keys = grown;
+    (*keys)[(*count)++] = *key;
+    return true;
+}
+
+static inline size_t candidate_slot(uint64_t entry, size_t size) {
+    return (size_t)((entry * 0x9E3779B97F4A7C15ULL) >> 20) & (size - 1);
+}
+
+// Append a candidate unless it is already there, looked up in the candidate index
+// (rebuilt from the list at half load). Returns true if added.
+static bool add_unique_candidate(MfkeyContext* ctx, const MfClassicKey* key) {
+    if((size_t)(ctx->candidate_key_count + 1) * 2 > ctx->candidate_index_size) {
+        size_t size = ctx->candidate_index_size ? ctx->candidate_index_size * 2 : 1024;
+        uint64_t* index = calloc(size, sizeof(uint64_t));
+        if(!index) {
+            return false;
+        }
+        for(int i = 0; i < ctx->candidate_key_count; i++) {
+            uint64_t entry = mfkey_dict_pack(ctx->candidate_keys[i].data) + 1;
+            size_t slot = candidate_slot(entry, size);
+            while(index[slot]) slot = (slot + 1) & (size - 1);
+            index[slot] = entry;
+        }
+        free(ctx->candidate_index);
+        ctx->candidate_index = index;
+        ctx->candidate_index_size = size;
+    }
+    uint64_t entry = mfkey_dict_pack(key->data) + 1;
+    size_t slot = candidate_slot(entry, ctx->candidate_index_size);
+    while(ctx->candidate_index[slot]) {
+        if(ctx->candidate_index[slot] == entry) {
+            return false; // Already found
+        }
+        slot = (slot + 1) & (ctx->candidate_index_size - 1);
+    }
+    MfClassicKey* grown = realloc(ctx->candidate_keys, sizeof(MfClassicKey) * (ctx->candidate_key_count + 1));
+    if(!grown) {
+        return false;
+    }
+    ctx->candidate_keys = grown;
+    ctx->candidate_keys[ctx->candidate_key_count++] = *key;
+    ctx->candidate_index[slot] = entry;
+    return true;
+}
+
+// Add candidate key to the list (for static_encrypted)
+static void add_candidate_key(MfkeyContext* ctx, const MfClassicNonce* n) {
+    if(ctx->config.results_dir || ctx->capture_candidates) {
+        if(ctx->nonce_candidate_count == ctx->nonce_candidate_capacity) {
+            int capacity = ctx->nonce_candidate_capacity ? ctx->nonce_candidate_capacity * 2 : 256;
+            MfClassicKey* grown = realloc(ctx->nonce_candidates, sizeof(MfClassicKey) * capacity);
+            if(grown) {
+                ctx->nonce_candidates = grown;
+                ctx->nonce_candidate_capacity = capacity;
+            }
+        }
+        if(ctx->nonce_candidate_count < ctx->nonce_candidate_capacity) {
+            ctx->nonce_candidates[ctx->nonce_candidate_count++] = n->key;
+        } else {
+            ctx->nonce_candidates_lost = true;
+        }
+    }
+    if(add_unique_candidate(ctx, &n->key) && ctx->callbacks.on_candidate) {
+        ctx->callbacks.on_candidate(ctx->callbacks.user, n, &n->key);
+    }
+}
+
+// Add found key to the list
+static void add_found_key(MfkeyContext* ctx, const MfClassicNonce* n) {
+    if(add_unique_key(&ctx->found_keys, &ctx->found_key_count, &n->key) && ctx->callbacks.on_key) {
+        ctx->callbacks.on_key(ctx->callbacks.user, n, &n->key);
+    }
+}
+
+// Leaf checks, one per attack type. Each returns 1 if the state is consistent with
+// the nonce and leaves the state to extract the key from in key_state. Keystream
+// and parity bits are compared byte by byte, most states fail on the first byte;
+// *bits counts the bits examined.
+static inline __attribute__((always_inline)) int check_state_mfkey32(
+    struct Crypto1State* t,
+    const MfClassicNonce* n,
+    struct Crypto1State* key_state,
+    int* bits) {
+    if(!(t->odd | t->even)) return 0;
+    
+    if(!rollback_word_check(t, 0, n->ar0_enc ^ n->p64, bits)) {
+        return 0;
+    }
+    rollback_word_noret(t, n->nr0_enc, 1);
+    rollback_word_noret(t, n->uid_xor_nt0, 0);
+    *key_state = *t;
+    crypt_word_noret(t, n->uid_xor_nt1, 0);
+    crypt_word_noret(t, n->nr1_enc, 1);
+    return crypt_word_check(t, 0, n->ar1_enc ^ n->p64b, bits);
+}
+
+static inline __attribute__((always_inline)) int check_state_static_nested(
+    struct Crypto1State* t,
+    const MfClassicNonce* n,
+    struct Crypto1State* key_state,
+    int* bits) {
+    if(!(t->odd | t->even)) return 0;
+    
+    *key_state = *t;
+    rollback_word_noret(t, n->uid_xor_nt1, 0);
+    if(crypt_word_check(t, n->uid_xor_nt0, n->ks1_1_enc, bits)) {
+        rollback_word_noret(key_state, n->uid_xor_nt1, 0);
+        return 1;
+    }
+    return 0;
+}
+
+// static_nested with nt0 alternatives: the state rolled back past nt1 is the
+// key state, checked against every plaintext candidate of nt0
+static inline __attribute__((always_inline)) int check_state_nested_alt(
+    struct Crypto1State* t,
+    const MfClassicNonce* n,
+    struct Crypto1State* key_state,
+    int* bits) {
+    if(!(t->odd | t->even)) return 0;
+    
+    rollback_word_noret(t, n->uid_xor_nt1, 0);
+    *key_state = *t;
+    const uint32_t nt_enc = n->nt0 ^ n->ks1_1_enc;
+    for(int i = -1; i < n->nt0_alt_count; i++) {
+        uint32_t nt0 = i < 0 ? n->nt0 : n->nt0_alt[i];
+        struct Crypto1State s = *key_state;
+        if(crypt_word_check(&s, n->uid ^ nt0, nt_enc ^ nt0, bits)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static inline __attribute__((always_inline)) int check_state_static_encrypted(
+    struct Crypto1State* t,
+    const MfClassicNonce* n,
+    struct Crypto1State* key_state,
+    int* bits) {
+    if(!(t->odd | t->even)) return 0;
+    
+    // Keystream and parity of nt0 in one rollback pass
+    if(rollback_word_par_check(t, n->uid_xor_nt0, n->ks1_1_enc, n->nt0, n->par_1, bits)) {
+        *key_state = *t;
+        return 1;
+    }
+    return 0;
+}
+// Bitsliced leaf checks: the same tests as the scalar ones on 64 states at once.
+// Return the lanes of alive still consistent with the nonce; survivors are
+// checked again by the scalar check, which extracts the key state.
+static inline __attribute__((always_inline)) uint64_t
+    check_slice_mfkey32(Crypto1Slice* t, const MfClassicNonce* n, uint64_t alive, int* bits) {
+    alive = crypto1_slice_rollback_word(t, 0, 0, true, n->ar0_enc ^ n->p64, false, 0, 0, alive, bits);
+    if(!alive) return 0;
+    crypto1_slice_rollback_word(t, n->nr0_enc, 1, false, 0, false, 0, 0, alive, bits);
+    crypto1_slice_rollback_word(t, n->uid_xor_nt0, 0, false, 0, false, 0, 0, alive, bits);
+    crypto1_slice_crypt_word(t, n->uid_xor_nt1, 0, false, 0, alive, bits);
+    crypto1_slice_crypt_word(t, n->nr1_enc, 1, false, 0, alive, bits);
+    return crypto1_slice_crypt_word(t, 0, 0, true, n->ar1_enc ^ n->p64b, alive, bits);
+}
+
+static inline __attribute__((always_inline)) uint64_t
+    check_slice_static_nested(Crypto1Slice* t, const MfClassicNonce* n, uint64_t alive, int* bits) {
+    crypto1_slice_rollback_word(t, n->uid_xor_nt1, 0, false, 0, false, 0, 0, alive, bits);
+    return crypto1_slice_crypt_word(t, n->uid_xor_nt0, 0, true, n->ks1_1_enc, alive, bits);
+}
+
+static inline __attribute__((always_inline)) uint64_t
+    check_slice_nested_alt(Crypto1Slice* t, const MfClassicNonce* n, uint64_t alive, int* bits) {
+    crypto1_slice_rollback_word(t, n->uid_xor_nt1, 0, false, 0, false, 0, 0, alive, bits);
+    const uint32_t nt_enc = n->nt0 ^ n->ks1_1_enc;
+    uint64_t match = 0;
+    for(int i = -1; i < n->nt0_alt_count; i++) {
+        uint32_t nt0 = i < 0 ? n->nt0 : n->nt0_alt[i];
+        Crypto1Slice s = *t;
+        match |= crypto1_slice_crypt_word(&s, n->uid ^ nt0, 0, true, nt_enc ^ nt0, alive, bits);
+    }
+    return match;
+}
+
+static inline __attribute__((always_inline)) uint64_t
+    check_slice_static_encrypted(Crypto1Slice* t, const MfClassicNonce* n, uint64_t alive, int* bits) {
+    return crypto1_slice_rollback_word(
+        t, n->uid_xor_nt0, 0, true, n->ks1_1_enc, true, n->nt0, n->par_1, alive, bits);
+}
+
+// Attacks whose leaf checks run bitsliced in the kernel variants, chosen by the
+// leaf checks as a recovery sees them (--bench leaf compares both). An attack
+// whose slice loses to its scalar check is switched off here.
+#define SLICED_LEAF_MFKEY32          1
+#define SLICED_LEAF_STATIC_NESTED    1
+#define SLICED_LEAF_NESTED_ALT       1
+#define SLICED_LEAF_STATIC_ENCRYPTED 1
+
+// Parity pruning. The encrypted parity bit of each of the first three nonce
+// bytes is the plain parity XOR the keystream bit that follows the byte, so it
+// only depends on the nonce and its keystream
+static bool nonce_parity_ok(uint32_t nt, uint32_t ks, uint8_t par) {
+    for(int n = 0; n < 3; n++) {
+        if((nfc_util_even_parity8(get_nth_byte(nt, n)) ^ BIT(ks, 16 - 8 * n)) != ((par >> (3 - n)) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The bit after the last byte is the filter of the odd half of the leaf state
+// (see rollback_word_par_check). Filter output it must have:
+static inline __attribute__((always_inline)) int last_parity_filter(const MfClassicNonce* n) {
+    return (n->par_1 ^ nfc_util_even_parity8(get_nth_byte(n->nt0, 3))) & 1;
+}
+
+// The odd half of a leaf is its even table state shifted left once more, so
+// bits 1..19 of the filter input are known after the last extension and bits
+// 4..19 (nibbles 1..4) already in the MSB bucket, three extensions earlier.
+// Whether a bucket state can still produce filter output want with nibble 0
+// unknown (fa of nibble 0 selects bit 4 of the fc input):
+static inline __attribute__((always_inline)) bool parity_bucket_ok(uint32_t x, int want) {
+    int f = (0x6c9c0 >> (x & 0xf) & 8) | (0x3c8b0 >> (x >> 4 & 0xf) & 4) | (0x1e458 >> (x >> 8 & 0xf) & 2) |
+            (0x0d938 >> (x >> 12 & 0xf) & 1);
+    return (int)BIT(0xEC57E80A, f) == want || (int)BIT(0xEC57E80A, f | 16) == want;
+}
+
+// Cold paths run when a leaf check matches
+static __attribute__((noinline, cold)) int
+    accept_found_key(MfkeyContext* ctx, struct Crypto1State* key_state, MfClassicNonce* n) {
+    crypto1_get_lfsr(key_state, &(n->key));
+    add_found_key(ctx, n);
+    return 1;
+}
+
+static __attribute__((noinline, cold)) int
+    accept_candidate_key(MfkeyContext* ctx, struct Crypto1State* key_state, MfClassicNonce* n) {
+    // Found key candidate - add to candidates list and keep searching
+    crypto1_get_lfsr(key_state, &(n->key));
+    add_candidate_key(ctx, n);
+    return 0;
+}
+
+static inline __attribute__((always_inline)) int state_loop(
+    unsigned int* states_buffer,
+    int xks,
+    int m1,
+    int m2,
+    unsigned int in,
+    uint8_t and_val) {
+    int states_tail = 0;
+    int round = 0, s = 0, xks_bit = 0, round_in = 0;
+
+    for(round = 1; round <= 12; round++) {
+        xks_bit = BIT(xks, round);
+        if(round > 4) {
+            round_in = ((in >> (2 * (round - 4))) & and_val) << 24;
+        }
+
+        for(s = 0; s <= states_tail; s++) {
+            states_buffer[s] <<= 1;
+            int extension = classify_extension(states_buffer[s], xks_bit);
+
+            if(extension == EXTEND_BIT0 || extension == EXTEND_BIT1) {
+                states_buffer[s] |= extension >> 1;
+                if(round > 4) {
+                    update_contribution(states_buffer, s, m1, m2);
+                    states_buffer[s] ^= round_in;
+                }
+            } else if(extension == EXTEND_BOTH) {
+                if(round > 4) {
+                    states_buffer[++states_tail] = states_buffer[s + 1];
+                    states_buffer[s + 1] = states_buffer[s] | 1;
+                    update_contribution(states_buffer, s, m1, m2);
+                    states_buffer[s++] ^= round_in;
+                    update_contribution(states_buffer, s, m1, m2);
+                    states_buffer[s] ^= round_in;
+                } else {
+                    states_buffer[++states_tail] = states_buffer[++s];
+                    states_buffer[s] = states_buffer[s - 1] | 1;
+                }
+            } else {
+                states_buffer[s--] = states_buffer[states_tail--];
+            }
+        }
+    }
+
+    return states_tail;
+}
+
+// state_loop() classifying with three composed filter() calls per state, kept
+// as the baseline for --bench filter
+static int state_loop_composed(
+    unsigned int* states_buffer,
+    int xks,
+    int m1,
+    int m2,
+    unsigned int in,
+    uint8_t and_val) {
+    int states_tail = 0;
+    int round = 0, s = 0, xks_bit = 0, round_in = 0;
+
+    for(round = 1; round <= 12; round++) {
+        xks_bit = BIT(xks, round);
+        if(round > 4) {
+            round_in = ((in >> (2 * (round - 4))) & and_val) << 24;
+        }
+
+        for(s = 0; s <= states_tail; s++) {
+            states_buffer[s] <<= 1;
+
+            if((filter(states_buffer[s]) ^ filter(states_buffer[s] | 1)) != 0) {
+                states_buffer[s] |= filter(states_buffer[s]) ^ xks_bit;
+                if(round > 4) {
+                    update_contribution(states_buffer, s, m1, m2);
+                    states_buffer[s] ^= round_in;
+                }
+            } else if(filter(states_buffer[s]) == xks_bit) {
+                if(round > 4) {
+                    states_buffer[++states_tail] = states_buffer[s + 1];
+                    states_buffer[s + 1] = states_buffer[s] | 1;
+                    update_contribution(states_buffer, s, m1, m2);
+                    states_buffer[s++] ^= round_in;
+                    update_contribution(states_buffer, s, m1, m2);
+                    states_buffer[s] ^= round_in;
+                } else {
+                    states_buffer[++states_tail] = states_buffer[++s];
+                    states_buffer[s] = states_buffer[s - 1] | 1;
+                }
+            } else {
+                states_buffer[s--] = states_buffer[states_tail--];
+            }
+        }
+    }
+
+    return states_tail;
+}
+
+static inline __attribute__((always_inline)) int binsearch(unsigned int data[], int start, int stop) {
+    int mid, val = data[stop] & 0xff000000;
+    while(start != stop) {
+        mid = (stop - start) >> 1;
+        if((data[start + mid] ^ 0x80000000) > (val ^ 0x80000000))
+            stop = start + mid;
+        else
+            start += mid + 1;
+    }
+    return start;
+}
+
+static inline __attribute__((always_inline)) int
+    extend_table(unsigned int data[], int tbl, int end, int bit, int m1, int m2, unsigned int in) {
+    in <<= 24;
+    for(data[tbl] <<= 1; tbl <= end; data[++tbl] <<= 1) {
+        int extension = classify_extension(data[tbl], bit);
+        if(extension == EXTEND_BIT0 || extension == EXTEND_BIT1) {
+            data[tbl] |= extension >> 1;
+            update_contribution(data, tbl, m1, m2);
+            data[tbl] ^= in;
+        } else if(extension == EXTEND_BOTH) {
+            data[++end] = data[tbl + 1];
+            data[tbl + 1] = data[tbl] | 1;
+            update_contribution(data, tbl, m1, m2);
+            data[tbl++] ^= in;
+            update_contribution(data, tbl, m1, m2);
+            data[tbl] ^= in;
+        } else {
+            data[tbl--] = data[end--];
+        }
+    }
+    return end;
+}
+
+// Make room for at least needed entries in a growable state array
+static bool reserve_states(unsigned int** states, size_t* capacity, size_t needed) {
+    if(needed <= *capacity) {
+        return true;
+    }
+    size_t new_capacity = *capacity ? *capacity : 4096;
+    while(new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    unsigned int* grown = realloc(*states, sizeof(unsigned int) * new_capacity);
+    if(!grown) {
+        return false;
+    }
+    *states = grown;
+    *capacity = new_capacity;
+    return true;
+}
+
+// Recovery kernels specialized per attack type (see mfkey_kernel_attack.inc)
+typedef int (*CalculateMsbTablesFn)(
+    MfkeyContext* ctx,
+    int oks,
+    int eks,
+    int msb_round,
+    MfClassicNonce* n,
+    const MfkeyOddTable* odd_table,
+    MfkeyScratch* scratch,
+    unsigned int in,
+    bool collected);
+
+// Kernel of a nonce: its attack type, or KERNEL_NESTED_ALT for static_nested
+// nonces with nt0 alternatives (hardnested nonces have no tables)
+#define KERNEL_NESTED_ALT 4
+
+static inline int kernel_index(const MfClassicNonce* n) {
+    return n->attack == static_nested && n->nt0_alt_count > 0 ? KERNEL_NESTED_ALT : (int)n->attack;
+}
+
+// Hot kernels compiled for one instruction set (see mfkey_kernel.inc)
+typedef struct KernelVariant {
+    const char* name;
+    bool (*cpu_ok)(void);
+    bool (*expand_odd)(MfkeyContext* ctx, int oks, unsigned int* states_buffer, MfkeyOddTable* table);
+    double (*sample_expansion)(
+        unsigned int* states_buffer, int ks, int m1, int m2, unsigned int in, uint8_t and_val, int samples, double* survival);
+    int (*collect_even)( // Even buckets of one MSB round into scratch->even
+        MfkeyContext* ctx, int eks, int msb_round, const MfClassicNonce* n, MfkeyScratch* scratch, unsigned int in);
+    CalculateMsbTablesFn calculate_msb_tables[5]; // Indexed by kernel_index()
+    MfkeyHardSearchFn hard_search;
+    int (*extend_table)( // Compacting extend_table(), for --bench extend
+        unsigned int data[], unsigned int work[], int tbl, int end, int bit, int m1, int m2, unsigned int in);
+    MfkeyDictCheckFn dict_check;
+} KernelVariant;
+
+// Reference engine: the scalar path that the optimized variants are checked
+// against (--engine reference, --cross-check). Never picked automatically.
+#define KERNEL_REFERENCE 1
+#define KERNEL_ISA    reference
+#define KERNEL_TARGET
+#define KERNEL_CPU_OK true
+#define KERNEL_VECTOR 16
+#include "mfkey_kernel.inc"
+#undef KERNEL_REFERENCE
+
+#define KERNEL_ISA    generic
+#define KERNEL_TARGET
+#define KERNEL_CPU_OK true
+#define KERNEL_VECTOR 16
+#include "mfkey_kernel.inc"
+
+#if defined(MFKEY_CPU_X86) && defined(__GNUC__)
+#define KERNEL_ISA    sse42
+#define KERNEL_TARGET __attribute__((target("sse4.2,popcnt")))
+#define KERNEL_CPU_OK (mfkey_cpu_features()->sse42 && mfkey_cpu_features()->popcnt)
+#define KERNEL_VECTOR 16
+#include "mfkey_kernel.inc"
+
+#define KERNEL_ISA    avx2
+#define KERNEL_TARGET __attribute__((target("avx2,bmi,bmi2,lzcnt,popcnt,sse4.2")))
+#define KERNEL_CPU_OK (mfkey_cpu_features()->avx2 && mfkey_cpu_features()->bmi2 && mfkey_cpu_features()->popcnt)
+#define KERNEL_VECTOR 32
+#include "mfkey_kernel.inc"
+
+#define KERNEL_ISA    avx512
+#define KERNEL_TARGET __attribute__((target("avx512f,avx512bw,avx512vl,avx2,bmi,bmi2,lzcnt,popcnt,sse4.2")))
+#define KERNEL_CPU_OK (mfkey_cpu_features()->avx512f && mfkey_cpu_features()->avx512bw && \
+                       mfkey_cpu_features()->avx512vl && mfkey_cpu_features()->bmi2)
+#define KERNEL_VECTOR 64
+#include "mfkey_kernel.inc"
+#endif
+
+#if defined(MFKEY_CPU_ARM64) && defined(__linux__) && defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 10
+#define MFKEY_KERNEL_SVE 1
+#define KERNEL_ISA    sve
+#define KERNEL_TARGET __attribute__((target("arch=armv8.2-a+sve")))
+#define KERNEL_CPU_OK (mfkey_cpu_features()->sve)
+#define KERNEL_VECTOR 16
+#include "mfkey_kernel.inc"
+#endif
+
+// Kernel variants in order of preference (last supported one wins). The
+// reference engine comes first and is only used when forced.
+static const KernelVariant* const kernel_variants[] = {
+    &kernel_variant_reference,
+    &kernel_variant_generic,
+#if defined(MFKEY_CPU_X86) && defined(__GNUC__)
+    &kernel_variant_sse42,
+    &kernel_variant_avx2,
+    &kernel_variant_avx512,
+#endif
+#ifdef MFKEY_KERNEL_SVE
+    &kernel_variant_sve,
+#endif
+};
+
+#define KERNEL_VARIANT_COUNT ((int)(sizeof(kernel_variants) / sizeof(kernel_variants[0])))
+
+// Select the best variant for this CPU, or the forced one if it is supported
+static const KernelVariant* select_kernels(const char* force_isa) {
+    const KernelVariant* selected = &kernel_variant_generic;
+    for(int i = 0; i < KERNEL_VARIANT_COUNT; i++) {
+        const KernelVariant* variant = kernel_variants[i];
+        if(force_isa) {
+            if(strcmp(variant->name, force_isa) != 0) continue;
+            if(!variant->cpu_ok()) {
+                fprintf(stderr, "Kernel variant '%s' is not supported by this CPU\n", force_isa);
+                return NULL;
+            }
+            return variant;
+        }
+        if(variant->cpu_ok()) {
+            selected = variant;
+        }
+    }
+    if(force_isa) {
+        fprintf(stderr, "Unknown kernel variant: %s\n", force_isa);
+        return NULL;
+    }
+    return selected;
+}
+
+int mfkey_kernel_variant_count(void) {
+    return KERNEL_VARIANT_COUNT;
+}
+
+const char* mfkey_kernel_variant_name(int index) {
+    return kernel_variants[index]->name;
+}
+
+bool mfkey_kernel_variant_supported(int index) {
+    return kernel_variants[index]->cpu_ok();
+}
+
+const char* mfkey_attack_name(AttackType attack) {
+    switch(attack) {
+        case mfkey32:
+            return "mfkey32";
+        case static_nested:
+            return "static_nested";
+        case static_encrypted:
+            return "static_encrypted";
+        case hardnested:
+            return "hardnested";
+    }
+    return "unknown";
+}
+
+static pthread_once_t global_init_once = PTHREAD_ONCE_INIT;
+
+void mfkey_global_init(void) {
+    pthread_once(&global_init_once, crypto1_init_tables);
+}
+
+MfkeyContext* mfkey_context_new(const MfkeyConfig* config, const MfkeyCallbacks* callbacks, MfkeyCancelToken* cancel) {
+    const KernelVariant* kernels = select_kernels(config->force_isa);
+    if(!kernels) {
+        return NULL;
+    }
+    if(config->msb_limit <= 0 || config->msb_limit > 256 || 256 % config->msb_limit != 0) {
+        fprintf(stderr, "Invalid MSB limit: %d\n", config->msb_limit);
+        return NULL;
+    }
+
+    MfkeyContext* ctx = calloc(1, sizeof(MfkeyContext));
+    if(!ctx) {
+        return NULL;
+    }
+    ctx->config = *config;
+    if(callbacks) {
+        ctx->callbacks = *callbacks;
+    }
+    ctx->cancel = cancel;
+    ctx->kernels = kernels;
+    ctx->capture_candidates = config->cross_check > 0;
+
+    mfkey_global_init();
+    return ctx;
+}
+
+void mfkey_context_free(MfkeyContext* ctx) {
+    if(!ctx) {
+        return;
+    }
+    free(ctx->found_keys);
+    free(ctx->candidate_keys);
+    free(ctx->candidate_index);
+    free(ctx->nonce_candidates);
+    mfkey_context_free(ctx->reference);
+    mfkey_scratch_free(ctx->reference_scratch);
+    free(ctx);
+}
+
+bool mfkey_dict_attack(const MfkeyConfig* config, const MfkeyDictKeys* dict, MfClassicNonce* n) {
+    const KernelVariant* kernels = select_kernels(config->force_isa);
+    if(!kernels) {
+        return false;
+    }
+    for(size_t block = 0; block < dict->block_count; block++) {
+        uint64_t alive[MFKEY_DICT_LANES / 64];
+        kernels->dict_check(n, dict->planes + block * 48, alive);
+        for(int w = 0; w < MFKEY_DICT_LANES / 64; w++) {
+            while(alive[w]) {
+                size_t i = block * MFKEY_DICT_LANES + w * 64 + __builtin_ctzll(alive[w]);
+                alive[w] &= alive[w] - 1;
+                if(i < dict->count && mfkey_dictattack_check(n, &dict->keys[i])) {
+                    n->key = dict->keys[i];
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+const char* mfkey_context_kernel(const MfkeyContext* ctx) {
+    return ctx->kernels->name;
+}
+
+const MfClassicKey* mfkey_found_keys(const MfkeyContext* ctx, int* count) {
+    *count = ctx->found_key_count;
+    return ctx->found_keys;
+}
+
+const MfClassicKey* mfkey_candidate_keys(const MfkeyContext* ctx, int* count) {
+    *count = ctx->candidate_key_count;
+    return ctx->candidate_keys;
+}
+
+void mfkey_clear_candidates(MfkeyContext* ctx) {
+    free(ctx->candidate_keys);
+    free(ctx->candidate_index);
+    ctx->candidate_keys = NULL;
+    ctx->candidate_key_count = 0;
+    ctx->candidate_index = NULL;
+    ctx->candidate_index_size = 0;
+}
+
+uint64_t mfkey_context_leaf_checks(const MfkeyContext* ctx) {
+    return __atomic_load_n(&ctx->stats.leaf_checks, __ATOMIC_RELAXED);
+}
+
+void mfkey_get_stats(const MfkeyContext* ctx, MfkeyStats* stats) {
+    *stats = ctx->stats;
+}
+
+MfkeyScratch* mfkey_scratch_new(void) {
+    // Bucket storage grows on demand
+    MfkeyScratch* scratch = calloc(1, sizeof(MfkeyScratch));
+    if(!scratch) {
+        return NULL;
+    }
+    scratch->states_buffer = malloc(sizeof(unsigned int) * STATES_BUFFER_SIZE);
+    if(!scratch->states_buffer) {
+        free(scratch);
+        return NULL;
+    }
+    return scratch;
+}
+
+void mfkey_scratch_free(MfkeyScratch* scratch) {
+    if(!scratch) {
+        return;
+    }
+    free(scratch->states_buffer);
+    free(scratch->even.states);
+    free(scratch->even.collected);
+    free(scratch->odd_work);
+    free(scratch->extend_work);
+    free(scratch);
+}
+
+// Get the odd-half expansion for a keystream, from the cache directory if possible
+static bool load_odd_table(MfkeyContext* ctx, int oks, unsigned int* states_buffer, MfkeyOddTable* odd_table) {
+    const char* cache_dir = ctx->config.cache_dir;
+    uint32_t prefix = mfkey_cache_prefix(oks);
+    if(cache_dir && mfkey_cache_load(cache_dir, prefix, odd_table)) {
+        return true;
+    }
+    if(!ctx->kernels->expand_odd(ctx, oks, states_buffer, odd_table)) {
+        return false;
+    }
+    if(cache_dir) {
+        mfkey_cache_store(cache_dir, prefix, odd_table);
+    }
+    return true;
+}
+
+typedef struct {
+    MfkeyContext* ctx;
+    MfClassicNonce* n;
+    bool found;
+} Recover64Job;
+
+// Roll a state recovered from ar0/at0 back to the key and check it against the second pair
+static bool recover64_check_state(void* user, const struct Crypto1State* state) {
+    Recover64Job* job = user;
+    const MfClassicNonce* n = job->n;
+    struct Crypto1State t = *state, key_state;
+    rollback_word_noret(&t, n->nr0_enc, 1);
+    rollback_word_noret(&t, n->uid_xor_nt0, 0);
+    key_state = t;
+    if(n->has_nt1) {
+        crypt_word_noret(&t, n->uid_xor_nt1, 0);
+        crypt_word_noret(&t, n->nr1_enc, 1);
+        int bits = 0;
+        bool match = crypt_word_check(&t, 0, n->ar1_enc ^ n->p64b, &bits);
+        __atomic_store_n(&job->ctx->stats.leaf_checks, job->ctx->stats.leaf_checks + 1, __ATOMIC_RELAXED);
+        job->ctx->stats.leaf_bits += bits;
+        if(!match) {
+            return false;
+        }
+        job->ctx->stats.leaf_matches++;
+    }
+    job->found = accept_found_key(job->ctx, &key_state, job->n);
+    return true;
+}
+
+// mfkey32 with the tag answer: ar0 and at0 give 64 consecutive keystream bits,
+// enough to solve the state directly instead of joining 32-bit half tables
+static bool recover_mfkey64(MfkeyContext* ctx, MfClassicNonce* n) {
+    Recover64Job job = {ctx, n, false};
+    crypto1_recover64(n->ar0_enc ^ n->p64, n->at0_enc ^ n->p96, recover64_check_state, &job);
+    report_progress(ctx, n, 256 / ctx->config.msb_limit, 100.0);
+    return job.found;
+}
+
+// Keystream word the tables are built from, split into its odd and even bits,
+// and the nonce input of the even half
+static void split_keystream(const MfClassicNonce* n, int* oks, int* eks, uint32_t* in) {
+    uint32_t ks2;
+    switch(n->attack) {
+        case mfkey32:
+            ks2 = n->ar0_enc ^ n->p64;
+            *in = 0;
+            break;
+        case static_nested:
+            ks2 = n->ks1_2_enc;
+            *in = n->uid_xor_nt1;
+            break;
+        default:
+            ks2 = n->ks1_1_enc;
+            *in = n->uid_xor_nt0;
+            break;
+    }
+    *oks = 0;
+    *eks = 0;
+    for(int i = 31; i >= 0; i -= 2) {
+        *oks = *oks << 1 | BEBIT(ks2, i);
+    }
+    for(int i = 30; i >= 0; i -= 2) {
+        *eks = *eks << 1 | BEBIT(ks2, i);
+    }
+}
+
+// Reference engine state of one nonce under cross-check
+typedef struct {
+    MfkeyOddTable odd; // Expanded by the reference engine on the first sampled round
+    bool odd_loaded;
+} CrossCheck;
+
+// Create the reference engine context of a cross-checked context
+static bool cross_check_init(MfkeyContext* ctx) {
+    if(ctx->reference) {
+        return true;
+    }
+    MfkeyConfig config = ctx->config;
+    config.force_isa = "reference";
+    config.cache_dir = NULL;
+    config.results_dir = NULL;
+    config.governor = NULL;
+    config.cross_check = 0;
+    ctx->reference = mfkey_context_new(&config, NULL, ctx->cancel);
+    ctx->reference_scratch = mfkey_scratch_new();
+    if(!ctx->reference || !ctx->reference_scratch) {
+        mfkey_context_free(ctx->reference);
+        mfkey_scratch_free(ctx->reference_scratch);
+        ctx->reference = NULL;
+        ctx->reference_scratch = NULL;
+        return false;
+    }
+    ctx->reference->capture_candidates = true;
+    return true;
+}
+
+// Pick the MSB rounds to cross-check: a hash of the nonce and the round, so that
+// reruns check the same rounds
+static bool cross_check_sampled(const MfkeyContext* ctx, const MfClassicNonce* n, int oks, int eks, int msb_round) {
+    uint64_t h = ((uint64_t)n->uid << 32 | n->nt0) ^ ((uint64_t)n->nt1 << 32 | (uint32_t)msb_round) * 0x9E3779B97F4A7C15ULL;
+    h ^= ((uint64_t)(uint32_t)oks << 32 | (uint32_t)eks) * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 31;
+    h *= 0x94D049BB133111EBULL;
+    h ^= h >> 29;
+    return (h >> 11) * 0x1.0p-53 < ctx->config.cross_check;
+}
+
+static void cross_check_report(const MfkeyContext* ctx, const MfClassicNonce* n, int msb_round, const char* what) {
+    fprintf(
+        stderr,
+        "CROSS-CHECK MISMATCH: %s engine differs from reference in %s (%s, uid %08x, sector %d key %c, MSB round %d)\n",
+        ctx->kernels->name,
+        what,
+        mfkey_attack_name(n->attack),
+        n->uid,
+        n->sector,
+        n->key_type,
+        msb_round + 1);
+}
+
+static bool odd_tables_equal(const MfkeyOddTable* a, const MfkeyOddTable* b) {
+    return a->count == b->count && memcmp(a->offsets, b->offsets, sizeof(uint32_t) * 257) == 0 &&
+           memcmp(a->states, b->states, sizeof(uint32_t) * a->count) == 0;
+}
+
+static bool buckets_equal(const struct MsbBuckets* a, const struct MsbBuckets* b, int msb_limit) {
+    for(int i = 0; i < msb_limit; i++) {
+        if(a->count[i] != b->count[i] ||
+           memcmp(a->states + a->start[i], b->states + b->start[i], sizeof(unsigned int) * a->count[i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int compare_packed(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Packed keys, sorted without duplicates. Returns the count, or -1 on allocation failure.
+static int pack_key_set(const MfClassicKey* keys, int count, uint64_t** packed) {
+    *packed = malloc(sizeof(uint64_t) * (count ? count : 1));
+    if(!*packed) {
+        return -1;
+    }
+    for(int i = 0; i < count; i++) {
+        (*packed)[i] = mfkey_dict_pack(keys[i].data);
+    }
+    qsort(*packed, count, sizeof(uint64_t), compare_packed);
+    int unique = 0;
+    for(int i = 0; i < count; i++) {
+        if(unique == 0 || (*packed)[i] != (*packed)[unique - 1]) {
+            (*packed)[unique++] = (*packed)[i];
+        }
+    }
+    return unique;
+}
+
+// Whether two key lists hold the same keys. Lists that cannot be compared
+// (allocation failure) count as equal.
+static bool same_keys(const MfClassicKey* a, int a_count, const MfClassicKey* b, int b_count) {
+    uint64_t *x, *y;
+    int x_count = pack_key_set(a, a_count, &x);
+    int y_count = pack_key_set(b, b_count, &y);
+    bool same = x_count < 0 || y_count < 0 ||
+                (x_count == y_count && memcmp(x, y, sizeof(uint64_t) * x_count) == 0);
+    free(x);
+    free(y);
+    return same;
+}
+
+// Run one MSB round on the engine of the context and on the reference engine,
+// and compare the odd table, the even buckets, the key found and the candidates.
+// A mismatch is reported and the keys of the reference are kept. Returns as the
+// calculate_msb_tables kernels.
+static int cross_check_round(
+    MfkeyContext* ctx,
+    MfkeyScratch* scratch,
+    MfClassicNonce* n,
+    const MfkeyOddTable* odd_table,
+    CrossCheck* cross,
+    int oks,
+    int eks,
+    uint32_t in,
+    int msb_round) {
+    if(!cross_check_init(ctx)) {
+        return -1;
+    }
+    MfkeyContext* ref = ctx->reference;
+    MfkeyScratch* ref_scratch = ctx->reference_scratch;
+    bool mismatch = false;
+
+    if(!cross->odd_loaded) {
+        if(!ref->kernels->expand_odd(ref, oks, ref_scratch->states_buffer, &cross->odd)) {
+            return context_cancelled(ctx) ? 0 : -1;
+        }
+        cross->odd_loaded = true;
+        if(!odd_tables_equal(odd_table, &cross->odd)) {
+            cross_check_report(ctx, n, msb_round, "the odd table");
+            mismatch = true;
+        }
+    }
+
+    int res = ctx->kernels->collect_even(ctx, eks, msb_round, n, scratch, in);
+    if(res == 0) {
+        res = ref->kernels->collect_even(ref, eks, msb_round, n, ref_scratch, in);
+    }
+    if(res != 0) {
+        return res < 0 ? -1 : 0;
+    }
+    if(!buckets_equal(&scratch->even, &ref_scratch->even, ctx->config.msb_limit)) {
+        cross_check_report(ctx, n, msb_round, "the even buckets");
+        mismatch = true;
+    }
+
+    int first = ctx->nonce_candidate_count;
+    int engine = ctx->kernels->calculate_msb_tables[kernel_index(n)](
+        ctx, oks, eks, msb_round, n, odd_table, scratch, in, true);
+    if(engine < 0) {
+        return -1;
+    }
+    MfClassicNonce copy = *n;
+    mfkey_clear_candidates(ref);
+    ref->nonce_candidate_count = 0;
+    ref->nonce_candidates_lost = false;
+    uint64_t trace_start = mfkey_trace_begin();
+    int reference = ref->kernels->calculate_msb_tables[kernel_index(n)](
+        ref, oks, eks, msb_round, &copy, &cross->odd, ref_scratch, in, true);
+    mfkey_trace_end(trace_start, "cross-check", "msb_round", msb_round);
+    if(reference < 0) {
+        return -1;
+    }
+    // A round cut short cannot be compared
+    if(context_cancelled(ctx)) {
+        return engine;
+    }
+
+    ctx->stats.cross_checks++;
+    if(engine != reference || (engine && memcmp(n->key.data, copy.key.data, MF_CLASSIC_KEY_SIZE) != 0)) {
+        cross_check_report(ctx, n, msb_round, "the key found");
+        mismatch = true;
+    }
+    if(!ctx->nonce_candidates_lost && !ref->nonce_candidates_lost &&
+       !same_keys(ctx->nonce_candidates + first, ctx->nonce_candidate_count - first,
+                  ref->nonce_candidates, ref->nonce_candidate_count)) {
+        cross_check_report(ctx, n, msb_round, "the candidate keys");
+        mismatch = true;
+    }
+    if(!mismatch) {
+        return engine;
+    }
+
+    ctx->stats.cross_check_mismatches++;
+    for(int i = 0; i < ref->nonce_candidate_count; i++) {
+        n->key = ref->nonce_candidates[i];
+        add_candidate_key(ctx, n);
+    }
+    if(reference) {
+        n->key = copy.key;
+        add_found_key(ctx, n);
+    }
+    return reference;
+}
+
+// Cross-check a nonce ruled out by its parity bits: run its sampled MSB rounds on
+// the reference engine and check that they find no key either. A mismatch is
+// reported and the keys of the reference are kept. Returns true if one was found.
+static bool cross_check_pruned(MfkeyContext* ctx, MfClassicNonce* n, int oks, int eks, uint32_t in) {
+    CrossCheck cross = {0};
+    bool found = false;
+    int msb_rounds = 256 / ctx->config.msb_limit;
+    for(int msb = 0; msb < msb_rounds && !found && !context_cancelled(ctx); msb++) {
+        if(!cross_check_sampled(ctx, n, oks, eks, msb)) {
+            continue;
+        }
+        if(!cross_check_init(ctx)) {
+            break;
+        }
+        MfkeyContext* ref = ctx->reference;
+        if(!cross.odd_loaded) {
+            if(!ref->kernels->expand_odd(ref, oks, ctx->reference_scratch->states_buffer, &cross.odd)) {
+                break;
+            }
+            cross.odd_loaded = true;
+        }
+        MfClassicNonce copy = *n;
+        mfkey_clear_candidates(ref);
+        ref->nonce_candidate_count = 0;
+        ref->nonce_candidates_lost = false;
+        uint64_t trace_start = mfkey_trace_begin();
+        int reference = ref->kernels->calculate_msb_tables[kernel_index(n)](
+            ref, oks, eks, msb, &copy, &cross.odd, ctx->reference_scratch, in, false);
+        mfkey_trace_end(trace_start, "cross-check", "msb_round", msb);
+        if(reference < 0 || context_cancelled(ctx)) {
+            break;
+        }
+
+        ctx->stats.cross_checks++;
+        if(!reference && ref->nonce_candidate_count == 0 && !ref->nonce_candidates_lost) {
+            continue;
+        }
+        cross_check_report(ctx, n, msb, "the nonce parity check");
+        ctx->stats.cross_check_mismatches++;
+        for(int i = 0; i < ref->nonce_candidate_count; i++) {
+            n->key = ref->nonce_candidates[i];
+            add_candidate_key(ctx, n);
+        }
+        if(reference) {
+            n->key = copy.key;
+            add_found_key(ctx, n);
+            found = true;
+        }
+    }
+    if(cross.odd_loaded) {
+        mfkey_odd_table_free(&cross.odd);
+    }
+    return found;
+}
+
+// Join the odd and even half tables, one MSB round at a time. *complete is
+// cleared if the search stopped before covering every round without a key.
+static bool recover_tables(MfkeyContext* ctx, MfkeyScratch* scratch, MfClassicNonce* n, bool* complete) {
+    bool found = false;
+    uint32_t in;
+    int oks, eks, msb;
+    CrossCheck cross = {0};
+    split_keystream(n, &oks, &eks, &in);
+    
+    // A static_encrypted nonce whose first parity bits disagree with its
+    // keystream has no consistent state: the search is complete without tables.
+    // The reference engine does not prune, so cross-check can catch a bad exit.
+    if(n->attack == static_encrypted && ctx->kernels != &kernel_variant_reference &&
+       !nonce_parity_ok(n->nt0, n->ks1_1_enc, n->par_1)) {
+        ctx->stats.parity_nonces_pruned++;
+        found = ctx->config.cross_check > 0 && cross_check_pruned(ctx, n, oks, eks, in);
+        if(!found && !context_cancelled(ctx)) {
+            report_progress(ctx, n, 256 / ctx->config.msb_limit, 100.0);
+        }
+        return found;
+    }
+
+    // Pick the attack-specialized kernel once per nonce
+    CalculateMsbTablesFn calculate_msb_tables = ctx->kernels->calculate_msb_tables[kernel_index(n)];
+    
+    // The odd half is expanded once for all MSB rounds
+    MfkeyOddTable odd_table;
+    uint64_t trace_start = mfkey_trace_begin();
+    if(!load_odd_table(ctx, oks, scratch->states_buffer, &odd_table)) {
+        *complete = false;
+        return false;
+    }
+    mfkey_trace_end(trace_start, "odd table", "prefix", mfkey_cache_prefix(oks));
+    
+    int msb_rounds = 256 / ctx->config.msb_limit;
+    for(msb = 0; msb < msb_rounds; msb++) {
+        trace_start = mfkey_trace_begin();
+        int res = ctx->config.cross_check > 0 && cross_check_sampled(ctx, n, oks, eks, msb) ?
+                      cross_check_round(ctx, scratch, n, &odd_table, &cross, oks, eks, in, msb) :
+                      calculate_msb_tables(ctx, oks, eks, msb, n, &odd_table, scratch, in, false);
+        mfkey_trace_end(trace_start, "msb round", "msb_round", msb);
+        if(res < 0) {
+            fprintf(stderr, "Memory allocation failed!\n");
+            *complete = false;
+            break;
+        }
+        if(res) {
+            found = true;
+            // Key found is reported by the on_key callback
+            break;
+        }
+        if(context_cancelled(ctx)) {
+            break;
+        }
+        
+        // Complete current MSB round
+        report_progress(ctx, n, msb + 1, 100.0);
+    }
+    
+    mfkey_odd_table_free(&odd_table);
+    if(cross.odd_loaded) {
+        mfkey_odd_table_free(&cross.odd);
+    }
+    return found;
+}
+
+typedef struct {
+    MfkeyContext* ctx;
+    MfClassicNonce* n;
+    MfkeyHardSearch* search;
+    uint64_t leaf_checks; // Of the context before the search
+} HardProgress;
+
+// Hardnested progress, spread over the MSB rounds the progress callbacks expect
+static void hard_progress(void* user, double fraction) {
+    HardProgress* progress = user;
+    MfkeyContext* ctx = progress->ctx;
+    uint64_t states = __atomic_load_n(&progress->search->states, __ATOMIC_RELAXED);
+    __atomic_store_n(&ctx->stats.leaf_checks, progress->leaf_checks + states, __ATOMIC_RELAXED);
+    int msb_rounds = 256 / ctx->config.msb_limit;
+    double position = fraction * msb_rounds;
+    int msb_round = (int)position < msb_rounds ? (int)position : msb_rounds - 1;
+    report_progress(ctx, progress->n, msb_round + 1, (float)((position - msb_round) * 100.0));
+}
+
+// Hardnested: match the first byte sums, then search the candidate halves on
+// config.search_threads threads. *complete is cleared if the search stopped early.
+static bool recover_hardnested(MfkeyContext* ctx, MfClassicNonce* n, bool* complete) {
+    MfkeyHardPlan plan;
+    uint64_t trace_start = mfkey_trace_begin();
+    if(!mfkey_hardnested_plan(n, &plan)) {
+        fprintf(stderr, "Memory allocation failed!\n");
+        *complete = false;
+        return false;
+    }
+    mfkey_trace_end(trace_start, "hardnested plan", "pairs", plan.pair_count);
+
+    MfkeyHardSearch search = {0};
+    HardProgress progress = {ctx, n, &search, ctx->stats.leaf_checks};
+    search.cancel = ctx->cancel;
+    search.on_progress = hard_progress;
+    search.user = &progress;
+    if(!mfkey_hardnested_search(n, &plan, ctx->kernels->hard_search, search_threads(&ctx->config), ctx->config.governor, &search)) {
+        fprintf(stderr, "Failed to start the hardnested search\n");
+        *complete = false;
+    }
+    __atomic_store_n(&ctx->stats.leaf_checks, progress.leaf_checks + search.states, __ATOMIC_RELAXED);
+    ctx->stats.leaf_matches += search.matches;
+    mfkey_hardnested_plan_free(&plan);
+
+    if(search.found) {
+        accept_found_key(ctx, &search.key_state, n);
+    }
+    if(search.found || (*complete && !context_cancelled(ctx))) {
+        report_progress(ctx, n, 256 / ctx->config.msb_limit, 100.0);
+    }
+    return search.found;
+}
+
+// Replay a stored result through the callbacks. Returns false on a miss.
+static bool replay_result(MfkeyContext* ctx, MfClassicNonce* n, bool* found) {
+    MfkeyResult result;
+    if(!mfkey_result_load(ctx->config.results_dir, n, &result)) {
+        return false;
+    }
+    ctx->stats.result_hits++;
+    for(uint32_t i = 0; i < result.candidate_count; i++) {
+        n->key = result.candidates[i];
+        add_candidate_key(ctx, n);
+    }
+    if(result.found) {
+        n->key = result.key;
+        add_found_key(ctx, n);
+    }
+    *found = result.found;
+    mfkey_result_free(&result);
+    report_progress(ctx, n, 256 / ctx->config.msb_limit, 100.0);
+    return true;
+}
+
+bool mfkey_recover(MfkeyContext* ctx, MfkeyScratch* scratch, MfClassicNonce* n) {
+    const char* results_dir = ctx->config.results_dir;
+    bool found = false, complete = true;
+    uint64_t trace_start = mfkey_trace_begin();
+    if(results_dir && replay_result(ctx, n, &found)) {
+        mfkey_trace_end(trace_start, "stored result", "uid", n->uid);
+        return found;
+    }
+
+    ctx->nonce_candidate_count = 0;
+    ctx->nonce_candidates_lost = false;
+    if(n->attack == mfkey32 && n->has_at0) {
+        found = recover_mfkey64(ctx, n);
+    } else if(n->attack == hardnested) {
+        found = recover_hardnested(ctx, n, &complete);
+    } else {
+        found = recover_tables(ctx, scratch, n, &complete);
+    }
+
+    // A search cut short proves nothing about the keys it did not reach
+    if(results_dir && (found || (complete && !context_cancelled(ctx))) && !ctx->nonce_candidates_lost) {
+        MfkeyResult result = {found, n->key, ctx->nonce_candidates, (uint32_t)ctx->nonce_candidate_count};
+        mfkey_result_store(results_dir, n, &result);
+    }
+    mfkey_trace_end(trace_start, mfkey_attack_name(n->attack), "uid", n->uid);
+    return found;
+}
+
+// Semi-states sampled per half by mfkey_estimate(), out of 2^20
+#define ESTIMATE_SAMPLES 16384
+// Timed samples converting sampled work into seconds, once per process
+#define ESTIMATE_CALIBRATION_RUNS 8
+// Traced phase times relative to the sampled expansion: the odd table is also
+// sorted and deduplicated, an MSB round joins and checks leaves but only stores
+// the states in its range
+#define ESTIMATE_ODD_FACTOR   1.5
+#define ESTIMATE_ROUND_FACTOR 1.0
+// mfkey32 with at0 solves the state directly
+#define ESTIMATE_MFKEY64_SECONDS 0.002
+// Kernel calls timed per run to calibrate the hardnested search
+#define ESTIMATE_HARD_CALLS 256
+
+// Seconds per unit of sampled work, measured once per kernel variant
+static pthread_mutex_t calibration_lock = PTHREAD_MUTEX_INITIALIZER;
+static const KernelVariant* calibrated_kernels;
+static double estimate_unit_seconds;
+
+// Time the expansion of a fixed keystream with the kernels the recovery will use
+static double unit_seconds(const KernelVariant* kernels) {
+    pthread_mutex_lock(&calibration_lock);
+    if(calibrated_kernels != kernels) {
+        unsigned int states_buffer[STATES_BUFFER_SIZE];
+        const unsigned int in = 0x2468ace0;
+        kernels->sample_expansion(states_buffer, 0x5a5a, CONST_M1_2, CONST_M2_2, in, 3, ESTIMATE_SAMPLES, NULL);
+        // The fastest of several runs: preemption only ever adds time
+        estimate_unit_seconds = 0;
+        for(int run = 0; run < ESTIMATE_CALIBRATION_RUNS; run++) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            double work = kernels->sample_expansion(
+                states_buffer, 0x5a5a, CONST_M1_2, CONST_M2_2, in, 3, ESTIMATE_SAMPLES, NULL);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            double per_unit = seconds / (work * ESTIMATE_SAMPLES);
+            if(run == 0 || per_unit < estimate_unit_seconds) {
+                estimate_unit_seconds = per_unit;
+            }
+        }
+        calibrated_kernels = kernels;
+    }
+    double result = estimate_unit_seconds;
+    pthread_mutex_unlock(&calibration_lock);
+    return result;
+}
+
+static const KernelVariant* hard_calibrated_kernels;
+static double hard_state_seconds;
+
+// Time the hardnested search kernel on a block of copies of a key's own state
+// against nonces generated from it: no lane drops out, so the whole first byte
+// tree and every kernel nonce is walked, the worst case. Returns seconds per state.
+static double hard_seconds_per_state(const KernelVariant* kernels) {
+    pthread_mutex_lock(&calibration_lock);
+    if(hard_calibrated_kernels != kernels) {
+        static MfClassicNonce n;
+        static MfkeyHardLog log;
+        static MfkeyHardLanes planes[24];
+        const struct Crypto1State key_state = {0x5a3c96, 0xc3a50f};
+        uint64_t alive[MFKEY_HARD_LANES / 64];
+        uint32_t nt = 0x01200145;
+        n.attack = hardnested;
+        n.uid = 0x2468ace0;
+        for(int i = 0; i < 1024; i++) {
+            struct Crypto1State s = key_state;
+            uint8_t par;
+            nt = nt * 0x9e3779b1u + 0x7f4a7c15u;
+            uint32_t ks = crypt_word_par(&s, n.uid ^ nt, 0, nt, &par);
+            mfkey_hardnested_add(&n, nt ^ ks, par);
+        }
+        mfkey_hardnested_log(&n, &log);
+        for(int k = 0; k < 24; k++) {
+            for(int l = 0; l < MFKEY_HARD_LANES / 64; l++) {
+                planes[k][l] = -(uint64_t)BIT(key_state.even, k);
+            }
+        }
+        hard_state_seconds = 0;
+        for(int run = 0; run < ESTIMATE_CALIBRATION_RUNS; run++) {
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for(int call = 0; call < ESTIMATE_HARD_CALLS; call++) {
+                kernels->hard_search(&log, key_state.odd, planes, alive);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            double per_state = seconds / ((double)ESTIMATE_HARD_CALLS * MFKEY_HARD_LANES);
+            if(run == 0 || per_state < hard_state_seconds) {
+                hard_state_seconds = per_state;
+            }
+        }
+        hard_calibrated_kernels = kernels;
+    }
+    double result = hard_state_seconds;
+    pthread_mutex_unlock(&calibration_lock);
+    return result;
+}
+
+void mfkey_estimate(const MfkeyConfig* config, const MfClassicNonce* n, MfkeyEstimate* estimate) {
+    memset(estimate, 0, sizeof(*estimate));
+
+    if(config->results_dir) {
+        MfkeyResult result;
+        if(mfkey_result_load(config->results_dir, n, &result)) {
+            mfkey_result_free(&result);
+            estimate->stored = true;
+            return;
+        }
+    }
+    if(n->attack == mfkey32 && n->has_at0) {
+        estimate->seconds = estimate->full_seconds = ESTIMATE_MFKEY64_SECONDS;
+        return;
+    }
+    const KernelVariant* kernels = select_kernels(config->force_isa);
+    if(!kernels) {
+        return;
+    }
+    if(n->attack == static_encrypted && kernels != &kernel_variant_reference &&
+       !nonce_parity_ok(n->nt0, n->ks1_1_enc, n->par_1)) {
+        return; // Ruled out by its parity bits, see recover_tables()
+    }
+    mfkey_global_init();
+    if(n->attack == hardnested) {
+        int threads = search_threads(config);
+        estimate->full_seconds = mfkey_hardnested_states(n) * hard_seconds_per_state(kernels) / threads;
+        estimate->seconds = estimate->full_seconds / 2;
+        return;
+    }
+    const double seconds_per_unit = unit_seconds(kernels);
+    unsigned int states_buffer[STATES_BUFFER_SIZE];
+    uint32_t in;
+    int oks, eks;
+    split_keystream(n, &oks, &eks, &in);
+    in = ((in >> 16 & 0xff) | (in << 16) | (in & 0xff00)) << 1;
+    const double semi_states = 1 << 20;
+
+    if(config->cache_dir) {
+        char path[512];
+        mfkey_cache_path(path, sizeof(path), config->cache_dir, mfkey_cache_prefix(oks));
+        estimate->odd_cached = access(path, R_OK) == 0;
+    }
+    double odd_work = kernels->sample_expansion(
+        states_buffer, oks, CONST_M1_1, CONST_M2_1, 0, 0, ESTIMATE_SAMPLES, &estimate->odd_survival);
+    double even_work = kernels->sample_expansion(
+        states_buffer, eks, CONST_M1_2, CONST_M2_2, in, 3, ESTIMATE_SAMPLES, &estimate->even_survival);
+
+    double odd_seconds =
+        estimate->odd_cached ? 0 : odd_work * semi_states * seconds_per_unit * ESTIMATE_ODD_FACTOR;
+    double round_seconds = even_work * semi_states * seconds_per_unit * ESTIMATE_ROUND_FACTOR;
+    int msb_rounds = 256 / config->msb_limit;
+    estimate->full_seconds = odd_seconds + msb_rounds * round_seconds;
+    // A key stops the search in a uniformly random round; candidates never do
+    estimate->seconds = n->attack == static_encrypted ? estimate->full_seconds
+                                                       : odd_seconds + (msb_rounds + 1) / 2.0 * round_seconds;
+}
+
+int mfkey_build_cache(
+    MfkeyContext* ctx,
+    MfkeyScratch* scratch,
+    const char* cache_dir,
+    void (*on_built)(void* user, uint32_t prefix, uint32_t total),
+    void* user) {
+    int built = 0;
+    for(uint32_t prefix = 0; prefix < MFKEY_CACHE_PREFIXES; prefix++) {
+        if(context_cancelled(ctx)) {
+            return -1;
+        }
+        MfkeyOddTable odd_table;
+        if(mfkey_cache_load(cache_dir, prefix, &odd_table)) {
+            mfkey_odd_table_free(&odd_table);
+            continue;
+        }
+        if(!ctx->kernels->expand_odd(ctx, prefix, scratch->states_buffer, &odd_table)) {
+            return -1;
+        }
+        bool stored = mfkey_cache_store(cache_dir, prefix, &odd_table);
+        mfkey_odd_table_free(&odd_table);
+        if(!stored) {
+            return -1;
+        }
+        built++;
+        if(on_built) {
+            on_built(user, prefix, MFKEY_CACHE_PREFIXES);
+        }
+    }
+    return built;
+}
+
+static int binaryStringToInt(const char* binStr) {
+    int result = 0;
+    while(*binStr) {
+        result <<= 1;
+        if(*binStr == '1') {
+            result |= 1;
+        }
+        binStr++;
+    }
+    return result;
+}
+
+static bool append_nonce(MfClassicNonce** nonces, int* nonce_count, const MfClassicNonce* nonce) {
+    MfClassicNonce* grown = realloc(*nonces, sizeof(MfClassicNonce) * (*nonce_count + 1));
+    if(!grown) {
+        return false;
+    }
+    *nonces = grown;
+    (*nonces)[(*nonce_count)++] = *nonce;
+    return true;
+}
+
+// Parse an mfkey32 reader log line: one nr/ar pair, plus the tag answer (at0)
+// and/or a second pair. Returns false if the line cannot be attacked.
+static bool parse_mfkey32_line(const char* line, MfClassicNonce* nonce) {
+    nonce->attack = mfkey32;
+    int parsed = sscanf(
+        line,
+        "Sec %d key %c cuid %" PRIx32 " nt0 %" PRIx32 " nr0 %" PRIx32 " ar0 %" PRIx32,
+        &nonce->sector,
+        &nonce->key_type,
+        &nonce->uid,
+        &nonce->nt0,
+        &nonce->nr0_enc,
+        &nonce->ar0_enc);
+    if(parsed != 6) {
+        return false;
+    }
+    
+    const char* at0 = strstr(line, " at0 ");
+    nonce->has_at0 = at0 && sscanf(at0, " at0 %" PRIx32, &nonce->at0_enc) == 1;
+    const char* nt1 = strstr(line, " nt1 ");
+    nonce->has_nt1 = nt1 && sscanf(nt1, " nt1 %" PRIx32 " nr1 %" PRIx32 " ar1 %" PRIx32,
+                                   &nonce->nt1, &nonce->nr1_enc, &nonce->ar1_enc) == 3;
+    if(!nonce->has_at0 && !nonce->has_nt1) {
+        return false;
+    }
+    
+    nonce->uid_xor_nt0 = nonce->uid ^ nonce->nt0;
+    nonce->uid_xor_nt1 = nonce->uid ^ nonce->nt1;
+    nonce->p64 = prng_successor(nonce->nt0, 64);
+    nonce->p96 = prng_successor(nonce->nt0, 96);
+    nonce->p64b = prng_successor(nonce->nt1, 64);
+    return true;
+}
+
+int mfkey_dist_candidates(uint32_t nt_ref, uint32_t ks, uint8_t par, int dist, uint32_t* nts, int* errors) {
+    const uint32_t nt_enc = nt_ref ^ ks;
+    int count = 0;
+    for(int i = 0; i <= 2 * MFKEY_DIST_WINDOW; i++) {
+        // 0, +1, -1, +2, -2, ...
+        int error = i & 1 ? (i + 1) / 2 : -(i / 2);
+        if(dist + error < 0) continue;
+        uint32_t nt = prng_successor(nt_ref, dist + error);
+        if(!nonce_parity_ok(nt, nt_enc ^ nt, par)) continue;
+        nts[count] = nt;
+        errors[count] = error;
+        count++;
+    }
+    return count;
+}
+
+// Append a parsed nested line. Static lines (dist 0) are appended as they are.
+// A dist > 0 line becomes one nonce per candidate of the nonce the tables are
+// built from: nt0 for a single nonce, nt1 for two, in which case the nt0
+// candidates are carried along (in chunks of 1 + MFKEY_NT0_ALTERNATIVES) and
+// share the tables. Returns the number of nonces added, or -1 on allocation failure.
+static int append_dist_nonces(
+    MfClassicNonce** nonces,
+    int* nonce_count,
+    const MfClassicNonce* nonce,
+    void (*on_loaded)(void* user, int count, const MfClassicNonce* nonce),
+    void* user) {
+    uint32_t nts0[2 * MFKEY_DIST_WINDOW + 1], nts1[2 * MFKEY_DIST_WINDOW + 1];
+    int errors0[2 * MFKEY_DIST_WINDOW + 1], errors1[2 * MFKEY_DIST_WINDOW + 1];
+    int count0 = 1, count1 = 1;
+    nts0[0] = nonce->nt0;
+    nts1[0] = nonce->nt1;
+    errors0[0] = errors1[0] = 0;
+    if(nonce->dist > 0) {
+        count0 = mfkey_dist_candidates(nonce->nt0, nonce->ks1_1_enc, nonce->par_1, nonce->dist, nts0, errors0);
+        if(nonce->attack == static_nested) {
+            count1 = mfkey_dist_candidates(nonce->nt1, nonce->ks1_2_enc, nonce->par_2, nonce->dist, nts1, errors1);
+        }
+    }
+
+    const uint32_t nt_enc0 = nonce->nt0 ^ nonce->ks1_1_enc;
+    const uint32_t nt_enc1 = nonce->nt1 ^ nonce->ks1_2_enc;
+    const int chunk = nonce->attack == static_nested ? 1 + MFKEY_NT0_ALTERNATIVES : 1;
+    int added = 0;
+    for(int j = 0; j < count1; j++) {
+        for(int i = 0; i < count0; i += chunk) {
+            MfClassicNonce candidate = *nonce;
+            candidate.nt0 = nts0[i];
+            candidate.ks1_1_enc = nt_enc0 ^ candidate.nt0;
+            candidate.uid_xor_nt0 = candidate.uid ^ candidate.nt0;
+            candidate.dist_error = errors0[i];
+            if(nonce->attack == static_nested) {
+                candidate.nt1 = nts1[j];
+                candidate.ks1_2_enc = nt_enc1 ^ candidate.nt1;
+                candidate.uid_xor_nt1 = candidate.uid ^ candidate.nt1;
+                candidate.dist_error = errors1[j];
+                for(int k = i + 1; k < count0 && k < i + chunk; k++) {
+                    candidate.nt0_alt[candidate.nt0_alt_count++] = nts0[k];
+                }
+            }
+            if(!append_nonce(nonces, nonce_count, &candidate)) {
+                return -1;
+            }
+            added++;
+            if(on_loaded) {
+                on_loaded(user, *nonce_count, &(*nonces)[*nonce_count - 1]);
+            }
+        }
+    }
+    return added;
+}
+
+// Merge a hardnested line into the nonce of its UID, sector and key type among
+// the nonces loaded from this file (*nonces from first), appending it if it is
+// the first line of the group. Returns the number of nonces added (0 or 1), or
+// -1 on allocation failure.
+static int merge_hardnested_line(const char* line, MfClassicNonce** nonces, int* nonce_count, int first) {
+    MfClassicNonce nonce = {0};
+    uint32_t nt_enc;
+    char par_str[5];
+    int parsed = sscanf(
+        line,
+        "Sec %d key %c cuid %" PRIx32 " nt_enc %" PRIx32 " par_enc %4s",
+        &nonce.sector,
+        &nonce.key_type,
+        &nonce.uid,
+        &nt_enc,
+        par_str);
+    if(parsed != 5) {
+        return 0;
+    }
+    uint8_t par = binaryStringToInt(par_str);
+    for(int i = first; i < *nonce_count; i++) {
+        MfClassicNonce* n = &(*nonces)[i];
+        if(n->attack == hardnested && n->uid == nonce.uid && n->sector == nonce.sector &&
+           n->key_type == nonce.key_type) {
+            mfkey_hardnested_add(n, nt_enc, par);
+            return 0;
+        }
+    }
+    nonce.attack = hardnested;
+    mfkey_hardnested_add(&nonce, nt_enc, par);
+    return append_nonce(nonces, nonce_count, &nonce) ? 1 : -1;
+}
+
+int mfkey_load_nonces(
+    const char* filename,
+    MfClassicNonce** nonces,
+    int* nonce_count,
+    void (*on_loaded)(void* user, int count, const MfClassicNonce* nonce),
+    void* user) {
+    FILE* file = fopen(filename, "r");
+    if(!file) {
+        fprintf(stderr, "Failed to open file: %s\n", filename);
+        return -1;
+    }
+    
+    char line[512];
+    int count = 0;
+    const int first_loaded = *nonce_count;
+    
+    while(fgets(line, sizeof(line), file)) {
+        MfClassicNonce nonce = {0};
+        
+        // Reader logs carry nr/ar pairs instead of nested keystreams
+        if(strstr(line, " nr0 ")) {
+            if(parse_mfkey32_line(line, &nonce)) {
+                if(!append_nonce(nonces, nonce_count, &nonce)) {
+                    break;
+                }
+                count++;
+                if(on_loaded) {
+                    on_loaded(user, *nonce_count, &(*nonces)[*nonce_count - 1]);
+                }
+            }
+            continue;
+        }
+        
+        // Hardnested logs hold one encrypted nonce per line
+        if(strstr(line, " nt_enc ")) {
+            int added = merge_hardnested_line(line, nonces, nonce_count, first_loaded);
+            if(added < 0) {
+                break;
+            }
+            count += added;
+            continue;
+        }
+        
+        // Nested lines end with the PRNG distance, 0 for static nonces
+        const char* dist_field = strstr(line, " dist ");
+        int dist = 0;
+        if(!dist_field || sscanf(dist_field, " dist %d", &dist) != 1 || dist < 0) {
+            continue;
+        }
+        
+        nonce.attack = static_encrypted;
+        
+        int parsed = sscanf(
+            line,
+            "Sec %d key %c cuid %" PRIx32 " nt0 %" PRIx32 " ks0 %" PRIx32
+            " par0 %4s nt1 %" PRIx32 " ks1 %" PRIx32 " par1 %4s",
+            &nonce.sector,
+            &nonce.key_type,
+            &nonce.uid,
+            &nonce.nt0,
+            &nonce.ks1_1_enc,
+            nonce.par_1_str,
+            &nonce.nt1,
+            &nonce.ks1_2_enc,
+            nonce.par_2_str);
+        
+        if(parsed >= 6) { // At least one nonce is present
+            nonce.par_1 = binaryStringToInt(nonce.par_1_str);
+            if(parsed == 9) { // Both nonces are present
+                nonce.attack = static_nested;
+                nonce.par_2 = binaryStringToInt(nonce.par_2_str);
+            }
+            nonce.dist = dist;
+            
+            int added = append_dist_nonces(nonces, nonce_count, &nonce, on_loaded, user);
+            if(added < 0) {
+                break;
+            }
+            count += added;
+        }
+    }
+    
+    fclose(file);
+    // Hardnested nonces are reported once all their lines are merged
+    for(int i = first_loaded; on_loaded && i < *nonce_count; i++) {
+        if((*nonces)[i].attack == hardnested) {
+            on_loaded(user, i + 1, &(*nonces)[i]);
+        }
+    }
+    return count;
+}
+
+// Run the odd and even semi-state expansion of one MSB round with both filter
+// strategies and report the time per semi-state
+int mfkey_bench_filter(void) {
+    unsigned int* states_buffer = malloc(sizeof(unsigned int) * STATES_BUFFER_SIZE);
+    if(!states_buffer) {
+        printf("Memory allocation failed!\n");
+        return 1;
+    }
+    
+    const int xks = 0x5a3c, in = 0x00c3a5, rounds = 3;
+    long l2_size = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    printf("Filter table: %zu KiB, L2 cache: ", sizeof(filter_table) / 1024);
+    if(l2_size > 0) {
+        printf("%ld KiB\n", l2_size / 1024);
+    } else {
+        printf("unknown\n");
+    }
+    
+    double seconds[2] = {0, 0};
+    uint32_t checksum[2] = {0, 0};
+    for(int variant = 0; variant < 2; variant++) {
+        clock_t start = clock();
+        for(int r = 0; r < rounds; r++) {
+            for(int semi_state = 1 << 20; semi_state >= 0; semi_state--) {
+                for(int side = 0; side < 2; side++) {
+                    int ks = side ? xks >> 1 : xks;
+                    if(filter(semi_state) != (ks & 1)) continue;
+                    states_buffer[0] = semi_state;
+                    int tail = variant ?
+                        state_loop(states_buffer, ks, CONST_M1_2, CONST_M2_2, side ? in : 0, side ? 3 : 0) :
+                        state_loop_composed(states_buffer, ks, CONST_M1_2, CONST_M2_2, side ? in : 0, side ? 3 : 0);
+                    for(int i = 0; i <= tail; i++) {
+                        checksum[variant] = checksum[variant] * 31 + states_buffer[i];
+                    }
+                }
+            }
+        }
+        seconds[variant] = (double)(clock() - start) / CLOCKS_PER_SEC;
+    }
+    free(states_buffer);
+    
+    double per_state = 1e9 / ((double)rounds * (1 << 21));
+    printf("composed filter: %.3f s (%.1f ns/semi-state)\n", seconds[0], seconds[0] * per_state);
+    printf("filter table:    %.3f s (%.1f ns/semi-state)\n", seconds[1], seconds[1] * per_state);
+    if(seconds[1] > 0) {
+        printf("speedup:         %.2fx\n", seconds[0] / seconds[1]);
+    }
+    if(checksum[0] != checksum[1]) {
+        printf("MISMATCH: state expansions differ (%08" PRIx32 " != %08" PRIx32 ")\n", checksum[0], checksum[1]);
+        return 1;
+    }
+    return 0;
+}
+
+
+// Word operations compared by --bench crypto1: byte-stepping against bit-serial
+typedef uint32_t (*Crypto1WordOp)(struct Crypto1State* s, uint32_t in, uint32_t nt);
+
+#define CRYPTO1_OP(name, expr)                                                              \
+    static uint32_t name(struct Crypto1State* s, uint32_t in, uint32_t nt) {                \
+        (void)in;                                                                           \
+        (void)nt;                                                                           \
+        expr;                                                                               \
+    }
+
+CRYPTO1_OP(op_crypt_word, return crypt_word(s))
+CRYPTO1_OP(op_crypt_word_bitwise, return crypt_word_bitwise(s))
+CRYPTO1_OP(op_crypt_word_ret, return crypt_word_ret(s, in, 0))
+CRYPTO1_OP(op_crypt_word_ret_bitwise, return crypt_word_ret_bitwise(s, in, 0))
+CRYPTO1_OP(op_crypt_word_noret, crypt_word_noret(s, in, 0); return 0)
+CRYPTO1_OP(op_crypt_word_noret_bitwise, crypt_word_noret_bitwise(s, in, 0); return 0)
+CRYPTO1_OP(op_crypt_word_par, uint8_t par; uint32_t ks = crypt_word_par(s, in, 0, nt, &par); return ks ^ par)
+CRYPTO1_OP(op_crypt_word_par_bitwise, uint8_t par; uint32_t ks = crypt_word_par_bitwise(s, in, 0, nt, &par); return ks ^ par)
+CRYPTO1_OP(op_rollback_word_noret, rollback_word_noret(s, in, 0); return 0)
+CRYPTO1_OP(op_rollback_word_noret_bitwise, rollback_word_noret_bitwise(s, in, 0); return 0)
+CRYPTO1_OP(op_rollback_word, return napi_lfsr_rollback_word(s, in, 0))
+CRYPTO1_OP(op_rollback_word_bitwise, return napi_lfsr_rollback_word_bitwise(s, in, 0))
+
+// Keeps benchmark results alive
+static volatile uint32_t bench_sink;
+
+static uint64_t bench_random(uint64_t* x) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+// Check the byte-stepping word operations against the bit-serial ones on random
+// states and inputs, then time both
+int mfkey_bench_crypto1(void) {
+    static const struct {
+        const char* name;
+        Crypto1WordOp bytewise;
+        Crypto1WordOp bitwise;
+    } ops[] = {
+        {"crypt_word", op_crypt_word, op_crypt_word_bitwise},
+        {"crypt_word_ret", op_crypt_word_ret, op_crypt_word_ret_bitwise},
+        {"crypt_word_noret", op_crypt_word_noret, op_crypt_word_noret_bitwise},
+        {"crypt_word_par", op_crypt_word_par, op_crypt_word_par_bitwise},
+        {"rollback_word_noret", op_rollback_word_noret, op_rollback_word_noret_bitwise},
+        {"rollback_word", op_rollback_word, op_rollback_word_bitwise},
+    };
+    const int samples = 1 << 20;
+    mfkey_global_init();
+    
+    int mismatches = 0;
+    printf("%-20s %10s %10s %8s\n", "operation", "bitwise", "bytewise", "speedup");
+    for(size_t op = 0; op < sizeof(ops) / sizeof(ops[0]); op++) {
+        // Bit-exactness on the 24 state bits of each half and the returned keystream
+        uint64_t seed = 0x9E3779B97F4A7C15ULL;
+        for(int i = 0; i < samples && !mismatches; i++) {
+            uint64_t r = bench_random(&seed);
+            uint32_t in = (uint32_t)bench_random(&seed), nt = (uint32_t)(r >> 48);
+            struct Crypto1State a = {r & 0xffffff, (r >> 24) & 0xffffff}, b = a;
+            uint32_t ra = ops[op].bytewise(&a, in, nt);
+            uint32_t rb = ops[op].bitwise(&b, in, nt);
+            if(ra != rb || ((a.odd ^ b.odd) | (a.even ^ b.even)) & 0xffffff) {
+                printf("MISMATCH: %s differs for state %06" PRIx32 "/%06" PRIx32 " in %08" PRIx32 "\n",
+                       ops[op].name, (uint32_t)(r & 0xffffff), (uint32_t)((r >> 24) & 0xffffff), in);
+                mismatches++;
+            }
+        }
+        
+        double seconds[2];
+        uint32_t checksum = 0;
+        for(int variant = 0; variant < 2; variant++) {
+            Crypto1WordOp fn = variant ? ops[op].bytewise : ops[op].bitwise;
+            struct Crypto1State s = {0x123456, 0xabcdef};
+            clock_t start = clock();
+            for(int i = 0; i < samples; i++) {
+                checksum ^= fn(&s, (uint32_t)i * 0x9E3779B9, (uint32_t)i);
+            }
+            seconds[variant] = (double)(clock() - start) / CLOCKS_PER_SEC;
+            checksum ^= s.odd ^ s.even;
+        }
+        bench_sink = checksum;
+        printf("%-20s %7.1f ns %7.1f ns %7.2fx\n",
+               ops[op].name,
+               seconds[0] * 1e9 / samples,
+               seconds[1] * 1e9 / samples,
+               seconds[1] > 0 ? seconds[0] / seconds[1] : 0.0);
+    }
+    
+    if(mismatches) {
+        return 1;
+    }
+    printf("All operations bit-exact on %d random states\n", samples);
+    return 0;
+}
+
+// Nonce consistent with a leaf state, derived with the scalar reference operations
+static void bench_leaf_nonce(AttackType attack, struct Crypto1State state, uint64_t* seed, MfClassicNonce* n) {
+    struct Crypto1State t = state;
+    memset(n, 0, sizeof(*n));
+    n->attack = attack;
+    n->uid_xor_nt0 = (uint32_t)bench_random(seed);
+    n->uid_xor_nt1 = (uint32_t)bench_random(seed);
+    n->nt0 = (uint32_t)bench_random(seed);
+    if(attack == mfkey32) {
+        n->p64 = (uint32_t)bench_random(seed);
+        n->p64b = (uint32_t)bench_random(seed);
+        n->nr0_enc = (uint32_t)bench_random(seed);
+        n->nr1_enc = (uint32_t)bench_random(seed);
+        n->ar0_enc = napi_lfsr_rollback_word(&t, 0, 0) ^ n->p64;
+        rollback_word_noret(&t, n->nr0_enc, 1);
+        rollback_word_noret(&t, n->uid_xor_nt0, 0);
+        crypt_word_noret(&t, n->uid_xor_nt1, 0);
+        crypt_word_noret(&t, n->nr1_enc, 1);
+        n->ar1_enc = crypt_word(&t) ^ n->p64b;
+    } else if(attack == static_nested) {
+        rollback_word_noret(&t, n->uid_xor_nt1, 0);
+        n->ks1_1_enc = crypt_word_ret(&t, n->uid_xor_nt0, 0);
+    } else {
+        n->ks1_1_enc = napi_lfsr_rollback_word(&t, n->uid_xor_nt0, 0);
+        crypt_word_par(&t, n->uid_xor_nt0, 0, n->nt0, &n->par_1);
+    }
+}
+
+// Scalar and batched bitsliced leaf checks over batches of 64 states with one
+// nonce per batch. Both store the lanes that passed in masks.
+#define LEAF_BENCH(attack)                                                                          \
+    static void leaf_scalar_##attack(                                                               \
+        const struct Crypto1State* states, const MfClassicNonce* nonces, int batches, uint64_t* masks) { \
+        for(int b = 0; b < batches; b++) {                                                          \
+            uint64_t mask = 0;                                                                      \
+            int bits = 0;                                                                           \
+            for(int l = 0; l < 64; l++) {                                                           \
+                struct Crypto1State t = states[b * 64 + l], key_state;                              \
+                if(check_state_##attack(&t, &nonces[b], &key_state, &bits)) mask |= 1ULL << l;      \
+            }                                                                                       \
+            masks[b] = mask;                                                                        \
+        }                                                                                           \
+    }                                                                                               \
+    static void leaf_slice_##attack(                                                                \
+        const struct Crypto1State* states, const MfClassicNonce* nonces, int batches, uint64_t* masks) { \
+        for(int b = 0; b < batches; b++) {                                                          \
+            Crypto1Slice slice;                                                                     \
+            uint64_t mask = 0;                                                                      \
+            int bits = 0;                                                                           \
+            crypto1_slice_load(&slice, states + b * 64, 64);                                        \
+            uint64_t alive = check_slice_##attack(&slice, &nonces[b], ~0ULL, &bits);                \
+            while(alive) {                                                                          \
+                int l = __builtin_ctzll(alive);                                                     \
+                struct Crypto1State t = states[b * 64 + l], key_state;                              \
+                alive &= alive - 1;                                                                 \
+                if(check_state_##attack(&t, &nonces[b], &key_state, &bits)) mask |= 1ULL << l;      \
+            }                                                                                       \
+            masks[b] = mask;                                                                        \
+        }                                                                                           \
+    }
+
+// The mfkey32 tables are built from the ar0 keystream, so most leaf states of a
+// recovery match ar0 and are only rejected at ar1, while random states are
+// rejected within the first bits of ar0, which favors the scalar check. The
+// "past ar0" rows time the mfkey32 checks of states that match ar0; recovery
+// leaves lie between the two rows (--trace shows their leaf check time).
+static inline int check_state_mfkey32_leaf(
+    struct Crypto1State* t,
+    const MfClassicNonce* n,
+    struct Crypto1State* key_state,
+    int* bits) {
+    rollback_word_noret(t, 0, 0);
+    rollback_word_noret(t, n->nr0_enc, 1);
+    rollback_word_noret(t, n->uid_xor_nt0, 0);
+    *key_state = *t;
+    crypt_word_noret(t, n->uid_xor_nt1, 0);
+    crypt_word_noret(t, n->nr1_enc, 1);
+    return crypt_word_check(t, 0, n->ar1_enc ^ n->p64b, bits);
+}
+
+static inline uint64_t check_slice_mfkey32_leaf(Crypto1Slice* t, const MfClassicNonce* n, uint64_t alive, int* bits) {
+    crypto1_slice_rollback_word(t, 0, 0, false, 0, false, 0, 0, alive, bits);
+    crypto1_slice_rollback_word(t, n->nr0_enc, 1, false, 0, false, 0, 0, alive, bits);
+    crypto1_slice_rollback_word(t, n->uid_xor_nt0, 0, false, 0, false, 0, 0, alive, bits);
+    crypto1_slice_crypt_word(t, n->uid_xor_nt1, 0, false, 0, alive, bits);
+    crypto1_slice_crypt_word(t, n->nr1_enc, 1, false, 0, alive, bits);
+    return crypto1_slice_crypt_word(t, 0, 0, true, n->ar1_enc ^ n->p64b, alive, bits);
+}
+
+LEAF_BENCH(mfkey32)
+LEAF_BENCH(mfkey32_leaf)
+LEAF_BENCH(static_nested)
+LEAF_BENCH(static_encrypted)
+
+typedef void (*LeafBenchFn)(const struct Crypto1State*, const MfClassicNonce*, int, uint64_t*);
+
+// Check the bitsliced leaf checks against the scalar ones on random states, each
+// batch holding one state that matches its nonce, then time both
+int mfkey_bench_leaf(void) {
+    static const struct {
+        AttackType attack;
+        const char* name;
+        LeafBenchFn scalar;
+        LeafBenchFn slice;
+        bool sliced; // Used by the kernel variants
+    } attacks[] = {
+        {mfkey32, "mfkey32 (random)", leaf_scalar_mfkey32, leaf_slice_mfkey32, SLICED_LEAF_MFKEY32},
+        {mfkey32, "mfkey32 (past ar0)", leaf_scalar_mfkey32_leaf, leaf_slice_mfkey32_leaf, SLICED_LEAF_MFKEY32},
+        {static_nested, "static_nested", leaf_scalar_static_nested, leaf_slice_static_nested, SLICED_LEAF_STATIC_NESTED},
+        {static_encrypted, "static_encrypted", leaf_scalar_static_encrypted, leaf_slice_static_encrypted,
+         SLICED_LEAF_STATIC_ENCRYPTED},
+    };
+    const int batches = 1 << 14;
+    mfkey_global_init();
+
+    struct Crypto1State* states = malloc(sizeof(struct Crypto1State) * 64 * batches);
+    MfClassicNonce* nonces = malloc(sizeof(MfClassicNonce) * batches);
+    uint64_t* masks[2] = {malloc(sizeof(uint64_t) * batches), malloc(sizeof(uint64_t) * batches)};
+    if(!states || !nonces || !masks[0] || !masks[1]) {
+        printf("Out of memory\n");
+        free(states);
+        free(nonces);
+        free(masks[0]);
+        free(masks[1]);
+        return 1;
+    }
+
+    int mismatches = 0;
+    printf("%-20s %10s %10s %8s  %s\n", "attack", "scalar", "bitsliced", "speedup", "engines use");
+    for(size_t a = 0; a < sizeof(attacks) / sizeof(attacks[0]) && !mismatches; a++) {
+        uint64_t seed = 0x9E3779B97F4A7C15ULL;
+        for(int i = 0; i < 64 * batches; i++) {
+            uint64_t r = bench_random(&seed);
+            states[i].odd = r & 0xffffff;
+            states[i].even = (r >> 24) & 0xffffff;
+        }
+        for(int b = 0; b < batches; b++) {
+            int lane = bench_random(&seed) & 63;
+            bench_leaf_nonce(attacks[a].attack, states[b * 64 + lane], &seed, &nonces[b]);
+        }
+
+        double seconds[2];
+        for(int variant = 0; variant < 2; variant++) {
+            LeafBenchFn fn = variant ? attacks[a].slice : attacks[a].scalar;
+            clock_t start = clock();
+            fn(states, nonces, batches, masks[variant]);
+            seconds[variant] = (double)(clock() - start) / CLOCKS_PER_SEC;
+        }
+        for(int b = 0; b < batches && !mismatches; b++) {
+            if(masks[0][b] != masks[1][b] || !masks[0][b]) {
+                printf("MISMATCH: %s batch %d passed %016" PRIx64 " (scalar) / %016" PRIx64 " (bitsliced)\n",
+                       attacks[a].name, b, masks[0][b], masks[1][b]);
+                mismatches++;
+            }
+        }
+        printf("%-20s %7.1f ns %7.1f ns %7.2fx  %s\n",
+               attacks[a].name,
+               seconds[0] * 1e9 / (64.0 * batches),
+               seconds[1] * 1e9 / (64.0 * batches),
+               seconds[1] > 0 ? seconds[0] / seconds[1] : 0.0,
+               attacks[a].sliced ? "bitsliced" : "scalar");
+    }
+
+    free(states);
+    free(nonces);
+    free(masks[0]);
+    free(masks[1]);
+    if(mismatches) {
+        return 1;
+    }
+    printf("Bitsliced leaf checks agree on %d batches of 64 states\n", batches);
+    return 0;
+}
+
+// Sub-ranges extended by --bench extend: sizes as in old_recover() joins
+#define EXTEND_BENCH_TABLES (1 << 16)
+#define EXTEND_BENCH_MAX    256
+
+int mfkey_bench_extend(const char* force_isa) {
+    mfkey_global_init();
+    const KernelVariant* kernels = select_kernels(force_isa);
+    if(!kernels) {
+        return 1;
+    }
+    const size_t room = (size_t)TABLE_GROWTH * (EXTEND_BENCH_MAX + 1) + EXTEND_SLACK;
+    unsigned int* input = malloc(sizeof(unsigned int) * EXTEND_BENCH_TABLES * EXTEND_BENCH_MAX);
+    int* sizes = malloc(sizeof(int) * EXTEND_BENCH_TABLES);
+    unsigned int* tables[2] = {malloc(sizeof(unsigned int) * room), malloc(sizeof(unsigned int) * room)};
+    unsigned int* work = malloc(sizeof(unsigned int) * room);
+    uint64_t* checksums[2] = {calloc(EXTEND_BENCH_TABLES, sizeof(uint64_t)), calloc(EXTEND_BENCH_TABLES, sizeof(uint64_t))};
+    if(!input || !sizes || !tables[0] || !tables[1] || !work || !checksums[0] || !checksums[1]) {
+        printf("Out of memory\n");
+        free(input);
+        free(sizes);
+        free(tables[0]);
+        free(tables[1]);
+        free(work);
+        free(checksums[0]);
+        free(checksums[1]);
+        return 1;
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    for(int t = 0; t < EXTEND_BENCH_TABLES; t++) {
+        sizes[t] = 1 + (int)(bench_random(&seed) % EXTEND_BENCH_MAX);
+        for(int k = 0; k < sizes[t]; k++) {
+            input[(size_t)t * EXTEND_BENCH_MAX + k] = (unsigned int)bench_random(&seed);
+        }
+    }
+
+    // Three extensions per sub-range, alternating the odd and even side as old_recover()
+    int mismatches = 0;
+    double seconds[2];
+    for(int variant = 0; variant < 2; variant++) {
+        unsigned int* data = tables[variant];
+        uint64_t ks = 0x2545F4914F6CDD1DULL;
+        clock_t start = clock();
+        for(int t = 0; t < EXTEND_BENCH_TABLES; t++) {
+            memcpy(data, input + (size_t)t * EXTEND_BENCH_MAX, sizeof(unsigned int) * sizes[t]);
+            int end = sizes[t] - 1;
+            for(int i = 0; i < 3 && end >= 0; i++, ks = ks >> 3 | ks << 61) {
+                int odd = i & 1, m1 = odd ? LF_POLY_EVEN << 1 | 1 : LF_POLY_ODD;
+                int m2 = odd ? LF_POLY_ODD << 1 : LF_POLY_EVEN << 1 | 1;
+                unsigned int in = odd ? 0 : ks >> 1 & 3;
+                end = variant ? kernels->extend_table(data, work, 0, end, ks & 1, m1, m2, in) :
+                                extend_table(data, 0, end, ks & 1, m1, m2, in);
+            }
+            // Entry order differs between the two: sum a hash of every entry
+            uint64_t checksum = end + 1;
+            for(int k = 0; k <= end; k++) {
+                checksum += (data[k] * 0x9E3779B97F4A7C15ULL) >> 17;
+            }
+            checksums[variant][t] = checksum;
+        }
+        seconds[variant] = (double)(clock() - start) / CLOCKS_PER_SEC;
+    }
+    for(int t = 0; t < EXTEND_BENCH_TABLES && !mismatches; t++) {
+        if(checksums[0][t] != checksums[1][t]) {
+            printf("MISMATCH: sub-range %d (%d states) extends differently\n", t, sizes[t]);
+            mismatches++;
+        }
+    }
+
+    printf("in place:   %.3f s\n", seconds[0]);
+    printf("compaction: %.3f s (%s)\n", seconds[1], kernels->name);
+    if(seconds[1] > 0) {
+        printf("speedup:    %.2fx\n", seconds[0] / seconds[1]);
+    }
+    free(input);
+    free(sizes);
+    free(tables[0]);
+    free(tables[1]);
+    free(work);
+    free(checksums[0]);
+    free(checksums[1]);
+    return mismatches ? 1 : 0;
+}
+
+// One nonce run through one engine by --bench engines
+typedef struct {
+    double odd_seconds;   // Odd table expansion
+    double round_seconds; // Even buckets and join of the first MSB round
+    MfkeyOddTable odd;
+    uint64_t buckets;     // Hash of the even buckets
+    int found;
+    MfClassicKey key;
+    uint64_t* candidates; // Packed, sorted and unique
+    int candidate_count;
+} EngineRun;
+
+static uint64_t buckets_checksum(const struct MsbBuckets* even, int msb_limit) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for(int i = 0; i < msb_limit; i++) {
+        h = (h ^ (uint64_t)even->count[i]) * 0x100000001B3ULL;
+        for(int k = 0; k < even->count[i]; k++) {
+            h = (h ^ even->states[even->start[i] + k]) * 0x100000001B3ULL;
+        }
+    }
+    return h;
+}
+
+static bool bench_engine_run(const char* engine, const MfClassicNonce* n, MfkeyScratch* scratch, EngineRun* run) {
+    MfkeyConfig config;
+    mfkey_config_init(&config);
+    config.force_isa = engine;
+    MfkeyContext* ctx = mfkey_context_new(&config, NULL, NULL);
+    if(!ctx) {
+        return false;
+    }
+    ctx->capture_candidates = true;
+    memset(run, 0, sizeof(*run));
+
+    uint32_t in;
+    int oks, eks;
+    MfClassicNonce copy = *n;
+    split_keystream(n, &oks, &eks, &in);
+    clock_t start = clock();
+    bool ok = ctx->kernels->expand_odd(ctx, oks, scratch->states_buffer, &run->odd);
+    run->odd_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    if(ok) {
+        start = clock();
+        ok = ctx->kernels->collect_even(ctx, eks, 0, &copy, scratch, in) == 0;
+        double collect_seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        if(ok) {
+            run->buckets = buckets_checksum(&scratch->even, config.msb_limit);
+            start = clock();
+            run->found = ctx->kernels->calculate_msb_tables[kernel_index(n)](
+                ctx, oks, eks, 0, &copy, &run->odd, scratch, in, true);
+            run->round_seconds = collect_seconds + (double)(clock() - start) / CLOCKS_PER_SEC;
+            run->key = copy.key;
+            ok = run->found >= 0 && !ctx->nonce_candidates_lost &&
+                 (run->candidate_count = pack_key_set(ctx->nonce_candidates, ctx->nonce_candidate_count, &run->candidates)) >= 0;
+        }
+        if(!ok) {
+            mfkey_odd_table_free(&run->odd);
+        }
+    }
+    mfkey_context_free(ctx);
+    return ok;
+}
+
+static void engine_run_free(EngineRun* run) {
+    mfkey_odd_table_free(&run->odd);
+    free(run->candidates);
+}
+
+// Compare a run with the reference run. Returns the number of differences found.
+static int engine_run_compare(const char* engine, AttackType attack, const EngineRun* run, const EngineRun* ref) {
+    const char* what = NULL;
+    if(!odd_tables_equal(&run->odd, &ref->odd)) {
+        what = "the odd table";
+    } else if(run->buckets != ref->buckets) {
+        what = "the even buckets";
+    } else if(run->found != ref->found || (run->found && memcmp(run->key.data, ref->key.data, MF_CLASSIC_KEY_SIZE) != 0)) {
+        what = "the key found";
+    } else if(run->candidate_count != ref->candidate_count ||
+              memcmp(run->candidates, ref->candidates, sizeof(uint64_t) * run->candidate_count) != 0) {
+        what = "the candidate keys";
+    }
+    if(what) {
+        printf("MISMATCH: %s engine differs from reference in %s (%s)\n", engine, what, mfkey_attack_name(attack));
+        return 1;
+    }
+    return 0;
+}
+
+int mfkey_bench_engines(const char* force_isa) {
+    static const AttackType attacks[] = {mfkey32, static_nested, static_encrypted};
+    mfkey_global_init();
+    if(force_isa && !select_kernels(force_isa)) {
+        return 1;
+    }
+    MfkeyScratch* scratch = mfkey_scratch_new();
+    if(!scratch) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    // Each attack runs a nonce derived from a random leaf state, so that every
+    // engine sees the same odd table, even buckets and candidates
+    int mismatches = 0, compared = 0;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    printf("%-18s %-10s %10s %10s %8s\n", "attack", "engine", "odd table", "MSB round", "speedup");
+    for(size_t a = 0; a < sizeof(attacks) / sizeof(attacks[0]); a++) {
+        uint64_t r = bench_random(&seed);
+        struct Crypto1State state = {r & 0xffffff, (r >> 24) & 0xffffff};
+        MfClassicNonce n;
+        bench_leaf_nonce(attacks[a], state, &seed, &n);
+
+        EngineRun ref;
+        if(!bench_engine_run("reference", &n, scratch, &ref)) {
+            printf("Out of memory\n");
+            mfkey_scratch_free(scratch);
+            return 1;
+        }
+        const char* attack = mfkey_attack_name(attacks[a]);
+        printf("%-18s %-10s %8.3f s %8.3f s %7.2fx\n", attack, "reference", ref.odd_seconds, ref.round_seconds, 1.0);
+        for(int i = 0; i < KERNEL_VARIANT_COUNT; i++) {
+            const KernelVariant* variant = kernel_variants[i];
+            if(variant == &kernel_variant_reference || !variant->cpu_ok()) continue;
+            if(force_isa && strcmp(variant->name, force_isa) != 0) continue;
+            EngineRun run;
+            if(!bench_engine_run(variant->name, &n, scratch, &run)) {
+                printf("Out of memory\n");
+                mismatches++;
+                continue;
+            }
+            double seconds = run.odd_seconds + run.round_seconds;
+            printf("%-18s %-10s %8.3f s %8.3f s %7.2fx\n", "", variant->name, run.odd_seconds, run.round_seconds,
+                   seconds > 0 ? (ref.odd_seconds + ref.round_seconds) / seconds : 0.0);
+            mismatches += engine_run_compare(variant->name, attacks[a], &run, &ref);
+            compared++;
+            engine_run_free(&run);
+        }
+        engine_run_free(&ref);
+    }
+
+    mfkey_scratch_free(scratch);
+    if(mismatches) {
+        return 1;
+    }
+    printf("%d engine runs agree with the reference (odd table, even buckets and keys of the first MSB round)\n", compared);
+    return 0;
+}
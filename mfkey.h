@@ -0,0 +1,288 @@
+#ifndef MFKEY_H
+#define MFKEY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// libmfkey: MIFARE Classic key recovery engine.
+//
+// All recovery state lives in an MfkeyContext; memory used by one recovery lives
+// in an MfkeyScratch owned by the caller. Contexts are independent of each other,
+// so several jobs can run in one process as long as each context and each scratch
+// is used by one thread at a time. Errors are reported on stderr; stdout is left
+// to the client.
+
+// MIFARE Classic key size
+#define MF_CLASSIC_KEY_SIZE 6
+
+// Default MSB processing chunk size
+#define MFKEY_DEFAULT_MSB_LIMIT 16
+
+// PRNG steps searched on each side of the logged distance of a dist > 0 nested line
+#define MFKEY_DIST_WINDOW 16
+
+// nt0 candidates carried by one static_nested nonce besides nt0 itself
+#define MFKEY_NT0_ALTERNATIVES 7
+
+// Encrypted nonces a hardnested nonce keeps for the final check of a key
+#define MFKEY_HARD_NONCES 32
+
+typedef struct {
+    uint8_t data[MF_CLASSIC_KEY_SIZE];
+} MfClassicKey;
+
+typedef enum {
+    mfkey32,
+    static_nested,
+    static_encrypted,
+    hardnested
+} AttackType;
+
+typedef struct {
+    AttackType attack;
+    MfClassicKey key;
+    int sector;
+    char key_type; // 'A' or 'B'
+    uint32_t uid;
+    uint32_t nt0;
+    uint32_t nt1;
+    uint32_t uid_xor_nt0;
+    uint32_t uid_xor_nt1;
+    int dist;       // Logged PRNG distance of a nested line, 0 for static nonces
+    int dist_error; // PRNG steps between this candidate nonce and the logged distance
+    union {
+        // Mfkey32
+        struct {
+            uint32_t p64;
+            uint32_t p64b;
+            uint32_t nr0_enc;
+            uint32_t ar0_enc;
+            uint32_t nr1_enc;
+            uint32_t ar1_enc;
+            uint32_t at0_enc;
+            uint32_t p96;
+            bool has_at0; // at0_enc is known: 64 bits of keystream, no second pair needed
+            bool has_nt1; // The second nonce pair is present
+        };
+        // Nested
+        struct {
+            uint32_t ks1_1_enc;
+            uint32_t ks1_2_enc;
+            char par_1_str[5];
+            char par_2_str[5];
+            uint8_t par_1;
+            uint8_t par_2;
+            // static_nested from a dist > 0 line: more plaintext candidates for
+            // nt0, checked against the same nt1 tables (nt0 holds the first)
+            uint8_t nt0_alt_count;
+            uint32_t nt0_alt[MFKEY_NT0_ALTERNATIVES];
+        };
+        // Hardnested: the encrypted nonces of one sector and key type, merged
+        // (see mfkey_hardnested_add). nt0 holds the first one.
+        struct {
+            uint32_t hard_total;          // Nonces merged
+            uint8_t hard_first_seen[32];  // First encrypted bytes with a known sum (bitmap)
+            uint8_t hard_first_sum[32];   // Their sum: par bit 3 ^ parity of the byte (bitmap)
+            uint8_t hard_first_bad[32];   // First bytes logged with both sums (bitmap)
+            uint32_t hard_nt_enc[MFKEY_HARD_NONCES]; // Kept for the final check
+            uint8_t hard_par[MFKEY_HARD_NONCES];
+            uint8_t hard_count;
+        };
+    };
+} MfClassicNonce;
+
+// Bucket occupancy statistics
+typedef struct {
+    uint64_t buckets;
+    uint64_t empty_buckets;
+    uint64_t odd_states;
+    uint64_t even_states;
+    int max_odd;
+    int max_even;
+    uint64_t leaf_checks;  // Candidate states verified against the nonce
+    uint64_t leaf_matches; // Checks that passed
+    uint64_t leaf_bits;    // Keystream and parity bits examined by the checks
+    uint64_t result_hits;  // Recoveries answered from the result database
+    uint64_t dict_hits;    // Nonces solved by a dictionary key before recovery
+    // Parity pruning of static_encrypted nonces (see README, Parity pruning)
+    uint64_t parity_nonces_pruned;  // Nonces ruled out by the parity bits of the first three bytes
+    uint64_t parity_bucket_states;  // Even MSB bucket states tested against the last parity bit
+    uint64_t parity_bucket_pruned;  // Of those, discarded
+    uint64_t parity_table_states;   // Extended even states tested before the leaf join
+    uint64_t parity_table_pruned;   // Of those, discarded
+    uint64_t parity_pairs;          // Leaf pairs of the join
+    uint64_t parity_pairs_pruned;   // Of those, discarded before the leaf checks
+    uint64_t cross_checks;           // MSB rounds also run on the reference engine
+    uint64_t cross_check_mismatches; // Of those, rounds whose buckets or keys differed
+} MfkeyStats;
+
+// Cancellation token, safe to set from another thread or a signal handler
+typedef struct {
+    volatile int cancelled;
+} MfkeyCancelToken;
+
+// Progress of the current recovery
+typedef struct {
+    const MfClassicNonce* nonce;
+    int msb_round;        // 1-based MSB round
+    int msb_rounds;
+    float round_progress; // Percentage of the current round
+} MfkeyProgress;
+
+// Callbacks, all optional. Keys and candidates are reported once per context.
+typedef struct {
+    void (*on_key)(void* user, const MfClassicNonce* nonce, const MfClassicKey* key);
+    void (*on_candidate)(void* user, const MfClassicNonce* nonce, const MfClassicKey* key);
+    void (*on_progress)(void* user, const MfkeyProgress* progress);
+    void* user;
+} MfkeyCallbacks;
+
+// CPU resource governor (see mfkey_governor.h)
+typedef struct MfkeyGovernor MfkeyGovernor;
+
+typedef struct {
+    int msb_limit;         // MSB values per round, a divisor of 256
+    const char* cache_dir; // Directory of the odd-half expansion cache (NULL: disabled)
+    const char* force_isa; // Recovery engine: "reference" or a kernel variant (NULL: best supported)
+    const char* results_dir; // Directory of the result database (NULL: disabled)
+    int search_threads;      // Threads of a hardnested search (0: the governor's workers, or one per usable CPU)
+    MfkeyGovernor* governor; // Admits, pins and backs off worker threads (NULL: none)
+    double cross_check;      // Fraction of MSB rounds also run on the reference engine (0: off)
+} MfkeyConfig;
+
+typedef struct MfkeyContext MfkeyContext;
+typedef struct MfkeyScratch MfkeyScratch;
+
+// Fill a configuration with defaults
+void mfkey_config_init(MfkeyConfig* config);
+
+// Build the shared lookup tables on the first call; safe to call from several
+// threads. Called by mfkey_context_new().
+void mfkey_global_init(void);
+
+// Create a context. callbacks and cancel may be NULL. Returns NULL if the
+// forced kernel variant is unknown or unsupported, or on allocation failure.
+MfkeyContext* mfkey_context_new(const MfkeyConfig* config, const MfkeyCallbacks* callbacks, MfkeyCancelToken* cancel);
+void mfkey_context_free(MfkeyContext* ctx);
+
+// Name of the kernel variant selected for a context
+const char* mfkey_context_kernel(const MfkeyContext* ctx);
+
+// Allocate / free scratch memory for one recovery at a time
+MfkeyScratch* mfkey_scratch_new(void);
+void mfkey_scratch_free(MfkeyScratch* scratch);
+
+// Run the attack for one nonce. Returns true if the key was found; candidates
+// of static_encrypted nonces are collected without stopping the search, and
+// hardnested nonces are searched on config.search_threads threads. With a
+// result database, stored results are replayed through the same callbacks and
+// completed recoveries are added to it. With config.cross_check, a sample of the
+// MSB rounds of table attacks is repeated on the reference engine; differences
+// in the even buckets, odd table or keys are printed to stderr, counted in
+// cross_check_mismatches, and the reference result is kept.
+bool mfkey_recover(MfkeyContext* ctx, MfkeyScratch* scratch, MfClassicNonce* n);
+
+// Expected cost of mfkey_recover() for a nonce
+typedef struct {
+    double seconds;       // Until the key is found (half the MSB rounds on average), or the full search
+    double full_seconds;  // Searching every MSB round
+    double odd_survival;  // Sampled states per semi-state after expansion, odd half
+    double even_survival; // Same for the even half
+    bool odd_cached;      // The odd half is in the cache directory
+    bool stored;          // Answered by the result database: no cost
+} MfkeyEstimate;
+
+// Estimate the cost of a recovery by expanding a sample of the semi-states of
+// both halves, in about a millisecond. Sampled work is converted into seconds
+// by a calibration run the first time. Thread-safe.
+void mfkey_estimate(const MfkeyConfig* config, const MfClassicNonce* n, MfkeyEstimate* estimate);
+
+// Keys of a dictionary loaded for mfkey_dict_attack() (see mfkey_dictattack.h)
+typedef struct MfkeyDictKeys MfkeyDictKeys;
+
+// Try every key of a dictionary on a nonce, 512 keys per call of the bitsliced
+// kernel of config->force_isa (or the best supported one). Returns true and sets
+// n->key to the matching key. Thread-safe.
+bool mfkey_dict_attack(const MfkeyConfig* config, const MfkeyDictKeys* dict, MfClassicNonce* n);
+
+// Keys found and candidates collected so far (owned by the context)
+const MfClassicKey* mfkey_found_keys(const MfkeyContext* ctx, int* count);
+const MfClassicKey* mfkey_candidate_keys(const MfkeyContext* ctx, int* count);
+void mfkey_clear_candidates(MfkeyContext* ctx);
+
+// Statistics accumulated over all recoveries of a context
+void mfkey_get_stats(const MfkeyContext* ctx, MfkeyStats* stats);
+
+// Leaf checks of a context so far. Unlike mfkey_get_stats(), safe to call from
+// another thread while a recovery runs (e.g. for live throughput).
+uint64_t mfkey_context_leaf_checks(const MfkeyContext* ctx);
+
+// Request / query cancellation
+void mfkey_cancel(MfkeyCancelToken* token);
+bool mfkey_cancel_requested(const MfkeyCancelToken* token);
+
+// Compiled kernel variants, in order of preference. The first is the
+// reference engine, which is only used when forced.
+int mfkey_kernel_variant_count(void);
+const char* mfkey_kernel_variant_name(int index);
+bool mfkey_kernel_variant_supported(int index);
+
+// Name of an attack type
+const char* mfkey_attack_name(AttackType attack);
+
+// Load the nonces of a nested attack log or an mfkey32 reader log and append them
+// to *nonces. A dist > 0 nested line adds one nonce per plaintext candidate of its
+// table nonce (see mfkey_dist_candidates), nearest to the logged distance first;
+// with two nonces, the candidates of nt0 ride along as nt0_alt. Hardnested lines
+// (nt_enc / par_enc) are merged into one nonce per UID, sector and key type.
+// on_loaded (optional) is called for every nonce added. Returns the number of
+// nonces loaded, or -1 if the file cannot be opened.
+int mfkey_load_nonces(
+    const char* filename,
+    MfClassicNonce** nonces,
+    int* nonce_count,
+    void (*on_loaded)(void* user, int count, const MfClassicNonce* nonce),
+    void* user);
+
+// Plaintext nonces behind one pair of a dist > 0 nested line: nt_ref is the nonce
+// of the authenticated session, ks the encrypted nested nonce XOR nt_ref and par
+// its encrypted parity bits. The tag nonce lies dist +/- MFKEY_DIST_WINDOW PRNG
+// steps after nt_ref; candidates whose first three parity bits disagree with the
+// keystream are dropped (7 in 8). Fills nts and errors (distance from dist), nearest
+// first, and returns the count; the arrays need 2 * MFKEY_DIST_WINDOW + 1 entries.
+int mfkey_dist_candidates(uint32_t nt_ref, uint32_t ks, uint8_t par, int dist, uint32_t* nts, int* errors);
+
+// Precompute the odd-half cache for every keystream prefix not cached yet.
+// on_built (optional) is called after each entry. Returns the number of
+// entries built, or -1 on failure or cancellation.
+int mfkey_build_cache(
+    MfkeyContext* ctx,
+    MfkeyScratch* scratch,
+    const char* cache_dir,
+    void (*on_built)(void* user, uint32_t prefix, uint32_t total),
+    void* user);
+
+// Benchmark the filter-table state expansion against composed filter() calls
+int mfkey_bench_filter(void);
+
+// Check the byte-stepping Crypto1 word operations against the bit-serial ones
+// on random states and time both. Returns non-zero on a mismatch.
+int mfkey_bench_crypto1(void);
+
+// Check the bitsliced leaf checks against the scalar ones on random states and
+// time both. Returns non-zero on a mismatch.
+int mfkey_bench_leaf(void);
+
+// Check the compacting extend_table() of a kernel variant (NULL: best supported)
+// against the in-place one on random sub-ranges and time both. Returns non-zero
+// on a mismatch.
+int mfkey_bench_extend(const char* force_isa);
+
+// Run the same nonces through every supported engine (or only force_isa) and the
+// reference engine: time the odd-table expansion and one MSB round of each attack
+// type, print the speedups and check that buckets and keys agree. Returns non-zero
+// on a mismatch.
+int mfkey_bench_engines(const char* force_isa);
+
+#endif // MFKEY_H
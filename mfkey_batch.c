@@ -0,0 +1,911 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mfkey_batch.h"
+#include "mfkey_dict.h"
+#include "mfkey_governor.h"
+#include "mfkey_results.h"
+#include "mfkey_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Milliseconds between on_update calls while jobs are running
+#define BATCH_UPDATE_MS 200
+
+struct MfkeyBatchWorker {
+    MfkeyBatch* batch;
+    pthread_t thread;
+    bool started;
+    MfkeyContext* ctx;
+    MfkeyScratch* scratch;
+    MfkeyCancelToken cancel; // Set on global cancel or when the group of job is solved
+    int job;                 // Running job, -1 if idle
+    double busy;             // Seconds spent on finished jobs
+    struct timespec job_start;
+};
+
+static double seconds_between(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static uint32_t hash_mix(uint32_t h, uint32_t v) {
+    h ^= v;
+    h *= 0x01000193;
+    return h ^ (h >> 15);
+}
+
+// Identity of a nonce: everything the recovery reads, plus its sector labels
+static bool nonce_same(const MfClassicNonce* a, const MfClassicNonce* b) {
+    if(a->attack != b->attack || a->uid != b->uid || a->sector != b->sector || a->key_type != b->key_type ||
+       a->nt0 != b->nt0 || a->nt1 != b->nt1) {
+        return false;
+    }
+    if(a->attack == mfkey32) {
+        return a->nr0_enc == b->nr0_enc && a->ar0_enc == b->ar0_enc && a->nr1_enc == b->nr1_enc &&
+               a->ar1_enc == b->ar1_enc && a->has_at0 == b->has_at0 && a->has_nt1 == b->has_nt1 &&
+               (!a->has_at0 || a->at0_enc == b->at0_enc);
+    }
+    if(a->attack == hardnested) {
+        return memcmp(a->hard_first_seen, b->hard_first_seen, sizeof(a->hard_first_seen)) == 0 &&
+               memcmp(a->hard_first_sum, b->hard_first_sum, sizeof(a->hard_first_sum)) == 0 &&
+               a->hard_count == b->hard_count &&
+               memcmp(a->hard_nt_enc, b->hard_nt_enc, sizeof(uint32_t) * a->hard_count) == 0 &&
+               memcmp(a->hard_par, b->hard_par, a->hard_count) == 0;
+    }
+    return a->ks1_1_enc == b->ks1_1_enc && a->ks1_2_enc == b->ks1_2_enc && a->par_1 == b->par_1 &&
+           a->par_2 == b->par_2 && a->nt0_alt_count == b->nt0_alt_count &&
+           memcmp(a->nt0_alt, b->nt0_alt, sizeof(uint32_t) * a->nt0_alt_count) == 0;
+}
+
+static uint32_t nonce_hash(const MfClassicNonce* n) {
+    uint32_t h = 0x811c9dc5;
+    h = hash_mix(h, n->attack);
+    h = hash_mix(h, n->uid);
+    h = hash_mix(h, n->nt0);
+    h = hash_mix(h, n->nt1);
+    if(n->attack == mfkey32) {
+        h = hash_mix(h, n->nr0_enc);
+        h = hash_mix(h, n->ar0_enc);
+    } else if(n->attack == hardnested) {
+        for(int i = 0; i < 32; i++) {
+            h = hash_mix(h, n->hard_first_seen[i] | n->hard_first_sum[i] << 8);
+        }
+    } else {
+        h = hash_mix(h, n->ks1_1_enc);
+        h = hash_mix(h, n->ks1_2_enc);
+    }
+    return h;
+}
+
+static uint32_t group_hash(uint32_t uid, int sector, char key_type) {
+    return hash_mix(hash_mix(hash_mix(0x811c9dc5, uid), (uint32_t)sector), (uint8_t)key_type);
+}
+
+// Grow both hash indexes to keep them at most half full
+static bool reserve_index(MfkeyBatch* batch, int count) {
+    if(count * 2 <= batch->index_size) {
+        return true;
+    }
+    int size = batch->index_size ? batch->index_size : 256;
+    while(count * 2 > size) {
+        size *= 2;
+    }
+    int* job_index = malloc(sizeof(int) * size);
+    int* group_index = malloc(sizeof(int) * size);
+    if(!job_index || !group_index) {
+        free(job_index);
+        free(group_index);
+        return false;
+    }
+    memset(job_index, 0xff, sizeof(int) * size);
+    memset(group_index, 0xff, sizeof(int) * size);
+    for(int j = 0; j < batch->job_count; j++) {
+        uint32_t slot = nonce_hash(&batch->jobs[j].nonce) & (size - 1);
+        while(job_index[slot] >= 0) slot = (slot + 1) & (size - 1);
+        job_index[slot] = j;
+    }
+    for(int g = 0; g < batch->group_count; g++) {
+        const MfkeyBatchGroup* group = &batch->groups[g];
+        uint32_t slot = group_hash(group->uid, group->sector, group->key_type) & (size - 1);
+        while(group_index[slot] >= 0) slot = (slot + 1) & (size - 1);
+        group_index[slot] = g;
+    }
+    free(batch->job_index);
+    free(batch->group_index);
+    batch->job_index = job_index;
+    batch->group_index = group_index;
+    batch->index_size = size;
+    return true;
+}
+
+// Find or add the group of a nonce. Returns its index, or -1 on allocation failure.
+static int batch_group(MfkeyBatch* batch, const MfClassicNonce* n) {
+    uint32_t slot = group_hash(n->uid, n->sector, n->key_type) & (batch->index_size - 1);
+    for(; batch->group_index[slot] >= 0; slot = (slot + 1) & (batch->index_size - 1)) {
+        const MfkeyBatchGroup* group = &batch->groups[batch->group_index[slot]];
+        if(group->uid == n->uid && group->sector == n->sector && group->key_type == n->key_type) {
+            return batch->group_index[slot];
+        }
+    }
+    MfkeyBatchGroup* groups = realloc(batch->groups, sizeof(MfkeyBatchGroup) * (batch->group_count + 1));
+    if(!groups) {
+        return -1;
+    }
+    batch->groups = groups;
+    MfkeyBatchGroup* group = &groups[batch->group_count];
+    memset(group, 0, sizeof(*group));
+    group->uid = n->uid;
+    group->sector = n->sector;
+    group->key_type = n->key_type;
+    batch->group_index[slot] = batch->group_count;
+    return batch->group_count++;
+}
+
+// Find or add the job of a nonce. Returns its index, or -1 on allocation failure.
+static int batch_job(MfkeyBatch* batch, const MfClassicNonce* n) {
+    if(!reserve_index(batch, batch->job_count + 1)) {
+        return -1;
+    }
+    uint32_t slot = nonce_hash(n) & (batch->index_size - 1);
+    for(; batch->job_index[slot] >= 0; slot = (slot + 1) & (batch->index_size - 1)) {
+        MfkeyBatchJob* job = &batch->jobs[batch->job_index[slot]];
+        if(nonce_same(&job->nonce, n)) {
+            job->owners++;
+            return batch->job_index[slot];
+        }
+    }
+    int group = batch_group(batch, n);
+    MfkeyBatchJob* jobs = realloc(batch->jobs, sizeof(MfkeyBatchJob) * (batch->job_count + 1));
+    if(group < 0 || !jobs) {
+        if(jobs) batch->jobs = jobs;
+        return -1;
+    }
+    batch->jobs = jobs;
+    MfkeyBatchJob* job = &jobs[batch->job_count];
+    memset(job, 0, sizeof(*job));
+    job->nonce = *n;
+    job->group = group;
+    job->owners = 1;
+    batch->job_index[slot] = batch->job_count;
+    return batch->job_count++;
+}
+
+void mfkey_batch_init(MfkeyBatch* batch, const MfkeyConfig* config, MfkeyCancelToken* cancel, int threads) {
+    memset(batch, 0, sizeof(*batch));
+    batch->config = *config;
+    batch->cancel = cancel;
+    batch->threads = threads < 1 ? 1 : threads;
+}
+
+void mfkey_batch_free(MfkeyBatch* batch) {
+    for(int i = 0; i < batch->log_count; i++) {
+        free(batch->logs[i].name);
+        free(batch->logs[i].jobs);
+    }
+    for(int j = 0; j < batch->job_count; j++) {
+        free(batch->jobs[j].candidates);
+    }
+    free(batch->logs);
+    free(batch->jobs);
+    free(batch->groups);
+    free(batch->job_index);
+    free(batch->group_index);
+    free(batch->order);
+    free(batch->completed);
+    memset(batch, 0, sizeof(*batch));
+}
+
+bool mfkey_batch_add_log(MfkeyBatch* batch, const char* name, const MfClassicNonce* nonces, int nonce_count) {
+    MfkeyBatchLog* logs = realloc(batch->logs, sizeof(MfkeyBatchLog) * (batch->log_count + 1));
+    if(!logs) {
+        return false;
+    }
+    batch->logs = logs;
+    MfkeyBatchLog* log = &logs[batch->log_count];
+    log->name = malloc(strlen(name) + 1);
+    log->jobs = malloc(sizeof(int) * (nonce_count > 0 ? nonce_count : 1));
+    log->nonce_count = nonce_count;
+    if(!log->name || !log->jobs) {
+        free(log->name);
+        free(log->jobs);
+        return false;
+    }
+    strcpy(log->name, name);
+    batch->log_count++;
+
+    for(int i = 0; i < nonce_count; i++) {
+        if((log->jobs[i] = batch_job(batch, &nonces[i])) < 0) {
+            log->nonce_count = i;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Hand out the next job, skipping nonces whose group is already solved. Returns -1
+// when the queue is empty. Called with the lock held.
+static int take_job(MfkeyBatch* batch) {
+    while(batch->next < batch->order_count) {
+        int j = batch->order[batch->next++];
+        MfkeyBatchJob* job = &batch->jobs[j];
+        if(job->done) continue;
+        if(job->nonce.attack != static_encrypted && batch->groups[job->group].solved) {
+            job->done = job->skipped = true;
+            batch->completed[batch->completed_count++] = j;
+            continue;
+        }
+        return j;
+    }
+    return -1;
+}
+
+static void* batch_worker(void* arg) {
+    MfkeyBatchWorker* worker = arg;
+    MfkeyBatch* batch = worker->batch;
+    char name[32];
+    const int slot = (int)(worker - batch->workers);
+    snprintf(name, sizeof(name), "worker %d", slot + 1);
+    mfkey_trace_thread_name(name);
+    MfkeyGovernor* governor = batch->config.governor;
+    if(governor) {
+        mfkey_governor_pin(governor, slot);
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    for(;;) {
+        if(mfkey_cancel_requested(batch->cancel)) break;
+        if(governor && batch->next < batch->order_count) {
+            // Parked while other processes load the host
+            pthread_mutex_unlock(&batch->lock);
+            bool admitted = mfkey_governor_admit(governor, slot, batch->threads, batch->cancel);
+            pthread_mutex_lock(&batch->lock);
+            if(!admitted) break;
+        }
+        int j = take_job(batch);
+        if(j < 0) break;
+        MfkeyBatchJob* job = &batch->jobs[j];
+        worker->job = j;
+        clock_gettime(CLOCK_MONOTONIC, &worker->job_start);
+        worker->cancel.cancelled = 0;
+        batch->running++;
+        MfClassicNonce nonce = job->nonce;
+        pthread_mutex_unlock(&batch->lock);
+
+        bool found = mfkey_recover(worker->ctx, worker->scratch, &nonce);
+        int candidate_count = 0;
+        MfClassicKey* candidates = NULL;
+        if(nonce.attack == static_encrypted) {
+            const MfClassicKey* keys = mfkey_candidate_keys(worker->ctx, &candidate_count);
+            if(candidate_count > 0 && (candidates = malloc(sizeof(MfClassicKey) * candidate_count)) != NULL) {
+                memcpy(candidates, keys, sizeof(MfClassicKey) * candidate_count);
+            } else {
+                candidate_count = 0;
+            }
+            mfkey_clear_candidates(worker->ctx);
+        }
+
+        pthread_mutex_lock(&batch->lock);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        worker->busy += seconds_between(&worker->job_start, &now);
+        worker->job = -1;
+        batch->running--;
+        if(mfkey_cancel_requested(batch->cancel)) {
+            // Interrupted: the job is left unfinished
+            free(candidates);
+            break;
+        }
+        job->nonce.key = nonce.key;
+        job->found = found;
+        job->skipped = !found && mfkey_cancel_requested(&worker->cancel);
+        job->candidates = candidates;
+        job->candidate_count = candidate_count;
+        job->done = true;
+        MfkeyBatchGroup* group = &batch->groups[job->group];
+        if(found && !group->solved) {
+            group->solved = true;
+            group->key = nonce.key;
+            // Stop other workers on the same group
+            for(int w = 0; w < batch->threads; w++) {
+                MfkeyBatchWorker* other = &batch->workers[w];
+                if(other->job >= 0 && batch->jobs[other->job].group == job->group &&
+                   batch->jobs[other->job].nonce.attack != static_encrypted) {
+                    mfkey_cancel(&other->cancel);
+                }
+            }
+        }
+        batch->completed[batch->completed_count++] = j;
+        pthread_cond_signal(&batch->changed);
+    }
+    batch->active--;
+    pthread_cond_signal(&batch->changed);
+    pthread_mutex_unlock(&batch->lock);
+    return NULL;
+}
+
+static void merge_stats(MfkeyStats* total, const MfkeyStats* stats) {
+    total->buckets += stats->buckets;
+    total->empty_buckets += stats->empty_buckets;
+    total->odd_states += stats->odd_states;
+    total->even_states += stats->even_states;
+    if(stats->max_odd > total->max_odd) total->max_odd = stats->max_odd;
+    if(stats->max_even > total->max_even) total->max_even = stats->max_even;
+    total->leaf_checks += stats->leaf_checks;
+    total->leaf_matches += stats->leaf_matches;
+    total->leaf_bits += stats->leaf_bits;
+    total->result_hits += stats->result_hits;
+    total->dict_hits += stats->dict_hits;
+    total->parity_nonces_pruned += stats->parity_nonces_pruned;
+    total->parity_bucket_states += stats->parity_bucket_states;
+    total->parity_bucket_pruned += stats->parity_bucket_pruned;
+    total->parity_table_states += stats->parity_table_states;
+    total->parity_table_pruned += stats->parity_table_pruned;
+    total->parity_pairs += stats->parity_pairs;
+    total->parity_pairs_pruned += stats->parity_pairs_pruned;
+    total->cross_checks += stats->cross_checks;
+    total->cross_check_mismatches += stats->cross_check_mismatches;
+}
+
+// Complete every job with a stored result, so that only new nonces are scheduled
+// and solved groups are skipped from the start. Returns the number of hits.
+static int apply_stored_results(MfkeyBatch* batch) {
+    int hits = 0;
+    for(int j = 0; j < batch->job_count; j++) {
+        MfkeyBatchJob* job = &batch->jobs[j];
+        MfkeyResult result;
+        if(!mfkey_result_load(batch->config.results_dir, &job->nonce, &result)) continue;
+        job->done = job->cached = true;
+        job->found = result.found;
+        if(result.found) {
+            job->nonce.key = result.key;
+            MfkeyBatchGroup* group = &batch->groups[job->group];
+            if(!group->solved) {
+                group->solved = true;
+                group->key = result.key;
+            }
+        }
+        // Ownership of the candidate array moves to the job
+        job->candidates = result.candidates;
+        job->candidate_count = (int)result.candidate_count;
+        batch->completed[batch->completed_count++] = j;
+        hits++;
+    }
+    return hits;
+}
+
+// Try the dictionary on every job left and complete the ones it solves, as
+// stored results are. Returns the number of jobs solved.
+static int apply_dictionary(MfkeyBatch* batch) {
+    int hits = 0;
+    uint64_t trace_start = mfkey_trace_begin();
+    for(int j = 0; j < batch->job_count; j++) {
+        MfkeyBatchJob* job = &batch->jobs[j];
+        if(job->done || !mfkey_dict_attack(&batch->config, batch->dictionary, &job->nonce)) continue;
+        job->done = job->found = true;
+        MfkeyBatchGroup* group = &batch->groups[job->group];
+        if(!group->solved) {
+            group->solved = true;
+            group->key = job->nonce.key;
+        }
+        batch->completed[batch->completed_count++] = j;
+        hits++;
+    }
+    mfkey_trace_end(trace_start, "dictionary", "jobs", batch->job_count);
+    return hits;
+}
+
+// Planning tiers: group leads, backups, static_encrypted
+static int job_tier(const MfkeyBatchJob* job) {
+    return job->nonce.attack == static_encrypted ? 2 : job->backup ? 1 : 0;
+}
+
+static const MfkeyBatchJob* sort_jobs;
+
+// Within a tier: candidates of dist > 0 lines nearest to the logged distance
+// first (the likeliest to hold the key), then by cost
+static int compare_plan(const MfkeyBatchJob* x, const MfkeyBatchJob* y) {
+    int ex = abs(x->nonce.dist_error), ey = abs(y->nonce.dist_error);
+    if(ex != ey) return ex - ey;
+    if(x->cost != y->cost) return x->cost < y->cost ? -1 : 1;
+    return 0;
+}
+
+static int compare_planned_jobs(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    const MfkeyBatchJob* jx = &sort_jobs[x];
+    const MfkeyBatchJob* jy = &sort_jobs[y];
+    if(job_tier(jx) != job_tier(jy)) return job_tier(jx) - job_tier(jy);
+    int order = compare_plan(jx, jy);
+    return order ? order : x - y;
+}
+
+bool mfkey_batch_plan(MfkeyBatch* batch) {
+    free(batch->order);
+    free(batch->completed);
+    batch->order = malloc(sizeof(int) * (batch->job_count + 1));
+    batch->completed = malloc(sizeof(int) * (batch->job_count + 1));
+    int* lead = malloc(sizeof(int) * (batch->group_count + 1));
+    if(!batch->order || !batch->completed || !lead) {
+        fprintf(stderr, "Memory allocation failed!\n");
+        free(lead);
+        return false;
+    }
+    batch->completed_count = 0;
+    memset(&batch->stats, 0, sizeof(batch->stats));
+    if(batch->config.results_dir) {
+        batch->stats.result_hits = apply_stored_results(batch);
+    }
+    if(batch->dictionary) {
+        batch->stats.dict_hits = apply_dictionary(batch);
+    }
+
+    // The cheapest nonce of each unsolved group leads it
+    uint64_t trace_start = mfkey_trace_begin();
+    memset(lead, 0xff, sizeof(int) * (batch->group_count + 1));
+    batch->order_count = 0;
+    for(int j = 0; j < batch->job_count; j++) {
+        MfkeyBatchJob* job = &batch->jobs[j];
+        if(job->done) continue;
+        MfkeyEstimate estimate;
+        mfkey_estimate(&batch->config, &job->nonce, &estimate);
+        job->cost = estimate.seconds;
+        batch->order[batch->order_count++] = j;
+        if(job->nonce.attack == static_encrypted) continue;
+        int* l = &lead[job->group];
+        if(*l < 0 || compare_plan(job, &batch->jobs[*l]) < 0) *l = j;
+    }
+    for(int j = 0; j < batch->job_count; j++) {
+        MfkeyBatchJob* job = &batch->jobs[j];
+        job->backup = !job->done && job->nonce.attack != static_encrypted && lead[job->group] != j;
+    }
+    free(lead);
+    sort_jobs = batch->jobs;
+    qsort(batch->order, batch->order_count, sizeof(int), compare_planned_jobs);
+    sort_jobs = NULL;
+    mfkey_trace_end(trace_start, "plan", "jobs", batch->order_count);
+    batch->planned = true;
+    return true;
+}
+
+bool mfkey_batch_run(MfkeyBatch* batch, void (*on_update)(void* user, MfkeyBatch* batch), void* user) {
+    if(!batch->planned && !mfkey_batch_plan(batch)) {
+        return false;
+    }
+    batch->workers = calloc(batch->threads, sizeof(MfkeyBatchWorker));
+    if(!batch->workers) {
+        fprintf(stderr, "Memory allocation failed!\n");
+        return false;
+    }
+    batch->next = 0;
+    batch->running = 0;
+
+    // Contexts are created up front so that shared tables are built on this thread
+    mfkey_global_init();
+    bool ok = true;
+    for(int w = 0; w < batch->threads && ok; w++) {
+        MfkeyBatchWorker* worker = &batch->workers[w];
+        worker->batch = batch;
+        worker->job = -1;
+        worker->ctx = mfkey_context_new(&batch->config, &batch->callbacks, &worker->cancel);
+        worker->scratch = mfkey_scratch_new();
+        ok = worker->ctx && worker->scratch;
+    }
+
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->changed, NULL);
+    pthread_mutex_lock(&batch->lock);
+    batch->active = 0;
+    for(int w = 0; w < batch->threads && ok; w++) {
+        MfkeyBatchWorker* worker = &batch->workers[w];
+        worker->started = pthread_create(&worker->thread, NULL, batch_worker, worker) == 0;
+        if(!worker->started) {
+            fprintf(stderr, "Failed to start worker thread %d\n", w);
+            ok = false;
+            break;
+        }
+        batch->active++;
+    }
+    if(!ok) {
+        // Workers already started stop at their next job
+        batch->next = batch->order_count;
+    }
+
+    // Relay Ctrl+C to the workers and report progress until all of them exit
+    int reported = -1;
+    while(batch->active > 0) {
+        if(mfkey_cancel_requested(batch->cancel)) {
+            for(int w = 0; w < batch->threads; w++) {
+                mfkey_cancel(&batch->workers[w].cancel);
+            }
+        }
+        bool update = batch->completed_count != reported;
+        if(!update) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += BATCH_UPDATE_MS * 1000000L;
+            if(deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            update = pthread_cond_timedwait(&batch->changed, &batch->lock, &deadline) != 0;
+        }
+        if(update && on_update) {
+            reported = batch->completed_count;
+            on_update(user, batch);
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    for(int w = 0; w < batch->threads; w++) {
+        if(batch->workers[w].started) {
+            pthread_join(batch->workers[w].thread, NULL);
+        }
+    }
+    if(on_update) {
+        on_update(user, batch);
+    }
+
+    for(int w = 0; w < batch->threads; w++) {
+        MfkeyBatchWorker* worker = &batch->workers[w];
+        if(worker->ctx) {
+            MfkeyStats stats;
+            mfkey_get_stats(worker->ctx, &stats);
+            merge_stats(&batch->stats, &stats);
+            mfkey_context_free(worker->ctx);
+        }
+        mfkey_scratch_free(worker->scratch);
+    }
+    pthread_cond_destroy(&batch->changed);
+    pthread_mutex_destroy(&batch->lock);
+    free(batch->workers);
+    batch->workers = NULL;
+    return ok && !mfkey_cancel_requested(batch->cancel);
+}
+
+void mfkey_batch_worker_status(const MfkeyBatch* batch, int worker, uint64_t* leaf_checks, double* busy_seconds) {
+    const MfkeyBatchWorker* w = &batch->workers[worker];
+    *leaf_checks = w->ctx ? mfkey_context_leaf_checks(w->ctx) : 0;
+    *busy_seconds = w->busy;
+    if(w->job >= 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        *busy_seconds += seconds_between(&w->job_start, &now);
+    }
+}
+
+bool mfkey_batch_log_keys(const MfkeyBatch* batch, int log, MfClassicKey** keys, int* count) {
+    const MfkeyBatchLog* l = &batch->logs[log];
+    *keys = malloc(sizeof(MfClassicKey) * (l->nonce_count + 1));
+    *count = 0;
+    if(!*keys) {
+        return false;
+    }
+    for(int i = 0; i < l->nonce_count; i++) {
+        const MfkeyBatchJob* job = &batch->jobs[l->jobs[i]];
+        const MfkeyBatchGroup* group = &batch->groups[job->group];
+        const MfClassicKey* key = job->found ? &job->nonce.key : group->solved ? &group->key : NULL;
+        if(!key) continue;
+        bool seen = false;
+        for(int k = 0; k < *count && !seen; k++) {
+            seen = memcmp((*keys)[k].data, key->data, MF_CLASSIC_KEY_SIZE) == 0;
+        }
+        if(!seen) {
+            (*keys)[(*count)++] = *key;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    uint64_t key;
+    int position;
+} OrderedKey;
+
+static int compare_ordered_keys(const void* a, const void* b) {
+    const OrderedKey* x = a;
+    const OrderedKey* y = b;
+    if(x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->position - y->position;
+}
+
+static int compare_positions(const void* a, const void* b) {
+    return ((const OrderedKey*)a)->position - ((const OrderedKey*)b)->position;
+}
+
+bool mfkey_batch_log_uids(const MfkeyBatch* batch, int log, uint32_t** uids, int* count) {
+    const MfkeyBatchLog* l = &batch->logs[log];
+    OrderedKey* all = malloc(sizeof(OrderedKey) * (l->nonce_count + 1));
+    *uids = malloc(sizeof(uint32_t) * (l->nonce_count + 1));
+    *count = 0;
+    if(!all || !*uids) {
+        free(all);
+        free(*uids);
+        *uids = NULL;
+        return false;
+    }
+    int n = 0;
+    for(int i = 0; i < l->nonce_count; i++) {
+        const MfClassicNonce* nonce = &batch->jobs[l->jobs[i]].nonce;
+        if(nonce->attack != static_encrypted) continue;
+        all[n].key = nonce->uid;
+        all[n].position = n;
+        n++;
+    }
+
+    // First occurrence of each UID, back in file order
+    qsort(all, n, sizeof(OrderedKey), compare_ordered_keys);
+    int unique = 0;
+    for(int i = 0; i < n; i++) {
+        if(unique == 0 || all[unique - 1].key != all[i].key) {
+            all[unique++] = all[i];
+        }
+    }
+    qsort(all, unique, sizeof(OrderedKey), compare_positions);
+    for(int i = 0; i < unique; i++) {
+        (*uids)[i] = (uint32_t)all[i].key;
+    }
+    *count = unique;
+    free(all);
+    return true;
+}
+
+// Candidates shared by the key A and key B nonces of a sector (shared-key filter)
+typedef struct {
+    MfkeySharedKeySector report;
+    uint64_t* shared; // Packed and sorted, NULL if the key types share none
+} SharedKeySector;
+
+static int compare_packed(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Packed candidates of a log's static_encrypted nonces for a UID, sector and key
+// type, sorted without duplicates
+static bool sector_candidates(
+    const MfkeyBatch* batch,
+    const MfkeyBatchLog* l,
+    uint32_t uid,
+    int sector,
+    char key_type,
+    uint64_t** keys,
+    size_t* count) {
+    size_t total = 0;
+    for(int i = 0; i < l->nonce_count; i++) {
+        const MfClassicNonce* n = &batch->jobs[l->jobs[i]].nonce;
+        if(n->attack == static_encrypted && n->uid == uid && n->sector == sector && n->key_type == key_type) {
+            total += batch->jobs[l->jobs[i]].candidate_count;
+        }
+    }
+    *keys = malloc(sizeof(uint64_t) * (total + 1));
+    if(!*keys) return false;
+    size_t n = 0;
+    for(int i = 0; i < l->nonce_count; i++) {
+        const MfkeyBatchJob* job = &batch->jobs[l->jobs[i]];
+        const MfClassicNonce* nonce = &job->nonce;
+        if(nonce->attack != static_encrypted || nonce->uid != uid || nonce->sector != sector ||
+           nonce->key_type != key_type) {
+            continue;
+        }
+        for(int k = 0; k < job->candidate_count; k++) {
+            (*keys)[n++] = mfkey_dict_pack(job->candidates[k].data);
+        }
+    }
+    qsort(*keys, n, sizeof(uint64_t), compare_packed);
+    size_t unique = 0;
+    for(size_t i = 0; i < n; i++) {
+        if(unique == 0 || (*keys)[unique - 1] != (*keys)[i]) (*keys)[unique++] = (*keys)[i];
+    }
+    *count = unique;
+    return true;
+}
+
+static bool shared_key_sector(const MfkeyBatch* batch, const MfkeyBatchLog* l, uint32_t uid, SharedKeySector* sector) {
+    uint64_t *a, *b;
+    size_t a_count, b_count;
+    MfkeySharedKeySector* report = &sector->report;
+    sector->shared = NULL;
+    if(!sector_candidates(batch, l, uid, report->sector, 'A', &a, &a_count)) return false;
+    if(!sector_candidates(batch, l, uid, report->sector, 'B', &b, &b_count)) {
+        free(a);
+        return false;
+    }
+    report->a_count = (int)a_count;
+    report->b_count = (int)b_count;
+    size_t n = 0;
+    for(size_t i = 0, j = 0; i < a_count && j < b_count;) {
+        if(a[i] < b[j]) {
+            i++;
+        } else if(a[i] > b[j]) {
+            j++;
+        } else {
+            a[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    free(b);
+    report->shared_count = (int)n;
+    report->applied = n > 0;
+    if(n == 0) {
+        free(a);
+        return true;
+    }
+    sector->shared = a;
+    return true;
+}
+
+static void free_shared_key_sectors(SharedKeySector* sectors, int count) {
+    for(int i = 0; i < count; i++) free(sectors[i].shared);
+    free(sectors);
+}
+
+// A candidate produced by a job, at its discovery position
+typedef struct {
+    uint64_t key;
+    int position;
+    int job;
+} CandidatePair;
+
+// A candidate key with the pairs that produced it
+typedef struct {
+    uint64_t key;
+    int first;   // Discovery position
+    int support; // Distinct jobs
+    int start;   // First of its jobs in the job list
+} RankedKey;
+
+static int compare_candidate_pairs(const void* a, const void* b) {
+    const CandidatePair* x = a;
+    const CandidatePair* y = b;
+    if(x->key != y->key) return x->key < y->key ? -1 : 1;
+    return x->position - y->position;
+}
+
+static int compare_ranked_keys(const void* a, const void* b) {
+    const RankedKey* x = a;
+    const RankedKey* y = b;
+    if(x->support != y->support) return y->support - x->support;
+    return x->first - y->first;
+}
+
+bool mfkey_batch_log_candidates(const MfkeyBatch* batch, int log, uint32_t uid, MfkeyBatchCandidates* candidates) {
+    const MfkeyBatchLog* l = &batch->logs[log];
+    memset(candidates, 0, sizeof(*candidates));
+
+    // Each job counts once even if the log lists its nonce several times
+    size_t total = 0;
+    for(int i = 0; i < l->nonce_count; i++) {
+        const MfkeyBatchJob* job = &batch->jobs[l->jobs[i]];
+        if(job->nonce.attack == static_encrypted && job->nonce.uid == uid) {
+            total += job->candidate_count;
+        }
+    }
+    CandidatePair* all = malloc(sizeof(CandidatePair) * (total + 1));
+    char* used = calloc(batch->job_count, 1);
+    if(!all || !used) {
+        free(all);
+        free(used);
+        return false;
+    }
+
+    // Shared-key filter: the shared candidates of each sector of the UID
+    SharedKeySector* sectors = NULL;
+    int sector_count = 0;
+    if(batch->shared_key_filter) {
+        sectors = calloc(l->nonce_count + 1, sizeof(SharedKeySector));
+        candidates->sectors = malloc(sizeof(MfkeySharedKeySector) * (l->nonce_count + 1));
+        if(!sectors || !candidates->sectors) {
+            free(sectors);
+            free(all);
+            free(used);
+            mfkey_batch_candidates_free(candidates);
+            return false;
+        }
+        for(int i = 0; i < l->nonce_count; i++) {
+            const MfClassicNonce* nonce = &batch->jobs[l->jobs[i]].nonce;
+            if(nonce->attack != static_encrypted || nonce->uid != uid) continue;
+            int c = 0;
+            while(c < sector_count && sectors[c].report.sector != nonce->sector) c++;
+            if(c < sector_count) continue;
+            sectors[sector_count].report.sector = nonce->sector;
+            if(!shared_key_sector(batch, l, uid, &sectors[sector_count])) {
+                free_shared_key_sectors(sectors, sector_count);
+                free(all);
+                free(used);
+                mfkey_batch_candidates_free(candidates);
+                return false;
+            }
+            candidates->sectors[sector_count] = sectors[sector_count].report;
+            sector_count++;
+        }
+        candidates->sector_count = sector_count;
+    }
+
+    size_t n = 0;
+    for(int i = 0; i < l->nonce_count; i++) {
+        const MfkeyBatchJob* job = &batch->jobs[l->jobs[i]];
+        if(job->nonce.attack != static_encrypted || job->nonce.uid != uid || used[l->jobs[i]]) continue;
+        used[l->jobs[i]] = 1;
+        const SharedKeySector* shared = NULL;
+        for(int c = 0; c < sector_count; c++) {
+            if(sectors[c].report.sector == job->nonce.sector && sectors[c].shared) shared = &sectors[c];
+        }
+        for(int k = 0; k < job->candidate_count; k++) {
+            uint64_t key = mfkey_dict_pack(job->candidates[k].data);
+            if(shared && !bsearch(&key, shared->shared, shared->report.shared_count, sizeof(uint64_t), compare_packed)) {
+                continue;
+            }
+            all[n].key = key;
+            all[n].position = (int)n;
+            all[n].job = l->jobs[i];
+            n++;
+        }
+    }
+    free(used);
+    free_shared_key_sectors(sectors, sector_count);
+
+    // Group the pairs by key: the jobs of a key are its support, listed in
+    // discovery order (a job's candidates are contiguous, so repeats are adjacent)
+    qsort(all, n, sizeof(CandidatePair), compare_candidate_pairs);
+    RankedKey* ranked = malloc(sizeof(RankedKey) * (n + 1));
+    int* jobs = malloc(sizeof(int) * (n + 1));
+    if(!ranked || !jobs) {
+        free(all);
+        free(ranked);
+        free(jobs);
+        mfkey_batch_candidates_free(candidates);
+        return false;
+    }
+    size_t unique = 0, job_total = 0;
+    for(size_t i = 0; i < n; i++) {
+        if(unique == 0 || ranked[unique - 1].key != all[i].key) {
+            ranked[unique].key = all[i].key;
+            ranked[unique].first = all[i].position;
+            ranked[unique].support = 0;
+            ranked[unique].start = (int)job_total;
+            unique++;
+        } else if(jobs[job_total - 1] == all[i].job) {
+            continue;
+        }
+        jobs[job_total++] = all[i].job;
+        ranked[unique - 1].support++;
+    }
+    free(all);
+
+    // Most supported first; ties keep discovery order
+    qsort(ranked, unique, sizeof(RankedKey), compare_ranked_keys);
+    candidates->keys = malloc(sizeof(MfClassicKey) * (unique + 1));
+    candidates->support = malloc(sizeof(int) * (unique + 1));
+    candidates->nonce_start = malloc(sizeof(int) * (unique + 1));
+    candidates->nonces = malloc(sizeof(int) * (job_total + 1));
+    if(!candidates->keys || !candidates->support || !candidates->nonce_start || !candidates->nonces) {
+        free(ranked);
+        free(jobs);
+        mfkey_batch_candidates_free(candidates);
+        return false;
+    }
+    int m = 0;
+    for(size_t i = 0; i < unique; i++) {
+        mfkey_dict_unpack(ranked[i].key, candidates->keys[i].data);
+        candidates->support[i] = ranked[i].support;
+        candidates->nonce_start[i] = m;
+        for(int k = 0; k < ranked[i].support; k++) {
+            candidates->nonces[m++] = jobs[ranked[i].start + k];
+        }
+    }
+    candidates->nonce_start[unique] = m;
+    candidates->count = (int)unique;
+    free(ranked);
+    free(jobs);
+    return true;
+}
+
+void mfkey_batch_candidates_free(MfkeyBatchCandidates* candidates) {
+    free(candidates->keys);
+    free(candidates->support);
+    free(candidates->nonce_start);
+    free(candidates->nonces);
+    free(candidates->sectors);
+    memset(candidates, 0, sizeof(*candidates));
+}
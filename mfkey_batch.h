@@ -0,0 +1,153 @@
+#ifndef MFKEY_BATCH_H
+#define MFKEY_BATCH_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "mfkey.h"
+
+// Shared scheduler for the nonces of many logs in one process. Identical nonces
+// are recovered once, the cheapest nonce of each UID/sector/key type group runs
+// first, a key found for a group skips its remaining nonces in every log, and
+// the jobs run on a pool of worker threads, each with its own context and
+// scratch memory.
+
+// One unique nonce
+typedef struct {
+    MfClassicNonce nonce;     // nonce.key holds the key once found
+    int group;                // UID/sector/key type group
+    int owners;               // Loaded nonces sharing this job
+    bool done;
+    bool found;
+    bool skipped;             // Not run to the end: the group was solved first
+    bool cached;              // Answered from the result database
+    bool backup;              // A cheaper nonce of the group is planned first
+    double cost;              // Estimated seconds (mfkey_estimate)
+    MfClassicKey* candidates; // static_encrypted candidates
+    int candidate_count;
+} MfkeyBatchJob;
+
+// One UID/sector/key type
+typedef struct {
+    uint32_t uid;
+    int sector;
+    char key_type;
+    bool solved;
+    MfClassicKey key;
+} MfkeyBatchGroup;
+
+// One loaded log
+typedef struct {
+    char* name;
+    int* jobs; // Job of each loaded nonce, in file order
+    int nonce_count;
+} MfkeyBatchLog;
+
+typedef struct MfkeyBatchWorker MfkeyBatchWorker;
+
+typedef struct MfkeyBatch {
+    MfkeyConfig config;
+    MfkeyCancelToken* cancel; // Global cancellation (e.g. Ctrl+C)
+    int threads;
+    MfkeyCallbacks callbacks; // Given to every worker context: called on worker threads
+    bool shared_key_filter;   // See mfkey_batch_log_candidates
+    const MfkeyDictKeys* dictionary; // Keys tried on every nonce when planning (NULL: none)
+
+    MfkeyBatchLog* logs;
+    int log_count;
+    MfkeyBatchJob* jobs;
+    int job_count;
+    MfkeyBatchGroup* groups;
+    int group_count;
+
+    // Hash indexes of jobs and groups (open addressing, -1 = empty)
+    int* job_index;
+    int* group_index;
+    int index_size;
+
+    // Plan (mfkey_batch_plan)
+    bool planned;
+    int* order; // Jobs left to run, in scheduling order
+    int order_count;
+
+    // Run state, guarded by lock
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int next;       // Next entry of order to hand out
+    int* completed; // Finished jobs in completion order
+    int completed_count;
+    int running;
+    int active; // Worker threads not exited yet
+    MfkeyBatchWorker* workers;
+
+    MfkeyStats stats; // Merged over all workers after the run
+} MfkeyBatch;
+
+// Initialize an empty batch. threads < 1 selects one worker.
+void mfkey_batch_init(MfkeyBatch* batch, const MfkeyConfig* config, MfkeyCancelToken* cancel, int threads);
+void mfkey_batch_free(MfkeyBatch* batch);
+
+// Add the nonces of a log (copied). Returns false on allocation failure.
+bool mfkey_batch_add_log(MfkeyBatch* batch, const char* name, const MfClassicNonce* nonces, int nonce_count);
+
+// Plan the run: complete the jobs with stored results (config.results_dir),
+// estimate the cost of the others and order them. Each unsolved group gets its
+// cheapest non-static_encrypted nonce first, cheapest groups first; the other
+// nonces of the groups follow by cost as backups, then static_encrypted nonces
+// by cost. Called by mfkey_batch_run() unless done before. Returns false on
+// allocation failure.
+bool mfkey_batch_plan(MfkeyBatch* batch);
+
+// Recover all jobs, in the order of the plan. New results are added to the
+// result database as they complete.
+// on_update (optional) is called on the calling thread, with the batch locked,
+// whenever jobs complete, at least every 200 ms and once after the workers have
+// exited; it may read batch->completed. Returns false if a worker could not be
+// created or the run was cancelled.
+bool mfkey_batch_run(MfkeyBatch* batch, void (*on_update)(void* user, MfkeyBatch* batch), void* user);
+
+// Live status of a worker during mfkey_batch_run(), for on_update only: leaf
+// checks so far and seconds spent on jobs.
+void mfkey_batch_worker_status(const MfkeyBatch* batch, int worker, uint64_t* leaf_checks, double* busy_seconds);
+
+// Keys for the nonces of a log, including keys found through other logs, in
+// file order without duplicates. The caller frees *keys.
+bool mfkey_batch_log_keys(const MfkeyBatch* batch, int log, MfClassicKey** keys, int* count);
+
+// UIDs with static_encrypted nonces in a log, in file order. The caller frees *uids.
+bool mfkey_batch_log_uids(const MfkeyBatch* batch, int log, uint32_t** uids, int* count);
+
+// Shared-key filter outcome of one sector of a UID
+typedef struct {
+    int sector;
+    int a_count;      // Distinct candidates of the key A nonces
+    int b_count;      // Distinct candidates of the key B nonces
+    int shared_count; // Candidates of both
+    bool applied;     // Only the shared candidates were kept
+} MfkeySharedKeySector;
+
+// Candidates of a UID, ranked by support: the number of distinct nonces that
+// produced each key
+typedef struct {
+    MfClassicKey* keys; // Most supported first, ties in discovery order
+    int* support;
+    int* nonce_start; // Jobs of keys[i]: nonces[nonce_start[i]] .. nonces[nonce_start[i + 1] - 1]
+    int* nonces;      // Jobs of the batch, in discovery order per key
+    int count;
+    MfkeySharedKeySector* sectors; // With shared_key_filter: each sector of the UID
+    int sector_count;
+} MfkeyBatchCandidates;
+
+// Union of the candidates of a log's static_encrypted nonces for a UID.
+//
+// shared_key_filter assumes that key A and key B of a sector are the same key
+// (cards personalized with one key for both, as many clones are): a sector whose
+// key A and key B nonces share candidates only contributes the shared ones. It
+// does not check a key A against a key B candidate, so it is no use on cards with
+// distinct keys; there the candidate sets almost never intersect and the sector
+// keeps all of its candidates. candidates->sectors tells for each sector whether
+// the filter applied. Free with mfkey_batch_candidates_free().
+bool mfkey_batch_log_candidates(const MfkeyBatch* batch, int log, uint32_t uid, MfkeyBatchCandidates* candidates);
+void mfkey_batch_candidates_free(MfkeyBatchCandidates* candidates);
+
+#endif // MFKEY_BATCH_H
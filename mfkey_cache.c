@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mfkey_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_OFFSET_COUNT 257
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t prefix;
+    uint32_t count;
+} CacheHeader;
+
+bool mfkey_odd_table_from_sorted(MfkeyOddTable* table, uint32_t* states, uint32_t count) {
+    uint32_t* offsets = malloc(sizeof(uint32_t) * CACHE_OFFSET_COUNT);
+    if(!offsets) {
+        free(states);
+        return false;
+    }
+
+    // States are sorted, so each MSB bucket is a contiguous run
+    uint32_t i = 0;
+    for(int msb = 0; msb < 256; msb++) {
+        offsets[msb] = i;
+        while(i < count && (states[i] >> 24) == (uint32_t)msb) {
+            i++;
+        }
+    }
+    offsets[256] = count;
+
+    table->offsets = offsets;
+    table->states = states;
+    table->count = count;
+    table->memory = NULL;
+    table->memory_size = 0;
+    table->mapped = false;
+    return true;
+}
+
+void mfkey_odd_table_free(MfkeyOddTable* table) {
+    if(table->mapped) {
+#ifdef _WIN32
+        free(table->memory);
+#else
+        munmap(table->memory, table->memory_size);
+#endif
+    } else if(table->offsets) {
+        free((void*)table->offsets);
+        free((void*)table->states);
+    }
+    memset(table, 0, sizeof(*table));
+}
+
+void mfkey_cache_path(char* path, size_t size, const char* cache_dir, uint32_t prefix) {
+    snprintf(path, size, "%s/odd_%04x.v%d.mfkc", cache_dir, prefix, MFKEY_CACHE_VERSION);
+}
+
+bool mfkey_cache_load(const char* cache_dir, uint32_t prefix, MfkeyOddTable* table) {
+    char path[512];
+    mfkey_cache_path(path, sizeof(path), cache_dir, prefix);
+
+    void* memory = NULL;
+    size_t size = 0;
+#ifdef _WIN32
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    if(length > 0 && (memory = malloc(length)) != NULL) {
+        size = fread(memory, 1, length, file);
+    }
+    fclose(file);
+    if(!memory) {
+        return false;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+        size = st.st_size;
+        memory = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if(memory == MAP_FAILED) {
+            memory = NULL;
+        }
+    }
+    close(fd);
+    if(!memory) {
+        return false;
+    }
+#endif
+
+    // Validate before use; a stale or foreign file is treated as a miss
+    const CacheHeader* header = memory;
+    const size_t table_size = sizeof(CacheHeader) + sizeof(uint32_t) * CACHE_OFFSET_COUNT;
+    bool valid = size >= table_size && memcmp(header->magic, MFKEY_CACHE_MAGIC, 4) == 0 &&
+                 header->version == MFKEY_CACHE_VERSION && header->prefix == prefix &&
+                 size == table_size + sizeof(uint32_t) * (size_t)header->count;
+    const uint32_t* offsets = (const uint32_t*)(header + 1);
+    valid = valid && offsets[256] == header->count;
+
+    table->memory = memory;
+    table->memory_size = size;
+    table->mapped = true;
+    if(!valid) {
+        mfkey_odd_table_free(table);
+        return false;
+    }
+    table->offsets = offsets;
+    table->states = offsets + CACHE_OFFSET_COUNT;
+    table->count = header->count;
+    return true;
+}
+
+bool mfkey_cache_store(const char* cache_dir, uint32_t prefix, const MfkeyOddTable* table) {
+    char path[512], temp_path[600];
+    mfkey_cache_path(path, sizeof(path), cache_dir, prefix);
+    // Unique per writer: worker threads of one process may store the same prefix
+    static atomic_uint store_counter;
+    snprintf(temp_path, sizeof(temp_path), "%s.%ld.%u.tmp", path, (long)getpid(),
+             atomic_fetch_add(&store_counter, 1));
+
+    FILE* file = fopen(temp_path, "wb");
+    if(!file) {
+        fprintf(stderr, "Failed to create cache file: %s\n", temp_path);
+        return false;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, MFKEY_CACHE_MAGIC, 4);
+    header.version = MFKEY_CACHE_VERSION;
+    header.prefix = prefix;
+    header.count = table->count;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(table->offsets, sizeof(uint32_t), CACHE_OFFSET_COUNT, file) == CACHE_OFFSET_COUNT &&
+              fwrite(table->states, sizeof(uint32_t), table->count, file) == table->count;
+    if(fclose(file) != 0) {
+        ok = false;
+    }
+
+    // Readers only ever see complete files
+#ifdef _WIN32
+    if(ok) remove(path);
+#endif
+    if(!ok || rename(temp_path, path) != 0) {
+        remove(temp_path);
+        fprintf(stderr, "Failed to write cache file: %s\n", path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef MFKEY_CACHE_H
+#define MFKEY_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Odd-half cache file: magic, version, prefix and state count (native byte order),
+// followed by 257 bucket offsets and the sorted unique odd states of all 256 MSB buckets
+#define MFKEY_CACHE_MAGIC       "MFKO"
+#define MFKEY_CACHE_VERSION     1
+#define MFKEY_CACHE_PREFIX_BITS 13
+#define MFKEY_CACHE_PREFIXES    (1 << MFKEY_CACHE_PREFIX_BITS)
+
+// Odd-half expansion of one keystream prefix, bucketed by MSB.
+// Bucket msb holds states[offsets[msb]] .. states[offsets[msb + 1] - 1].
+typedef struct {
+    const uint32_t* offsets;
+    const uint32_t* states;
+    uint32_t count;
+    void* memory;       // Heap block or mapping backing offsets and states
+    size_t memory_size;
+    bool mapped;
+} MfkeyOddTable;
+
+// Keystream prefix selecting the odd-half expansion of an odd keystream word
+static inline uint32_t mfkey_cache_prefix(uint32_t oks) {
+    return oks & (MFKEY_CACHE_PREFIXES - 1);
+}
+
+// Build a table from sorted unique odd states (takes ownership of states)
+bool mfkey_odd_table_from_sorted(MfkeyOddTable* table, uint32_t* states, uint32_t count);
+
+// Release a table (heap or mapping)
+void mfkey_odd_table_free(MfkeyOddTable* table);
+
+// Path of the cache file for a prefix
+void mfkey_cache_path(char* path, size_t size, const char* cache_dir, uint32_t prefix);
+
+// Map the cached table for a prefix read-only. Returns false if missing or stale.
+bool mfkey_cache_load(const char* cache_dir, uint32_t prefix, MfkeyOddTable* table);
+
+// Store a table for a prefix (written to a temporary file and renamed into place)
+bool mfkey_cache_store(const char* cache_dir, uint32_t prefix, const MfkeyOddTable* table);
+
+#endif // MFKEY_CACHE_H
@@ -0,0 +1,262 @@
+#define _GNU_SOURCE
+#include "mfkey_cpu.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#if defined(MFKEY_CPU_ARM64) && defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_ASIMD
+#define HWCAP_ASIMD (1 << 1)
+#endif
+#ifndef HWCAP_SVE
+#define HWCAP_SVE (1 << 22)
+#endif
+#endif
+
+static MfkeyCpuFeatures cpu_features;
+static bool cpu_features_detected = false;
+
+static void detect_features(MfkeyCpuFeatures* f) {
+#if defined(MFKEY_CPU_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    f->sse42 = __builtin_cpu_supports("sse4.2");
+    f->popcnt = __builtin_cpu_supports("popcnt");
+    f->avx2 = __builtin_cpu_supports("avx2");
+    f->bmi2 = __builtin_cpu_supports("bmi2");
+    f->avx512f = __builtin_cpu_supports("avx512f");
+    f->avx512bw = __builtin_cpu_supports("avx512bw");
+    f->avx512vl = __builtin_cpu_supports("avx512vl");
+#elif defined(MFKEY_CPU_ARM64) && defined(__linux__)
+    unsigned long hwcap = getauxval(AT_HWCAP);
+    f->neon = (hwcap & HWCAP_ASIMD) != 0;
+    f->sve = (hwcap & HWCAP_SVE) != 0;
+#elif defined(MFKEY_CPU_ARM64)
+    // NEON is part of the arm64 baseline; SVE is not detected on this platform
+    f->neon = true;
+#else
+    (void)f;
+#endif
+}
+
+const MfkeyCpuFeatures* mfkey_cpu_features(void) {
+    if(!cpu_features_detected) {
+        detect_features(&cpu_features);
+        cpu_features_detected = true;
+    }
+    return &cpu_features;
+}
+
+void mfkey_cpu_print_features(const MfkeyCpuFeatures* f) {
+    const struct {
+        const char* name;
+        bool present;
+    } list[] = {
+        {"sse4.2", f->sse42},
+        {"popcnt", f->popcnt},
+        {"avx2", f->avx2},
+        {"bmi2", f->bmi2},
+        {"avx512f", f->avx512f},
+        {"avx512bw", f->avx512bw},
+        {"avx512vl", f->avx512vl},
+        {"neon", f->neon},
+        {"sve", f->sve},
+    };
+
+    int printed = 0;
+    for(size_t i = 0; i < sizeof(list) / sizeof(list[0]); i++) {
+        if(list[i].present) {
+            printf("%s%s", printed++ ? " " : "", list[i].name);
+        }
+    }
+    if(!printed) {
+        printf("(none)");
+    }
+    printf("\n");
+}
+
+static MfkeyCpuBudget cpu_budget;
+static pthread_once_t cpu_budget_once = PTHREAD_ONCE_INIT;
+
+#if defined(__linux__)
+// Quota of a cgroup v2 directory from cpu.max ("max 100000" or "<quota> <period>")
+static double quota_v2(const char* dir) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/cpu.max", dir);
+    FILE* f = fopen(path, "r");
+    if(!f) {
+        return 0;
+    }
+    char quota[32];
+    long period = 0;
+    double cpus = 0;
+    if(fscanf(f, "%31s %ld", quota, &period) == 2 && strcmp(quota, "max") != 0 && period > 0) {
+        cpus = atof(quota) / period;
+    }
+    fclose(f);
+    return cpus;
+}
+
+// Quota of a cgroup v1 cpu controller directory (cfs_quota_us is -1 when unlimited)
+static double quota_v1(const char* dir) {
+    char path[512];
+    long quota = -1, period = 0;
+    snprintf(path, sizeof(path), "%s/cpu.cfs_quota_us", dir);
+    FILE* f = fopen(path, "r");
+    if(!f) {
+        return 0;
+    }
+    if(fscanf(f, "%ld", &quota) != 1) quota = -1;
+    fclose(f);
+    snprintf(path, sizeof(path), "%s/cpu.cfs_period_us", dir);
+    f = fopen(path, "r");
+    if(!f) {
+        return 0;
+    }
+    if(fscanf(f, "%ld", &period) != 1) period = 0;
+    fclose(f);
+    return quota > 0 && period > 0 ? (double)quota / period : 0;
+}
+
+// Smallest quota of a cgroup and its ancestors below a mount point (0: none)
+static double cgroup_quota(const char* mount, const char* cgroup, bool v2) {
+    char path[512];
+    double quota = 0;
+    size_t length = strlen(cgroup);
+    while(length > 0 && cgroup[length - 1] == '/') length--;
+    for(;;) {
+        snprintf(path, sizeof(path), "%s%.*s", mount, (int)length, cgroup);
+        double q = v2 ? quota_v2(path) : quota_v1(path);
+        if(q > 0 && (quota == 0 || q < quota)) quota = q;
+        if(length == 0) break;
+        while(length > 0 && cgroup[length - 1] != '/') length--;
+        while(length > 0 && cgroup[length - 1] == '/') length--;
+    }
+    return quota;
+}
+
+// CPU quota of the process from /proc/self/cgroup: the cpu controller of cgroup
+// v1, or the unified hierarchy of cgroup v2 (pure or hybrid mount)
+static double detect_quota(void) {
+    static const char* v1_mounts[] = {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct", "/sys/fs/cgroup/cpuacct,cpu"};
+    static const char* v2_mounts[] = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+    FILE* f = fopen("/proc/self/cgroup", "r");
+    if(!f) {
+        return 0;
+    }
+    double quota = 0;
+    char line[1024];
+    while(fgets(line, sizeof(line), f)) {
+        // "<id>:<controllers>:<path>"
+        char* controllers = strchr(line, ':');
+        char* cgroup = controllers ? strchr(controllers + 1, ':') : NULL;
+        if(!cgroup) continue;
+        *controllers++ = '\0';
+        *cgroup++ = '\0';
+        cgroup[strcspn(cgroup, "\n")] = '\0';
+
+        double q = 0;
+        if(strcmp(line, "0") == 0 && controllers[0] == '\0') {
+            for(size_t m = 0; m < sizeof(v2_mounts) / sizeof(v2_mounts[0]) && q == 0; m++) {
+                q = cgroup_quota(v2_mounts[m], cgroup, true);
+            }
+        } else {
+            bool cpu = false;
+            for(char* c = strtok(controllers, ","); c; c = strtok(NULL, ",")) {
+                cpu = cpu || strcmp(c, "cpu") == 0;
+            }
+            for(size_t m = 0; cpu && m < sizeof(v1_mounts) / sizeof(v1_mounts[0]) && q == 0; m++) {
+                q = cgroup_quota(v1_mounts[m], cgroup, false);
+            }
+        }
+        if(q > 0 && (quota == 0 || q < quota)) quota = q;
+    }
+    fclose(f);
+    return quota;
+}
+#endif
+
+static void detect_budget(void) {
+    MfkeyCpuBudget* b = &cpu_budget;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    b->online = online > 0 ? (int)online : 1;
+    b->affinity = b->online;
+#if defined(__linux__)
+    cpu_set_t set;
+    if(sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        b->affinity = CPU_COUNT(&set);
+    }
+    b->quota = detect_quota();
+#endif
+    b->usable = b->affinity;
+    if(b->quota > 0) {
+        int quota = (int)b->quota;
+        if(quota < b->quota) quota++;
+        if(quota < b->usable) b->usable = quota;
+    }
+    if(b->usable < 1) {
+        b->usable = 1;
+    }
+}
+
+const MfkeyCpuBudget* mfkey_cpu_budget(void) {
+    pthread_once(&cpu_budget_once, detect_budget);
+    return &cpu_budget;
+}
+
+int mfkey_cpu_affinity_list(int* cpus, int max) {
+    int count = 0;
+#if defined(__linux__)
+    cpu_set_t set;
+    if(sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for(int cpu = 0; cpu < CPU_SETSIZE && count < max; cpu++) {
+            if(CPU_ISSET(cpu, &set)) cpus[count++] = cpu;
+        }
+        return count;
+    }
+#endif
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    for(int cpu = 0; cpu < online && count < max; cpu++) {
+        cpus[count++] = cpu;
+    }
+    return count;
+}
+
+bool mfkey_cpu_pin_thread(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+void* mfkey_aligned_alloc(size_t alignment, size_t size) {
+#ifdef _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    void* memory;
+    return posix_memalign(&memory, alignment, size) == 0 ? memory : NULL;
+#endif
+}
+
+void mfkey_aligned_free(void* memory) {
+#ifdef _WIN32
+    _aligned_free(memory);
+#else
+    free(memory);
+#endif
+}
@@ -0,0 +1,59 @@
+#ifndef MFKEY_CPU_H
+#define MFKEY_CPU_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define MFKEY_CPU_X86 1
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define MFKEY_CPU_ARM64 1
+#endif
+
+// CPU features relevant to the kernel variants
+typedef struct {
+    bool sse42;
+    bool popcnt;
+    bool avx2;
+    bool bmi2;
+    bool avx512f;
+    bool avx512bw;
+    bool avx512vl;
+    bool neon;
+    bool sve;
+} MfkeyCpuFeatures;
+
+// Detect features of the running CPU (cached after the first call)
+const MfkeyCpuFeatures* mfkey_cpu_features(void);
+
+// Print detected features as a space separated list
+void mfkey_cpu_print_features(const MfkeyCpuFeatures* features);
+
+// CPUs the process may actually use. Thread counts derived from the online CPU
+// count over-subscribe containers and processes restricted with taskset.
+typedef struct {
+    int online;   // Online CPUs
+    int affinity; // CPUs in the affinity mask of the process
+    double quota; // CPUs granted by the cgroup v2 cpu.max or v1 CFS quota (0: unlimited)
+    int usable;   // Affinity CPUs, limited by the quota rounded up; at least 1
+} MfkeyCpuBudget;
+
+// Detect the CPU budget of the process (cached after the first call, thread-safe)
+const MfkeyCpuBudget* mfkey_cpu_budget(void);
+
+// CPUs of the affinity mask in ascending order. Fills up to max entries and
+// returns the count.
+int mfkey_cpu_affinity_list(int* cpus, int max);
+
+// Pin the calling thread to one CPU. Returns false if it cannot be pinned.
+bool mfkey_cpu_pin_thread(int cpu);
+
+// Memory aligned to alignment (a power of two) for the vector kernels, NULL on
+// failure. Released with mfkey_aligned_free(): Windows has no posix_memalign()
+// and its aligned blocks cannot go to free().
+void* mfkey_aligned_alloc(size_t alignment, size_t size);
+void mfkey_aligned_free(void* memory);
+
+#endif // MFKEY_CPU_H
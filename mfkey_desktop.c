@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,865 +6,424 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "pixel_ui.h"
+#include "mfkey.h"
+#include "mfkey_batch.h"
+#include "mfkey_trace.h"
+#include "mfkey_metrics.h"
+#include "mfkey_dict.h"
+#include "mfkey_dictattack.h"
+#include "mfkey_cpu.h"
+#include "mfkey_governor.h"
 
 // Version information
 #define MFKEY_VERSION "1.0"
 #define MFKEY_NAME "mfkey_desktop"
 
-// MIFARE Classic key size
-#define MF_CLASSIC_KEY_SIZE 6
-
-// Crypto1 constants
-#define LF_POLY_ODD  (0x29CE5C)
-#define LF_POLY_EVEN (0x870804)
-#define CONST_M1_1   (LF_POLY_EVEN << 1 | 1)
-#define CONST_M2_1   (LF_POLY_ODD << 1)
-#define CONST_M1_2   (LF_POLY_ODD)
-#define CONST_M2_2   (LF_POLY_EVEN << 1 | 1)
-#define BIT(x, n)    ((x) >> (n) & 1)
-#define BEBIT(x, n)  BIT(x, (n) ^ 24)
-#define SWAPENDIAN(x) \
-    ((x) = ((x) >> 8 & 0xff00ff) | ((x) & 0xff00ff) << 8, (x) = (x) >> 16 | (x) << 16)
-
-// MSB processing chunk size
-static int MSB_LIMIT = 16;
-
-// Structures
-struct Crypto1State {
-    uint32_t odd, even;
-};
-
-struct Msb {
-    int tail;
-    uint32_t states[768];
-};
-
-typedef struct {
-    uint8_t data[MF_CLASSIC_KEY_SIZE];
-} MfClassicKey;
-
-typedef enum {
-    mfkey32,
-    static_nested,
-    static_encrypted
-} AttackType;
-
-typedef struct {
-    AttackType attack;
-    MfClassicKey key;
-    uint32_t uid;
-    uint32_t nt0;
-    uint32_t nt1;
-    uint32_t uid_xor_nt0;
-    uint32_t uid_xor_nt1;
-    union {
-        // Mfkey32
-        struct {
-            uint32_t p64;
-            uint32_t p64b;
-            uint32_t nr0_enc;
-            uint32_t ar0_enc;
-            uint32_t nr1_enc;
-            uint32_t ar1_enc;
-        };
-        // Nested
-        struct {
-            uint32_t ks1_1_enc;
-            uint32_t ks1_2_enc;
-            char par_1_str[5];
-            char par_2_str[5];
-            uint8_t par_1;
-            uint8_t par_2;
-        };
-    };
-} MfClassicNonce;
-
-// Lookup tables for filter function
-static const uint8_t lookup1[256] = {
-    0, 0,  16, 16, 0,  16, 0,  0,  0, 16, 0,  0,  16, 16, 16, 16, 0, 0,  16, 16, 0,  16, 0,  0,
-    0, 16, 0,  0,  16, 16, 16, 16, 0, 0,  16, 16, 0,  16, 0,  0,  0, 16, 0,  0,  16, 16, 16, 16,
-    8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24, 8, 8,  24, 24, 8,  24, 8,  8,
-    8, 24, 8,  8,  24, 24, 24, 24, 8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24,
-    0, 0,  16, 16, 0,  16, 0,  0,  0, 16, 0,  0,  16, 16, 16, 16, 0, 0,  16, 16, 0,  16, 0,  0,
-    0, 16, 0,  0,  16, 16, 16, 16, 8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24,
-    0, 0,  16, 16, 0,  16, 0,  0,  0, 16, 0,  0,  16, 16, 16, 16, 0, 0,  16, 16, 0,  16, 0,  0,
-    0, 16, 0,  0,  16, 16, 16, 16, 8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24,
-    8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24, 0, 0,  16, 16, 0,  16, 0,  0,
-    0, 16, 0,  0,  16, 16, 16, 16, 8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24,
-    8, 8,  24, 24, 8,  24, 8,  8,  8, 24, 8,  8,  24, 24, 24, 24};
-
-static const uint8_t lookup2[256] = {
-    0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4,
-    4, 4, 4, 2, 2, 6, 6, 2, 6, 2, 2, 2, 6, 2, 2, 6, 6, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2, 2, 6,
-    2, 2, 6, 6, 6, 6, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 2, 2, 6, 6, 2, 6, 2,
-    2, 2, 6, 2, 2, 6, 6, 6, 6, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 0, 0, 4, 4,
-    0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 2,
-    2, 6, 6, 2, 6, 2, 2, 2, 6, 2, 2, 6, 6, 6, 6, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4,
-    4, 4, 0, 0, 4, 4, 0, 4, 0, 0, 0, 4, 0, 0, 4, 4, 4, 4, 2, 2, 6, 6, 2, 6, 2, 2, 2, 6, 2,
-    2, 6, 6, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2, 2, 6, 2, 2, 6, 6, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2,
-    2, 6, 2, 2, 6, 6, 6, 6, 2, 2, 6, 6, 2, 6, 2, 2, 2, 6, 2, 2, 6, 6, 6, 6};
-
-// Global variables for tracking found keys
-static MfClassicKey* found_keys = NULL;
-static int found_key_count = 0;
-static bool stop_attack = false;
-
-// Global variables for tracking candidate keys (static_encrypted)
-static MfClassicKey* candidate_keys = NULL;
-static int candidate_key_count = 0;
+// Cancelled by Ctrl+C
+static MfkeyCancelToken cancel_token = {0};
 
 // Global progress tracking variables
-static int current_nonce = 0;
-static int total_nonces = 0;
-static int current_msb_round = 0;
-static int total_msb_rounds = 0;
 static int global_current_nonce = 0;
 static int global_total_nonces = 0;
 
+// Statistics
+static bool show_stats = false;
+
 // UI options
 static UIOptions ui_options = {false, true};
 
+// Dictionary output options
+typedef struct {
+    bool binary;              // Also write a sorted binary key file
+    bool shared_key_filter;   // Keep the candidates shared by key A and key B of a sector
+    int top_k;                // Candidates written per dictionary (0: all)
+    const char** merge_files; // Existing dictionaries merged into each output
+    int merge_count;
+    MfkeyDict merged;         // Their keys, loaded once before recovery, sorted
+} DictOptions;
+
+static DictOptions dict_options = {false, false, 0, NULL, 0, {NULL, 0, 0}};
+
+// Keys tried on every nonce before recovery (--dict)
+static MfkeyDictKeys attack_dict;
+
+// Worker limits, priority and pinning (--max-cpu-percent, --background, --no-pin)
+static MfkeyGovernor governor;
+
 // Function declarations
 void print_progress_bar(float percentage, int width);
 void print_simple_progress(int nonce_current, int nonce_total, int msb_current, int msb_total, float msb_progress, uint32_t current_uid);
 void signal_handler(int sig);
 void print_usage(const char* program_name);
 
-// Crypto1 functions
-static inline uint8_t evenparity32(uint32_t x) {
-    return __builtin_parity(x);
+static double seconds_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
 }
 
-static inline int filter(uint32_t const x) {
-    uint32_t f;
-    f = lookup1[x & 0xff] | lookup2[(x >> 8) & 0xff];
-    f |= 0x0d938 >> (x >> 16 & 0xf) & 1;
-    return BIT(0xEC57E80A, f);
-}
-
-static uint8_t get_nth_byte(uint32_t value, int n) {
-    if(n < 0 || n > 3) {
-        return 0;
-    }
-    return (value >> (8 * (3 - n))) & 0xFF;
+// Library callbacks
+static void on_found_key(void* user, const MfClassicNonce* nonce, const MfClassicKey* key) {
+    (void)user;
+    (void)nonce;
+    // Use pixel UI to show found key
+    pixel_ui_show_found_key(key->data, "");
 }
 
-static uint8_t nfc_util_even_parity8(uint8_t data) {
-    return __builtin_parity(data);
+// Called on the worker threads; the nonce counters are kept by the main thread
+static void on_recover_progress(void* user, const MfkeyProgress* progress) {
+    (void)user;
+    print_simple_progress(__atomic_load_n(&global_current_nonce, __ATOMIC_RELAXED),
+                          __atomic_load_n(&global_total_nonces, __ATOMIC_RELAXED), progress->msb_round,
+                          progress->msb_rounds, progress->round_progress, progress->nonce->uid);
 }
 
-static uint8_t crypt_bit(struct Crypto1State* s, uint8_t in, int is_encrypted) {
-    uint32_t feedin, t;
-    uint8_t ret = filter(s->odd);
-    feedin = ret & !!is_encrypted;
-    feedin ^= !!in;
-    feedin ^= LF_POLY_ODD & s->odd;
-    feedin ^= LF_POLY_EVEN & s->even;
-    s->even = s->even << 1 | evenparity32(feedin);
-    t = s->odd, s->odd = s->even, s->even = t;
-    return ret;
+// Attack of a nonce as shown to the user, with the PRNG distance of dist > 0 candidates
+static void nonce_label(char* label, size_t size, const MfClassicNonce* n) {
+    if(n->attack == mfkey32 && n->has_at0) {
+        snprintf(label, size, "%s (at0)", mfkey_attack_name(n->attack));
+    } else if(n->attack == hardnested) {
+        snprintf(label, size, "%s (%u nonces)", mfkey_attack_name(n->attack), n->hard_total);
+    } else if(n->dist > 0) {
+        snprintf(label, size, "%s (dist %d%+d)", mfkey_attack_name(n->attack), n->dist, n->dist_error);
+    } else {
+        snprintf(label, size, "%s", mfkey_attack_name(n->attack));
+    }
 }
 
-static inline uint32_t crypt_word_par(
-    struct Crypto1State* s,
-    uint32_t in,
-    int is_encrypted,
-    uint32_t nt_plain,
-    uint8_t* parity_keystream_bits) {
-    uint32_t ret = 0;
-    *parity_keystream_bits = 0;
-
-    for(int i = 0; i < 32; i++) {
-        uint8_t bit = crypt_bit(s, BEBIT(in, i), is_encrypted);
-        ret |= bit << (24 ^ i);
-        // Save keystream parity bit
-        if((i + 1) % 8 == 0) {
-            *parity_keystream_bits |=
-                (filter(s->odd) ^ nfc_util_even_parity8(get_nth_byte(nt_plain, i / 8)))
-                << (3 - (i / 8));
-        }
-    }
-    return ret;
+static void on_nonce_loaded(void* user, int count, const MfClassicNonce* nonce) {
+    (void)user;
+    char label[48];
+    nonce_label(label, sizeof(label), nonce);
+    pixel_ui_show_nonce_loaded(count, nonce->uid, label);
 }
 
-static inline void update_contribution(unsigned int data[], int item, int mask1, int mask2) {
-    int p = data[item] >> 25;
-    p = p << 1 | evenparity32(data[item] & mask1);
-    p = p << 1 | evenparity32(data[item] & mask2);
-    data[item] = p << 24 | (data[item] & 0xffffff);
+static void on_cache_built(void* user, uint32_t prefix, uint32_t total) {
+    (void)user;
+    printf("\rBuilding odd-half cache: %u/%u", prefix + 1, total);
+    fflush(stdout);
 }
 
-static inline uint32_t crypt_word(struct Crypto1State* s) {
-    uint32_t res_ret = 0;
-    uint32_t feedin, t;
-    for(int i = 0; i <= 31; i++) {
-        res_ret |= (filter(s->odd) << (24 ^ i));
-        feedin = LF_POLY_EVEN & s->even;
-        feedin ^= LF_POLY_ODD & s->odd;
-        s->even = s->even << 1 | (evenparity32(feedin));
-        t = s->odd, s->odd = s->even, s->even = t;
-    }
-    return res_ret;
+// Usable CPUs and the workers the governor starts on them
+static void print_cpu_budget(void) {
+    const MfkeyCpuBudget* budget = &governor.budget;
+    printf("Usable CPUs: %d (%d online, %d in the affinity mask", budget->usable, budget->online, budget->affinity);
+    if(budget->quota > 0) printf(", cgroup quota %.2f", budget->quota);
+    printf(")\nWorkers: %d (%d%% of the usable CPUs%s%s)\n", governor.workers, governor.max_cpu_percent,
+           governor.background ? ", background" : "", governor.pin ? ", pinned" : "");
 }
 
-static inline void crypt_word_noret(struct Crypto1State* s, uint32_t in, int x) {
-    uint8_t ret;
-    uint32_t feedin, t, next_in;
-    for(int i = 0; i <= 31; i++) {
-        next_in = BEBIT(in, i);
-        ret = filter(s->odd);
-        feedin = ret & (!!x);
-        feedin ^= LF_POLY_EVEN & s->even;
-        feedin ^= LF_POLY_ODD & s->odd;
-        feedin ^= !!next_in;
-        s->even = s->even << 1 | (evenparity32(feedin));
-        t = s->odd, s->odd = s->even, s->even = t;
+void print_cpu_features(const MfkeyContext* ctx) {
+    printf("CPU features: ");
+    mfkey_cpu_print_features(mfkey_cpu_features());
+    printf("Kernel variants:\n");
+    for(int i = 0; i < mfkey_kernel_variant_count(); i++) {
+        const char* name = mfkey_kernel_variant_name(i);
+        printf("  %-9s %s%s\n",
+               name,
+               mfkey_kernel_variant_supported(i) ? "supported" : "unsupported",
+               strcmp(name, mfkey_context_kernel(ctx)) == 0 ? " (selected)" : "");
     }
+    print_cpu_budget();
 }
 
-static inline uint32_t crypt_word_ret(struct Crypto1State* s, uint32_t in, int x) {
-    uint32_t ret = 0;
-    uint32_t feedin, t, next_in;
-    uint8_t next_ret;
-    for(int i = 0; i <= 31; i++) {
-        next_in = BEBIT(in, i);
-        next_ret = filter(s->odd);
-        feedin = next_ret & (!!x);
-        feedin ^= LF_POLY_EVEN & s->even;
-        feedin ^= LF_POLY_ODD & s->odd;
-        feedin ^= !!next_in;
-        s->even = s->even << 1 | (evenparity32(feedin));
-        t = s->odd, s->odd = s->even, s->even = t;
-        ret |= next_ret << (24 ^ i);
+// Precompute the odd-half cache for every keystream prefix not cached yet
+int build_odd_cache(MfkeyContext* ctx, const char* cache_dir) {
+    MfkeyScratch* scratch = mfkey_scratch_new();
+    if(!scratch) {
+        printf("Memory allocation failed!\n");
+        return 1;
     }
-    return ret;
+    int built = mfkey_build_cache(ctx, scratch, cache_dir, on_cache_built, NULL);
+    mfkey_scratch_free(scratch);
+    if(built < 0) {
+        printf("\n");
+        return 1;
+    }
+    printf("\n%d cache entries built in %s\n", built, cache_dir);
+    return 0;
 }
 
-static inline void rollback_word_noret(struct Crypto1State* s, uint32_t in, int x) {
-    uint8_t ret;
-    uint32_t feedin, t, next_in;
-    for(int i = 31; i >= 0; i--) {
-        next_in = BEBIT(in, i);
-        s->odd &= 0xffffff;
-        t = s->odd, s->odd = s->even, s->even = t;
-        ret = filter(s->odd);
-        feedin = ret & (!!x);
-        feedin ^= s->even & 1;
-        feedin ^= LF_POLY_EVEN & (s->even >>= 1);
-        feedin ^= LF_POLY_ODD & s->odd;
-        feedin ^= !!next_in;
-        s->even |= (evenparity32(feedin)) << 23;
+void save_keys_to_file(const char* filename, const MfClassicKey* found_keys, int found_key_count) {
+    if(found_key_count == 0) {
+        return;
     }
+    
+    // Pixel UI will show saved files info at the end
+    uint64_t trace_start = mfkey_trace_begin();
+    mfkey_dict_write_nfc_keys(filename, (const uint8_t(*)[6])found_keys, found_key_count);
+    mfkey_trace_end(trace_start, "write keys", "keys", found_key_count);
 }
 
-uint8_t napi_lfsr_rollback_bit(struct Crypto1State* s, uint32_t in, int fb) {
-    int out;
-    uint8_t ret;
-    uint32_t t;
-    s->odd &= 0xffffff;
-    t = s->odd, s->odd = s->even, s->even = t;
-
-    out = s->even & 1;
-    out ^= LF_POLY_EVEN & (s->even >>= 1);
-    out ^= LF_POLY_ODD & s->odd;
-    out ^= !!in;
-    out ^= (ret = filter(s->odd)) & !!fb;
-
-    s->even |= evenparity32(out) << 23;
-    return ret;
+// Build the per-UID dictionary path with the given extension
+static void build_dict_path(char* path, size_t size, const char* output_dir, uint32_t uid, const char* ext) {
+    if(output_dir) {
+        snprintf(path, size, "%s/mf_classic_dict_%08x.%s", output_dir, uid, ext);
+    } else {
+        snprintf(path, size, "mf_classic_dict_%08x.%s", uid, ext);
+    }
 }
 
-uint32_t napi_lfsr_rollback_word(struct Crypto1State* s, uint32_t in, int fb) {
-    int i;
-    uint32_t ret = 0;
-    for(i = 31; i >= 0; --i)
-        ret |= napi_lfsr_rollback_bit(s, BEBIT(in, i), fb) << (i ^ 24);
-    return ret;
+static int compare_packed_keys(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
 }
 
-void crypto1_get_lfsr(struct Crypto1State* state, MfClassicKey* lfsr) {
-    int i;
-    uint64_t lfsr_value = 0;
-    for(i = 23; i >= 0; --i) {
-        lfsr_value = lfsr_value << 1 | BIT(state->odd, i ^ 3);
-        lfsr_value = lfsr_value << 1 | BIT(state->even, i ^ 3);
-    }
-
-    for(i = 0; i < 6; ++i) {
-        lfsr->data[i] = (lfsr_value >> ((5 - i) * 8)) & 0xFF;
-    }
-}
-
-// Add candidate key to the list (for static_encrypted)
-void add_candidate_key(MfClassicKey* key) {
-    // Check if key already exists in candidates
-    for(int i = 0; i < candidate_key_count; i++) {
-        if(memcmp(candidate_keys[i].data, key->data, MF_CLASSIC_KEY_SIZE) == 0) {
-            return; // Already found
-        }
+// Write ranked candidates to a .nfc dictionary, in their order. Keys of merged
+// dictionaries follow in ascending order; the binary key file is sorted.
+// Returns the number of keys written, or -1 on failure.
+int save_candidate_keys_to_dict(
+    const char* dict_filename,
+    const char* bin_filename,
+    const MfClassicKey* candidate_keys,
+    int candidate_key_count) {
+    if(candidate_key_count == 0) {
+        return 0;
     }
     
-    candidate_keys = realloc(candidate_keys, sizeof(MfClassicKey) * (candidate_key_count + 1));
-    candidate_keys[candidate_key_count] = *key;
-    candidate_key_count++;
-}
-
-// Add found key to the list
-void add_found_key(MfClassicKey* key) {
-    // Check if key already exists
-    for(int i = 0; i < found_key_count; i++) {
-        if(memcmp(found_keys[i].data, key->data, MF_CLASSIC_KEY_SIZE) == 0) {
-            return; // Already found
+    // Pixel UI will show saved files info at the end
+    uint64_t trace_start = mfkey_trace_begin();
+    
+    if(dict_options.merge_count == 0 && !bin_filename) {
+        if(!mfkey_dict_write_nfc_keys(dict_filename, (const uint8_t(*)[6])candidate_keys, candidate_key_count)) {
+            return -1;
         }
+        mfkey_trace_end(trace_start, "write dictionary", "keys", candidate_key_count);
+        return candidate_key_count;
     }
     
-    found_keys = realloc(found_keys, sizeof(MfClassicKey) * (found_key_count + 1));
-    found_keys[found_key_count] = *key;
-    found_key_count++;
-    
-    // Use pixel UI to show found key
-    pixel_ui_show_found_key(key->data, "");
-}
-
-static inline int check_state(struct Crypto1State* t, MfClassicNonce* n) {
-    if(!(t->odd | t->even)) return 0;
+    const MfkeyDict* merged = &dict_options.merged;
+    MfkeyDict ranked, sorted;
+    mfkey_dict_init(&ranked);
+    mfkey_dict_init(&sorted);
+    if(!mfkey_dict_append_array(&ranked, (const uint8_t(*)[6])candidate_keys, candidate_key_count) ||
+       !mfkey_dict_append_array(&sorted, (const uint8_t(*)[6])candidate_keys, candidate_key_count)) {
+        mfkey_dict_free(&ranked);
+        mfkey_dict_free(&sorted);
+        return -1;
+    }
+    mfkey_dict_sort_unique(&sorted);
     
-    if(n->attack == mfkey32) {
-        uint32_t rb = (napi_lfsr_rollback_word(t, 0, 0) ^ n->p64);
-        if(rb != n->ar0_enc) {
-            return 0;
-        }
-        rollback_word_noret(t, n->nr0_enc, 1);
-        rollback_word_noret(t, n->uid_xor_nt0, 0);
-        struct Crypto1State temp = {t->odd, t->even};
-        crypt_word_noret(t, n->uid_xor_nt1, 0);
-        crypt_word_noret(t, n->nr1_enc, 1);
-        if(n->ar1_enc == (crypt_word(t) ^ n->p64b)) {
-            crypto1_get_lfsr(&temp, &(n->key));
-            add_found_key(&(n->key));
-            return 1;
-        }
-    } else if(n->attack == static_nested) {
-        struct Crypto1State temp = {t->odd, t->even};
-        rollback_word_noret(t, n->uid_xor_nt1, 0);
-        if(n->ks1_1_enc == crypt_word_ret(t, n->uid_xor_nt0, 0)) {
-            rollback_word_noret(&temp, n->uid_xor_nt1, 0);
-            crypto1_get_lfsr(&temp, &(n->key));
-            add_found_key(&(n->key));
-            return 1;
-        }
-    } else if(n->attack == static_encrypted) {
-        if(n->ks1_1_enc == napi_lfsr_rollback_word(t, n->uid_xor_nt0, 0)) {
-            // Reduce with parity check
-            uint8_t local_parity_keystream_bits;
-            struct Crypto1State temp = {t->odd, t->even};
-            if((crypt_word_par(&temp, n->uid_xor_nt0, 0, n->nt0, &local_parity_keystream_bits) ==
-                n->ks1_1_enc) &&
-               (local_parity_keystream_bits == n->par_1)) {
-                // Found key candidate - add to candidates list
-                crypto1_get_lfsr(t, &(n->key));
-                add_candidate_key(&(n->key));
-            }
+    bool ok = true;
+    for(size_t i = 0; i < merged->count && ok; i++) {
+        if(!bsearch(&merged->keys[i], sorted.keys, sorted.count, sizeof(uint64_t), compare_packed_keys)) {
+            uint8_t key[6];
+            mfkey_dict_unpack(merged->keys[i], key);
+            ok = mfkey_dict_append(&ranked, key);
         }
     }
-    return 0;
+    
+    ok = ok && mfkey_dict_write_nfc(dict_filename, &ranked);
+    if(ok && bin_filename) {
+        ok = mfkey_dict_merge(&sorted, merged) && mfkey_dict_write_bin(bin_filename, &sorted);
+    }
+    int written = (int)ranked.count;
+    mfkey_dict_free(&ranked);
+    mfkey_dict_free(&sorted);
+    mfkey_trace_end(trace_start, "write dictionary", "keys", written);
+    return ok ? written : -1;
 }
 
-static inline int state_loop(
-    unsigned int* states_buffer,
-    int xks,
-    int m1,
-    int m2,
-    unsigned int in,
-    uint8_t and_val) {
-    int states_tail = 0;
-    int round = 0, s = 0, xks_bit = 0, round_in = 0;
-
-    for(round = 1; round <= 12; round++) {
-        xks_bit = BIT(xks, round);
-        if(round > 4) {
-            round_in = ((in >> (2 * (round - 4))) & and_val) << 24;
-        }
+// Keys listed with their nonces in a ranking report
+#define RANK_REPORT_KEYS 32
 
-        for(s = 0; s <= states_tail; s++) {
-            states_buffer[s] <<= 1;
-
-            if((filter(states_buffer[s]) ^ filter(states_buffer[s] | 1)) != 0) {
-                states_buffer[s] |= filter(states_buffer[s]) ^ xks_bit;
-                if(round > 4) {
-                    update_contribution(states_buffer, s, m1, m2);
-                    states_buffer[s] ^= round_in;
-                }
-            } else if(filter(states_buffer[s]) == xks_bit) {
-                if(round > 4) {
-                    states_buffer[++states_tail] = states_buffer[s + 1];
-                    states_buffer[s + 1] = states_buffer[s] | 1;
-                    update_contribution(states_buffer, s, m1, m2);
-                    states_buffer[s++] ^= round_in;
-                    update_contribution(states_buffer, s, m1, m2);
-                    states_buffer[s] ^= round_in;
-                } else {
-                    states_buffer[++states_tail] = states_buffer[++s];
-                    states_buffer[s] = states_buffer[s - 1] | 1;
-                }
-            } else {
-                states_buffer[s--] = states_buffer[states_tail--];
-            }
-        }
+// Shared-key filter outcome of a sector, for the rank report and the summary
+static void describe_shared_key_sector(const MfkeySharedKeySector* sector, char* text, size_t size) {
+    if(sector->applied) {
+        snprintf(text, size, "applied, %d of %d key A / %d key B candidates kept", sector->shared_count,
+                 sector->a_count, sector->b_count);
+    } else if(sector->a_count == 0 || sector->b_count == 0) {
+        snprintf(text, size, "not applied, no key %c candidates", sector->a_count == 0 ? 'A' : 'B');
+    } else {
+        snprintf(text, size, "not applied, key A and key B share no candidate (distinct keys)");
     }
-
-    return states_tail;
 }
 
-int binsearch(unsigned int data[], int start, int stop) {
-    int mid, val = data[stop] & 0xff000000;
-    while(start != stop) {
-        mid = (stop - start) >> 1;
-        if((data[start + mid] ^ 0x80000000) > (val ^ 0x80000000))
-            stop = start + mid;
-        else
-            start += mid + 1;
+// Write the sidecar report of a ranked dictionary: keys per support level with
+// their ranks (the mean rank is the expected number of online tries if the key
+// has that support), then the best keys with the nonces that produced them
+static bool save_rank_report(
+    const char* filename,
+    uint32_t uid,
+    const MfkeyBatch* batch,
+    const MfkeyBatchCandidates* candidates,
+    int written) {
+    FILE* f = fopen(filename, "w");
+    if(!f) {
+        return false;
     }
-    return start;
-}
-
-void quicksort(unsigned int array[], int low, int high) {
-    if(low >= high) return;
-    int middle = low + (high - low) / 2;
-    unsigned int pivot = array[middle];
-    int i = low, j = high;
-    while(i <= j) {
-        while(array[i] < pivot) {
-            i++;
-        }
-        while(array[j] > pivot) {
-            j--;
-        }
-        if(i <= j) {
-            int temp = array[i];
-            array[i] = array[j];
-            array[j] = temp;
-            i++;
-            j--;
+    int nonce_count = 0;
+    char* seen = calloc(batch->job_count + 1, 1);
+    if(seen) {
+        for(int i = 0; i < candidates->nonce_start[candidates->count]; i++) {
+            if(!seen[candidates->nonces[i]]) {
+                seen[candidates->nonces[i]] = 1;
+                nonce_count++;
+            }
         }
+        free(seen);
     }
-    if(low < j) {
-        quicksort(array, low, j);
+    fprintf(f, "# UID %08X: %d candidates from %d nonces, %d written\n", uid, candidates->count, nonce_count, written);
+    for(int i = 0; i < candidates->sector_count; i++) {
+        char text[128];
+        describe_shared_key_sector(&candidates->sectors[i], text, sizeof(text));
+        fprintf(f, "# sector %d shared-key filter: %s\n", candidates->sectors[i].sector, text);
     }
-    if(high > i) {
-        quicksort(array, i, high);
+    fprintf(f, "# support keys first_rank last_rank mean_rank\n");
+    for(int i = 0; i < candidates->count;) {
+        int j = i;
+        while(j < candidates->count && candidates->support[j] == candidates->support[i]) j++;
+        fprintf(f, "%d %d %d %d %.1f\n", candidates->support[i], j - i, i + 1, j, (i + 1 + j) / 2.0);
+        i = j;
     }
-}
-
-int extend_table(unsigned int data[], int tbl, int end, int bit, int m1, int m2, unsigned int in) {
-    in <<= 24;
-    for(data[tbl] <<= 1; tbl <= end; data[++tbl] <<= 1) {
-        if((filter(data[tbl]) ^ filter(data[tbl] | 1)) != 0) {
-            data[tbl] |= filter(data[tbl]) ^ bit;
-            update_contribution(data, tbl, m1, m2);
-            data[tbl] ^= in;
-        } else if(filter(data[tbl]) == bit) {
-            data[++end] = data[tbl + 1];
-            data[tbl + 1] = data[tbl] | 1;
-            update_contribution(data, tbl, m1, m2);
-            data[tbl++] ^= in;
-            update_contribution(data, tbl, m1, m2);
-            data[tbl] ^= in;
-        } else {
-            data[tbl--] = data[end--];
+    fprintf(f, "# rank key support nonces (sector and key type)\n");
+    for(int i = 0; i < candidates->count && i < RANK_REPORT_KEYS; i++) {
+        const uint8_t* key = candidates->keys[i].data;
+        fprintf(f, "%d %02X%02X%02X%02X%02X%02X %d", i + 1, key[0], key[1], key[2], key[3], key[4], key[5],
+                candidates->support[i]);
+        for(int k = candidates->nonce_start[i]; k < candidates->nonce_start[i + 1]; k++) {
+            const MfClassicNonce* nonce = &batch->jobs[candidates->nonces[k]].nonce;
+            fprintf(f, " %d%c", nonce->sector, nonce->key_type);
         }
+        fprintf(f, "\n");
     }
-    return end;
+    return fclose(f) == 0;
 }
 
-int old_recover(
-    unsigned int odd[],
-    int o_head,
-    int o_tail,
-    int oks,
-    unsigned int even[],
-    int e_head,
-    int e_tail,
-    int eks,
-    int rem,
-    int s,
-    MfClassicNonce* n,
-    unsigned int in,
-    int first_run) {
-    int o, e, i;
-    if(rem == -1) {
-        for(e = e_head; e <= e_tail; ++e) {
-            even[e] = (even[e] << 1) ^ evenparity32(even[e] & LF_POLY_EVEN) ^ (!!(in & 4));
-            for(o = o_head; o <= o_tail; ++o, ++s) {
-                struct Crypto1State temp = {0, 0};
-                temp.even = odd[o];
-                temp.odd = even[e] ^ evenparity32(odd[o] & LF_POLY_ODD);
-                if(check_state(&temp, n)) {
-                    return -1;
-                }
-            }
-        }
-        return s;
-    }
-    if(first_run == 0) {
-        for(i = 0; (i < 4) && (rem-- != 0); i++) {
-            oks >>= 1;
-            eks >>= 1;
-            in >>= 2;
-            o_tail = extend_table(
-                odd, o_head, o_tail, oks & 1, LF_POLY_EVEN << 1 | 1, LF_POLY_ODD << 1, 0);
-            if(o_head > o_tail) return s;
-            e_tail = extend_table(
-                even, e_head, e_tail, eks & 1, LF_POLY_ODD, LF_POLY_EVEN << 1 | 1, in & 3);
-            if(e_head > e_tail) return s;
-        }
+// Write the dictionary, binary key file and ranking report of a UID's candidates.
+// Returns the number of keys written, or -1 on failure.
+static int save_candidates(const char* dir, uint32_t uid, const MfkeyBatch* batch, const MfkeyBatchCandidates* candidates) {
+    char dict_filename[256];
+    char bin_filename[256];
+    char report_filename[256];
+    build_dict_path(dict_filename, sizeof(dict_filename), dir, uid, "nfc");
+    build_dict_path(bin_filename, sizeof(bin_filename), dir, uid, MFKEY_DICT_BIN_EXT);
+    build_dict_path(report_filename, sizeof(report_filename), dir, uid, "rank.txt");
+    int count = candidates->count;
+    if(dict_options.top_k > 0 && count > dict_options.top_k) {
+        count = dict_options.top_k;
     }
-    first_run = 0;
-    quicksort(odd, o_head, o_tail);
-    quicksort(even, e_head, e_tail);
-    while(o_tail >= o_head && e_tail >= e_head) {
-        if(((odd[o_tail] ^ even[e_tail]) >> 24) == 0) {
-            o_tail = binsearch(odd, o_head, o = o_tail);
-            e_tail = binsearch(even, e_head, e = e_tail);
-            s = old_recover(
-                odd,
-                o_tail--,
-                o,
-                oks,
-                even,
-                e_tail--,
-                e,
-                eks,
-                rem,
-                s,
-                n,
-                in,
-                first_run);
-            if(s == -1) {
-                break;
-            }
-        } else if((odd[o_tail] ^ 0x80000000) > (even[e_tail] ^ 0x80000000)) {
-            o_tail = binsearch(odd, o_head, o_tail) - 1;
-        } else {
-            e_tail = binsearch(even, e_head, e_tail) - 1;
-        }
+    int written = save_candidate_keys_to_dict(
+        dict_filename, dict_options.binary ? bin_filename : NULL, candidates->keys, count);
+    if(written > 0 && !save_rank_report(report_filename, uid, batch, candidates, count)) {
+        printf("Failed to write %s\n", report_filename);
     }
-    return s;
+    return written;
 }
 
-int calculate_msb_tables(
-    int oks,
-    int eks,
-    int msb_round,
-    MfClassicNonce* n,
-    unsigned int* states_buffer,
-    struct Msb* odd_msbs,
-    struct Msb* even_msbs,
-    unsigned int* temp_states_odd,
-    unsigned int* temp_states_even,
-    unsigned int in,
-    uint32_t uid) {
+// Standalone merge mode: combine dictionaries into one sorted, deduplicated .nfc file
+int merge_dictionaries(const char* output, char* inputs[], int input_count) {
+    MfkeyDict merged;
+    mfkey_dict_init(&merged);
     
-    unsigned int msb_head = (MSB_LIMIT * msb_round);
-    unsigned int msb_tail = (MSB_LIMIT * (msb_round + 1));
-    int states_tail = 0, tail = 0;
-    int i = 0, j = 0, semi_state = 0, found = 0;
-    unsigned int msb = 0;
-    in = ((in >> 16 & 0xff) | (in << 16) | (in & 0xff00)) << 1;
-    
-    memset(odd_msbs, 0, MSB_LIMIT * sizeof(struct Msb));
-    memset(even_msbs, 0, MSB_LIMIT * sizeof(struct Msb));
-
-    for(semi_state = 1 << 20; semi_state >= 0; semi_state--) {
-        if(stop_attack) return 0;
-        
-        if(semi_state % 65536 == 0) {
-            // Calculate progress percentage
-            float progress = (float)(1048576 - semi_state) / 1048576.0 * 100.0;
-            print_simple_progress(global_current_nonce, global_total_nonces, current_msb_round, total_msb_rounds, progress, uid);
-        }
-
-        if(filter(semi_state) == (oks & 1)) {
-            states_buffer[0] = semi_state;
-            states_tail = state_loop(states_buffer, oks, CONST_M1_1, CONST_M2_1, 0, 0);
-
-            for(i = states_tail; i >= 0; i--) {
-                msb = states_buffer[i] >> 24;
-                if((msb >= msb_head) && (msb < msb_tail)) {
-                    found = 0;
-                    for(j = 0; j < odd_msbs[msb - msb_head].tail - 1; j++) {
-                        if(odd_msbs[msb - msb_head].states[j] == states_buffer[i]) {
-                            found = 1;
-                            break;
-                        }
-                    }
-
-                    if(!found) {
-                        tail = odd_msbs[msb - msb_head].tail++;
-                        odd_msbs[msb - msb_head].states[tail] = states_buffer[i];
-                    }
-                }
-            }
-        }
-
-        if(filter(semi_state) == (eks & 1)) {
-            states_buffer[0] = semi_state;
-            states_tail = state_loop(states_buffer, eks, CONST_M1_2, CONST_M2_2, in, 3);
-
-            for(i = 0; i <= states_tail; i++) {
-                msb = states_buffer[i] >> 24;
-                if((msb >= msb_head) && (msb < msb_tail)) {
-                    found = 0;
-
-                    for(j = 0; j < even_msbs[msb - msb_head].tail; j++) {
-                        if(even_msbs[msb - msb_head].states[j] == states_buffer[i]) {
-                            found = 1;
-                            break;
-                        }
-                    }
-
-                    if(!found) {
-                        tail = even_msbs[msb - msb_head].tail++;
-                        even_msbs[msb - msb_head].states[tail] = states_buffer[i];
-                    }
-                }
-            }
+    for(int i = 0; i < input_count; i++) {
+        MfkeyDict dict;
+        mfkey_dict_init(&dict);
+        if(!mfkey_dict_load(inputs[i], &dict)) {
+            mfkey_dict_free(&dict);
+            mfkey_dict_free(&merged);
+            return 1;
         }
-    }
-
-    oks >>= 12;
-    eks >>= 12;
-
-    for(i = 0; i < MSB_LIMIT; i++) {
-        if(stop_attack) return 0;
-        
-        memset(temp_states_even, 0, sizeof(unsigned int) * (1280));
-        memset(temp_states_odd, 0, sizeof(unsigned int) * (1280));
-        memcpy(temp_states_odd, odd_msbs[i].states, odd_msbs[i].tail * sizeof(unsigned int));
-        memcpy(temp_states_even, even_msbs[i].states, even_msbs[i].tail * sizeof(unsigned int));
-        
-        int res = old_recover(
-            temp_states_odd,
-            0,
-            odd_msbs[i].tail,
-            oks,
-            temp_states_even,
-            0,
-            even_msbs[i].tail,
-            eks,
-            3,
-            0,
-            n,
-            in >> 16,
-            1);
-        if(res == -1) {
+        mfkey_dict_sort_unique(&dict);
+        printf("%s: %zu unique keys\n", inputs[i], dict.count);
+        bool merged_ok = mfkey_dict_merge(&merged, &dict);
+        mfkey_dict_free(&dict);
+        if(!merged_ok) {
+            printf("Memory allocation failed!\n");
+            mfkey_dict_free(&merged);
             return 1;
         }
     }
-
-    return 0;
-}
-
-bool recover(MfClassicNonce* n, int ks2, unsigned int in) {
-    bool found = false;
     
-    // Allocate memory blocks
-    struct Msb* odd_msbs = malloc(sizeof(struct Msb) * MSB_LIMIT * 2);
-    struct Msb* even_msbs = malloc(sizeof(struct Msb) * MSB_LIMIT * 2);
-    unsigned int* temp_states_odd = malloc(sizeof(unsigned int) * 1280);
-    unsigned int* temp_states_even = malloc(sizeof(unsigned int) * 1280);
-    unsigned int* states_buffer = malloc(sizeof(unsigned int) * 1024);
-    
-    if(!odd_msbs || !even_msbs || !temp_states_odd || !temp_states_even || !states_buffer) {
-        printf("Memory allocation failed!\n");
-        return false;
-    }
-    
-    int oks = 0, eks = 0;
-    int i = 0, msb = 0;
-    
-    for(i = 31; i >= 0; i -= 2) {
-        oks = oks << 1 | BEBIT(ks2, i);
+    bool ok = mfkey_dict_write_nfc(output, &merged);
+    if(ok && dict_options.binary) {
+        char bin_filename[256];
+        snprintf(bin_filename, sizeof(bin_filename), "%s.%s", output, MFKEY_DICT_BIN_EXT);
+        ok = mfkey_dict_write_bin(bin_filename, &merged);
     }
-    for(i = 30; i >= 0; i -= 2) {
-        eks = eks << 1 | BEBIT(ks2, i);
-    }
-    
-    total_msb_rounds = 256 / MSB_LIMIT;
-    
-    for(msb = 0; msb <= ((256 / MSB_LIMIT) - 1); msb++) {
-        current_msb_round = msb + 1;
-        
-        if(calculate_msb_tables(
-            oks,
-            eks, 
-            msb,
-            n,
-            states_buffer,
-            odd_msbs,
-            even_msbs,
-            temp_states_odd,
-            temp_states_even,
-            in,
-            n->uid)) {
-            found = true;
-            // Key found message will be printed by add_found_key function
-            break;
-        }
-        if(stop_attack) {
-            break;
-        }
-        
-        // Complete current MSB round
-        print_simple_progress(global_current_nonce, global_total_nonces, current_msb_round, total_msb_rounds, 100.0, n->uid);
-    }
-    
-    // Free allocated memory
-    free(odd_msbs);
-    free(even_msbs);
-    free(temp_states_odd);
-    free(temp_states_even);
-    free(states_buffer);
-    
-    return found;
-}
-
-int binaryStringToInt(const char* binStr) {
-    int result = 0;
-    while(*binStr) {
-        result <<= 1;
-        if(*binStr == '1') {
-            result |= 1;
-        }
-        binStr++;
+    if(ok) {
+        printf("Merged %d dictionaries into %s (%zu keys)\n", input_count, output, merged.count);
     }
-    return result;
+    mfkey_dict_free(&merged);
+    return ok ? 0 : 1;
 }
 
-bool load_nested_nonces(const char* filename, MfClassicNonce** nonces, int* nonce_count) {
-    FILE* file = fopen(filename, "r");
-    if(!file) {
-        printf("Failed to open file: %s\n", filename);
-        return false;
-    }
-    
-    char line[512];
-    int count = 0;
-    MfClassicNonce* nonce_array = NULL;
-    
-    // Loading message is now handled by pixel_ui_show_loading in main
-    
-    while(fgets(line, sizeof(line), file)) {
-        // Only process lines ending with "dist 0"
-        if(!strstr(line, "dist 0")) {
-            continue;
+// Load the --dict dictionaries into attack_dict. Returns false if one cannot be read.
+static bool load_attack_dict(const char** files, int file_count) {
+    MfkeyDict all;
+    mfkey_dict_init(&all);
+    for(int i = 0; i < file_count; i++) {
+        MfkeyDict dict;
+        mfkey_dict_init(&dict);
+        if(!mfkey_dict_load(files[i], &dict)) {
+            printf("Failed to load dictionary %s\n", files[i]);
+            mfkey_dict_free(&dict);
+            mfkey_dict_free(&all);
+            return false;
         }
-        
-        MfClassicNonce nonce = {0};
-        nonce.attack = static_encrypted;
-        
-        int parsed = sscanf(
-            line,
-            "Sec %*d key %*c cuid %" PRIx32 " nt0 %" PRIx32 " ks0 %" PRIx32
-            " par0 %4s nt1 %" PRIx32 " ks1 %" PRIx32 " par1 %4s",
-            &nonce.uid,
-            &nonce.nt0,
-            &nonce.ks1_1_enc,
-            nonce.par_1_str,
-            &nonce.nt1,
-            &nonce.ks1_2_enc,
-            nonce.par_2_str);
-        
-        if(parsed >= 4) { // At least one nonce is present
-            nonce.par_1 = binaryStringToInt(nonce.par_1_str);
-            nonce.uid_xor_nt0 = nonce.uid ^ nonce.nt0;
-            
-            if(parsed == 7) { // Both nonces are present  
-                nonce.attack = static_nested;
-                nonce.par_2 = binaryStringToInt(nonce.par_2_str);
-                nonce.uid_xor_nt1 = nonce.uid ^ nonce.nt1;
-            }
-            
-            nonce_array = realloc(nonce_array, sizeof(MfClassicNonce) * (count + 1));
-            nonce_array[count] = nonce;
-            count++;
-            
-            pixel_ui_show_nonce_loaded(count, nonce.uid, 
-                (nonce.attack == static_nested) ? "static_nested" : "static_encrypted");
+        mfkey_dict_sort_unique(&dict);
+        bool ok = mfkey_dict_merge(&all, &dict);
+        mfkey_dict_free(&dict);
+        if(!ok) {
+            printf("Memory allocation failed!\n");
+            mfkey_dict_free(&all);
+            return false;
         }
     }
-    
-    fclose(file);
-    
-    *nonces = nonce_array;
-    *nonce_count = count;
-    
-    pixel_ui_show_loading_complete(count);
-    return count > 0;
-}
-
-void save_keys_to_file(const char* filename) {
-    if(found_key_count == 0) {
-        return;
-    }
-    
-    FILE* file = fopen(filename, "w");
-    if(!file) {
-        printf("Failed to create output file: %s\n", filename);
-        return;
+    MfClassicKey* keys = malloc(sizeof(MfClassicKey) * (all.count + 1));
+    bool ok = keys != NULL;
+    for(size_t i = 0; ok && i < all.count; i++) {
+        mfkey_dict_unpack(all.keys[i], keys[i].data);
     }
-    
-    // Pixel UI will show saved files info at the end
-    
-    for(int i = 0; i < found_key_count; i++) {
-        for(int j = 0; j < MF_CLASSIC_KEY_SIZE; j++) {
-            fprintf(file, "%02X", found_keys[i].data[j]);
-        }
-        fprintf(file, "\n");
+    ok = ok && mfkey_dictattack_load(&attack_dict, keys, all.count);
+    free(keys);
+    mfkey_dict_free(&all);
+    if(!ok) {
+        printf("Memory allocation failed!\n");
+        return false;
     }
-    
-    fclose(file);
+    printf("Dictionary: %zu keys from %d files\n", attack_dict.count, file_count);
+    return true;
 }
 
-void save_candidate_keys_to_dict(uint32_t uid, const char* output_dir) {
-    if(candidate_key_count == 0) {
-        return;
-    }
-    
-    char dict_filename[256];
-    if(output_dir) {
-        snprintf(dict_filename, sizeof(dict_filename), "%s/mf_classic_dict_%08x.nfc", output_dir, uid);
-    } else {
-        snprintf(dict_filename, sizeof(dict_filename), "mf_classic_dict_%08x.nfc", uid);
-    }
-    
-    FILE* file = fopen(dict_filename, "w");
-    if(!file) {
-        printf("Failed to create dictionary file: %s\n", dict_filename);
-        return;
-    }
-    
-    // Pixel UI will show saved files info at the end
-    
-    for(int i = 0; i < candidate_key_count; i++) {
-        for(int j = 0; j < MF_CLASSIC_KEY_SIZE; j++) {
-            fprintf(file, "%02X", candidate_keys[i].data[j]);
+// Load the --merge-dict dictionaries into dict_options.merged. Returns false if
+// one cannot be read, before any recovery runs.
+static bool load_merge_dict(void) {
+    for(int i = 0; i < dict_options.merge_count; i++) {
+        MfkeyDict dict;
+        mfkey_dict_init(&dict);
+        if(!mfkey_dict_load(dict_options.merge_files[i], &dict)) {
+            printf("Failed to load dictionary %s\n", dict_options.merge_files[i]);
+            mfkey_dict_free(&dict);
+            return false;
+        }
+        mfkey_dict_sort_unique(&dict);
+        bool ok = mfkey_dict_merge(&dict_options.merged, &dict);
+        mfkey_dict_free(&dict);
+        if(!ok) {
+            printf("Memory allocation failed!\n");
+            return false;
         }
-        fprintf(file, "\n");
     }
-    
-    fclose(file);
+    return true;
 }
 
 void print_usage(const char* program_name) {
     printf("%s - MIFARE Classic Key Recovery Tool\n", MFKEY_NAME);
     printf("Version %s\n\n", MFKEY_VERSION);
     
-    printf("Usage: %s [OPTIONS] <nonces.log> [output_keys.txt] [dict_output_dir]\n\n", program_name);
+    printf("Usage: %s [OPTIONS] <nonces.log> [output_keys.txt] [dict_output_dir]\n", program_name);
+    printf("       %s --merge <output.nfc> <input.nfc>...\n", program_name);
+    printf("       %s --batch [OPTIONS] <log or directory>...\n\n", program_name);
     
     printf("ARGUMENTS:\n");
-    printf("  nonces.log        Input file containing nonces from nested attack\n");
+    printf("  nonces.log        Input file containing nonces (nested, mfkey32 or hardnested log;\n");
+    printf("                    hardnested recovery is experimental, see README)\n");
     printf("  output_keys.txt   Output file for recovered keys (default: found_keys.txt)\n");
     printf("  dict_output_dir   Directory for candidate key dictionaries (default: current dir)\n\n");
     
@@ -871,6 +431,40 @@ void print_usage(const char* program_name) {
     printf("  -h, --help        Show this help message and exit\n");
     printf("  --no-ui           Disable pixel UI and use simple text output\n");
     printf("  --version         Show version information\n");
+    printf("  --log FILE        Also load nonces from FILE (may be repeated)\n");
+    printf("  --dict FILE       Try the keys of a .nfc/.mfkd dictionary on every nonce before\n");
+    printf("                    recovering it (may be repeated)\n");
+    printf("  --merge-dict FILE Merge an existing .nfc dictionary into each candidate dictionary\n");
+    printf("                    (may be repeated; output is sorted and deduplicated)\n");
+    printf("  --binary-dict     Also write sorted binary key files (.%s)\n", MFKEY_DICT_BIN_EXT);
+    printf("  --shared-key-filter  Assume key A == key B: keep only the candidates shared by the\n");
+    printf("                    key A and key B nonces of a sector (reported per sector)\n");
+    printf("  --cross-filter    Same as --shared-key-filter\n");
+    printf("  --top-k N         Write only the N candidates produced by the most nonces per dictionary\n");
+    printf("  --merge OUT IN... Merge and deduplicate dictionaries into OUT, then exit\n");
+    printf("  --cpu-features    Show detected CPU features and selected kernel variant\n");
+    printf("  --engine NAME     Recover with the named engine: reference (scalar path) or a kernel\n");
+    printf("                    variant (generic, sse42, avx2, avx512, sve)\n");
+    printf("  --force-isa NAME  Same as --engine\n");
+    printf("  --cross-check F   Also run a fraction F (0..1) of the MSB rounds on the reference engine\n");
+    printf("                    and fail on any difference in buckets or keys\n");
+    printf("  --bench NAME      Run a built-in benchmark and exit (filter, crypto1, leaf, extend, engines)\n");
+    printf("  --stats           Show recovery statistics after the summary\n");
+    printf("  --cache-dir DIR   Reuse and extend the odd-half expansion cache in DIR\n");
+    printf("  --build-cache DIR Precompute the odd-half cache for all keystream prefixes (about 4.4 GB),\n");
+    printf("                    then exit\n");
+    printf("  --results-db DIR  Reuse results of nonces recovered before and store new ones in DIR\n");
+    printf("  --trace FILE      Write a timeline of the recovery phases per thread (Chrome trace JSON)\n");
+    printf("  --metrics-file F  Rewrite Prometheus metrics to F while recovering (SIGUSR1: dump to stderr)\n");
+    printf("  --metrics-interval SEC  Seconds between metrics file updates (default: 5)\n");
+    printf("  --batch           Recover the nonces of many logs together; directories add their *.log files\n");
+    printf("  --batch-out DIR   Batch output root: one directory per log (default: current dir)\n");
+    printf("  --threads N       Worker threads (default: one per usable CPU in batch mode, else 1);\n");
+    printf("                    also the threads of a hardnested search (default: one per usable CPU)\n");
+    printf("  --max-cpu-percent N  Use at most N%% of the usable CPUs for the default thread counts\n");
+    printf("  --background      Lowest priority and half the threads, for shared hosts\n");
+    printf("  --no-pin          Do not pin worker threads to CPUs\n");
+    printf("  --plan            Print the planned schedule with estimated times, then exit\n");
 }
 
 // Progress bar display function - simple version
@@ -907,11 +501,437 @@ void print_simple_progress(int nonce_current, int nonce_total, int msb_current,
     }
 }
 
+// Display the statistics collected during recovery
+void print_stats(const MfkeyStats* b) {
+    char value[128];
+    pixel_ui_show_stats_header();
+    
+    uint64_t used = b->buckets - b->empty_buckets;
+    snprintf(value, sizeof(value), "%" PRIu64 " (%" PRIu64 " empty)", b->buckets, b->empty_buckets);
+    pixel_ui_show_stat("MSB buckets:", value);
+    snprintf(value, sizeof(value), "avg %.1f, max %d states",
+             b->buckets ? (double)b->odd_states / b->buckets : 0.0, b->max_odd);
+    pixel_ui_show_stat("Odd occupancy:", value);
+    snprintf(value, sizeof(value), "avg %.1f, max %d states",
+             b->buckets ? (double)b->even_states / b->buckets : 0.0, b->max_even);
+    pixel_ui_show_stat("Even occupancy:", value);
+    snprintf(value, sizeof(value), "%.1f%% of buckets joined", b->buckets ? 100.0 * used / b->buckets : 0.0);
+    pixel_ui_show_stat("Bucket utilization:", value);
+    snprintf(value, sizeof(value), "%" PRIu64 " (%.4f%% rejected)", b->leaf_checks,
+             b->leaf_checks ? 100.0 * (b->leaf_checks - b->leaf_matches) / b->leaf_checks : 0.0);
+    pixel_ui_show_stat("Leaf checks:", value);
+    snprintf(value, sizeof(value), "avg %.2f per check", b->leaf_checks ? (double)b->leaf_bits / b->leaf_checks : 0.0);
+    pixel_ui_show_stat("Bits examined:", value);
+    snprintf(value, sizeof(value), "%" PRIu64 " nonces", b->result_hits);
+    pixel_ui_show_stat("Stored results:", value);
+    snprintf(value, sizeof(value), "%" PRIu64 " nonces", b->dict_hits);
+    pixel_ui_show_stat("Dictionary hits:", value);
+    if(b->parity_nonces_pruned > 0 || b->parity_bucket_states > 0) {
+        snprintf(value, sizeof(value), "%.1f%% of even bucket states, %.1f%% extended",
+                 b->parity_bucket_states ? 100.0 * b->parity_bucket_pruned / b->parity_bucket_states : 0.0,
+                 b->parity_table_states ? 100.0 * b->parity_table_pruned / b->parity_table_states : 0.0);
+        pixel_ui_show_stat("Parity pruning:", value);
+        snprintf(value, sizeof(value), "%.1f%% of leaf pairs, %" PRIu64 " nonces ruled out",
+                 b->parity_pairs ? 100.0 * b->parity_pairs_pruned / b->parity_pairs : 0.0, b->parity_nonces_pruned);
+        pixel_ui_show_stat("Parity-pruned joins:", value);
+    }
+    if(b->cross_checks > 0) {
+        snprintf(value, sizeof(value), "%" PRIu64 " MSB rounds, %" PRIu64 " mismatches", b->cross_checks,
+                 b->cross_check_mismatches);
+        pixel_ui_show_stat("Cross-checks:", value);
+    }
+}
+
+// Report cross-check mismatches of a run, which make it fail
+static bool cross_check_failed(const MfkeyStats* stats) {
+    if(stats->cross_check_mismatches == 0) {
+        return false;
+    }
+    fprintf(stderr, "\nCross-check FAILED: %" PRIu64 " of %" PRIu64 " MSB rounds differ from the reference engine\n",
+            stats->cross_check_mismatches, stats->cross_checks);
+    return true;
+}
+
+// Batch mode: every log gets its own outputs, all nonces share one scheduler
+
+// Append a batch input: a log file, or every *.log file of a directory (sorted)
+static int compare_strings(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static bool collect_batch_inputs(const char* path, char*** files, int* count) {
+    struct stat st;
+    if(stat(path, &st) != 0) {
+        printf("Cannot access %s\n", path);
+        return false;
+    }
+    if(!S_ISDIR(st.st_mode)) {
+        char** grown = realloc(*files, sizeof(char*) * (*count + 1));
+        if(!grown || !(grown[*count] = strdup(path))) {
+            if(grown) *files = grown;
+            return false;
+        }
+        *files = grown;
+        (*count)++;
+        return true;
+    }
+
+    DIR* dir = opendir(path);
+    if(!dir) {
+        printf("Cannot open directory %s\n", path);
+        return false;
+    }
+    int first = *count;
+    struct dirent* entry;
+    bool ok = true;
+    while(ok && (entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if(length <= 4 || strcmp(entry->d_name + length - 4, ".log") != 0) continue;
+        char* file = malloc(strlen(path) + length + 2);
+        char** grown = realloc(*files, sizeof(char*) * (*count + 1));
+        if(!file || !grown) {
+            free(file);
+            if(grown) *files = grown;
+            ok = false;
+            break;
+        }
+        sprintf(file, "%s/%s", path, entry->d_name);
+        *files = grown;
+        (*files)[(*count)++] = file;
+    }
+    closedir(dir);
+    qsort(*files + first, *count - first, sizeof(char*), compare_strings);
+    return ok;
+}
+
+static void make_directory(const char* path) {
+#ifdef _WIN32
+    _mkdir(path);
+#else
+    mkdir(path, 0777);
+#endif
+}
+
+// Creates the directory if missing; false if it still is not a directory
+static bool ensure_directory(const char* path) {
+    make_directory(path);
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Output directory of a log: <out>/<file name without extension>, numbered if taken
+static void batch_output_dir(char* dir, size_t size, const char* out_dir, const char* log, char (*used)[256], int used_count) {
+    const char* base = strrchr(log, '/');
+    base = base ? base + 1 : log;
+    char stem[200];
+    snprintf(stem, sizeof(stem), "%s", base);
+    char* dot = strrchr(stem, '.');
+    if(dot && dot != stem) *dot = '\0';
+
+    for(int n = 1;; n++) {
+        if(n == 1) {
+            snprintf(dir, size, "%s/%s", out_dir, stem);
+        } else {
+            snprintf(dir, size, "%s/%s_%d", out_dir, stem, n);
+        }
+        bool taken = false;
+        for(int i = 0; i < used_count && !taken; i++) {
+            taken = strcmp(used[i], dir) == 0;
+        }
+        if(!taken) return;
+    }
+}
+
+typedef struct {
+    int printed; // Completed jobs reported so far
+    struct timespec start;
+} BatchProgress;
+
+// Publish the live metrics of a batch run (called from on_update)
+static void publish_batch_metrics(MfkeyBatch* batch) {
+    int threads = batch->threads;
+    char (*names)[24] = malloc(sizeof(*names) * threads);
+    const char** name_list = malloc(sizeof(char*) * threads);
+    double* busy = malloc(sizeof(double) * threads);
+    uint32_t* uids = malloc(sizeof(uint32_t) * (batch->job_count + 1));
+    int* candidates = calloc(batch->job_count + 1, sizeof(int));
+    if(names && name_list && busy && uids && candidates) {
+        uint64_t leaf_checks = 0;
+        for(int w = 0; w < threads; w++) {
+            uint64_t checks;
+            mfkey_batch_worker_status(batch, w, &checks, &busy[w]);
+            leaf_checks += checks;
+            snprintf(names[w], sizeof(names[w]), "worker %d", w + 1);
+            name_list[w] = names[w];
+        }
+        int keys_found = 0;
+        for(int g = 0; g < batch->group_count; g++) {
+            keys_found += batch->groups[g].solved;
+        }
+        int uid_count = 0;
+        for(int c = 0; c < batch->completed_count; c++) {
+            const MfkeyBatchJob* job = &batch->jobs[batch->completed[c]];
+            if(job->nonce.attack != static_encrypted) continue;
+            int u = 0;
+            while(u < uid_count && uids[u] != job->nonce.uid) u++;
+            if(u == uid_count) uids[uid_count++] = job->nonce.uid;
+            candidates[u] += job->candidate_count;
+        }
+        MfkeyMetricsSnapshot snapshot = {
+            leaf_checks, batch->job_count, batch->completed_count, batch->running, keys_found,
+            uids, candidates, uid_count, name_list, busy, threads};
+        mfkey_metrics_publish(&snapshot);
+    }
+    free(names);
+    free(name_list);
+    free(busy);
+    free(uids);
+    free(candidates);
+}
+
+// Report finished jobs, one line each, followed by a status line
+static void on_batch_update(void* user, MfkeyBatch* batch) {
+    BatchProgress* progress = user;
+    for(; progress->printed < batch->completed_count; progress->printed++) {
+        const MfkeyBatchJob* job = &batch->jobs[batch->completed[progress->printed]];
+        const MfClassicNonce* n = &job->nonce;
+        char label[48];
+        nonce_label(label, sizeof(label), n);
+        printf("\r[%d/%d] %08" PRIx32 " sector %2d key %c %-16s ",
+               progress->printed + 1, batch->job_count,
+               n->uid, n->sector, n->key_type ? n->key_type : '?', label);
+        if(job->found) {
+            for(int i = 0; i < MF_CLASSIC_KEY_SIZE; i++) {
+                printf("%02X", n->key.data[i]);
+            }
+            printf("%s" CLEAR_LINE "\n", job->cached ? " (stored)" : "");
+        } else if(job->cached && n->attack == static_encrypted) {
+            printf("%d candidates (stored)" CLEAR_LINE "\n", job->candidate_count);
+        } else if(job->skipped) {
+            printf("skipped (key already found)" CLEAR_LINE "\n");
+        } else if(n->attack == static_encrypted) {
+            printf("%d candidates" CLEAR_LINE "\n", job->candidate_count);
+        } else {
+            printf("no key%s" CLEAR_LINE "\n", job->cached ? " (stored)" : "");
+        }
+    }
+    printf("\r%d/%d jobs done, %d running, %.1f s" CLEAR_LINE, batch->completed_count, batch->job_count,
+           batch->running, seconds_since(&progress->start));
+    fflush(stdout);
+    publish_batch_metrics(batch);
+}
+
+// Single-log run: keys answered by the result database are shown as they are
+// applied, live keys by on_found_key
+static void on_single_update(void* user, MfkeyBatch* batch) {
+    int* reported = user;
+    for(; *reported < batch->completed_count; (*reported)++) {
+        const MfkeyBatchJob* job = &batch->jobs[batch->completed[*reported]];
+        if(job->cached && job->found) {
+            pixel_ui_show_found_key(job->nonce.key.data, "");
+        }
+    }
+    int current = batch->completed_count + (batch->running > 0);
+    __atomic_store_n(&global_current_nonce, current < batch->job_count ? current : batch->job_count, __ATOMIC_RELAXED);
+    publish_batch_metrics(batch);
+}
+
+// Print the planned schedule: each job with its estimated time and when it starts
+// if every group is solved by its first nonce. Backups only run if that fails.
+static void print_plan(const MfkeyBatch* batch) {
+    printf("%5s  %-8s %6s %3s  %-30s %9s %9s\n", "#", "uid", "sector", "key", "attack", "estimate", "start");
+    double elapsed = 0, backups = 0;
+    for(int i = 0; i < batch->order_count; i++) {
+        const MfkeyBatchJob* job = &batch->jobs[batch->order[i]];
+        const MfClassicNonce* n = &job->nonce;
+        char attack[48];
+        nonce_label(attack, sizeof(attack), n);
+        printf("%5d  %08" PRIx32 " %6d %3c  %-30s %7.2f s ", i + 1, n->uid, n->sector,
+               n->key_type ? n->key_type : '?', attack, job->cost);
+        if(job->backup) {
+            printf("%9s\n", "backup");
+            backups += job->cost;
+        } else {
+            printf("%7.2f s\n", elapsed);
+            elapsed += job->cost;
+        }
+    }
+    int stored = 0;
+    for(int j = 0; j < batch->job_count; j++) {
+        stored += batch->jobs[j].cached;
+    }
+    if(stored > 0) {
+        printf("%d nonces answered by the result database\n", stored);
+    }
+    printf("Estimated time: %.1f s", elapsed / batch->threads);
+    if(backups >= 0.05) {
+        printf(" (up to %.1f s if every backup runs)", (elapsed + backups) / batch->threads);
+    }
+    printf(" on %d thread%s\n", batch->threads, batch->threads == 1 ? "" : "s");
+}
+
+// Load every input into one batch, recover, then write each log's keys and
+// candidate dictionaries to its own directory under out_dir and print a summary
+int run_batch(const MfkeyConfig* config, char** inputs, int input_count, const char* out_dir, int threads, bool plan_only) {
+    char** files = NULL;
+    int file_count = 0;
+    for(int i = 0; i < input_count; i++) {
+        if(!collect_batch_inputs(inputs[i], &files, &file_count)) {
+            for(int f = 0; f < file_count; f++) free(files[f]);
+            free(files);
+            return 1;
+        }
+    }
+    if(file_count == 0) {
+        printf("No logs found\n");
+        free(files);
+        return 1;
+    }
+
+    MfkeyBatch batch;
+    mfkey_batch_init(&batch, config, &cancel_token, threads);
+    batch.shared_key_filter = dict_options.shared_key_filter;
+    batch.dictionary = attack_dict.count > 0 ? &attack_dict : NULL;
+    int total_nonces = 0, failed_logs = 0;
+    for(int f = 0; f < file_count; f++) {
+        MfClassicNonce* nonces = NULL;
+        int nonce_count = 0;
+        if(mfkey_load_nonces(files[f], &nonces, &nonce_count, NULL, NULL) < 0) {
+            printf("Failed to load %s\n", files[f]);
+            failed_logs++;
+            free(nonces);
+            continue;
+        }
+        bool added = mfkey_batch_add_log(&batch, files[f], nonces, nonce_count);
+        free(nonces);
+        if(!added) {
+            printf("Memory allocation failed!\n");
+            mfkey_batch_free(&batch);
+            for(int i = 0; i < file_count; i++) free(files[i]);
+            free(files);
+            return 1;
+        }
+        total_nonces += nonce_count;
+    }
+    for(int f = 0; f < file_count; f++) free(files[f]);
+    free(files);
+    printf("Loaded %d nonces from %d logs: %d unique, %d sector groups\n",
+           total_nonces, batch.log_count, batch.job_count, batch.group_count);
+    if(!mfkey_batch_plan(&batch)) {
+        mfkey_batch_free(&batch);
+        return 1;
+    }
+    if(plan_only) {
+        print_plan(&batch);
+        mfkey_batch_free(&batch);
+        return failed_logs == 0 ? 0 : 1;
+    }
+    printf("Recovering with %d worker thread%s\n\n", batch.threads, batch.threads == 1 ? "" : "s");
+
+    BatchProgress progress = {0, {0, 0}};
+    clock_gettime(CLOCK_MONOTONIC, &progress.start);
+    mfkey_governor_start(&governor);
+    bool completed = mfkey_batch_run(&batch, on_batch_update, &progress);
+    double elapsed = seconds_since(&progress.start);
+    double parallelism = mfkey_governor_parallelism(&governor);
+    printf("\n");
+
+    // Per-log outputs
+    make_directory(out_dir);
+    char (*dirs)[256] = calloc(batch.log_count + 1, sizeof(*dirs));
+    int total_candidates = 0, total_dicts = 0;
+    MfkeyDict all_keys;
+    mfkey_dict_init(&all_keys);
+    printf("\n%-32s %7s %5s %10s  %s\n", "log", "nonces", "keys", "candidates", "output");
+    for(int l = 0; l < batch.log_count && dirs; l++) {
+        const MfkeyBatchLog* log = &batch.logs[l];
+        char* dir = dirs[l];
+        batch_output_dir(dir, sizeof(dirs[l]), out_dir, log->name, dirs, l);
+
+        MfClassicKey* keys = NULL;
+        uint32_t* uids = NULL;
+        int key_count = 0, uid_count = 0, candidates = 0;
+        mfkey_batch_log_keys(&batch, l, &keys, &key_count);
+        mfkey_batch_log_uids(&batch, l, &uids, &uid_count);
+        if(key_count > 0) {
+            char keys_file[300];
+            make_directory(dir);
+            snprintf(keys_file, sizeof(keys_file), "%s/found_keys.txt", dir);
+            save_keys_to_file(keys_file, keys, key_count);
+            mfkey_dict_append_array(&all_keys, (const uint8_t(*)[6])keys, key_count);
+        }
+        for(int u = 0; u < uid_count; u++) {
+            MfkeyBatchCandidates ranked;
+            if(!mfkey_batch_log_candidates(&batch, l, uids[u], &ranked)) continue;
+            if(ranked.count == 0) {
+                mfkey_batch_candidates_free(&ranked);
+                continue;
+            }
+            make_directory(dir);
+            if(save_candidates(dir, uids[u], &batch, &ranked) > 0) {
+                total_dicts++;
+            }
+            candidates += ranked.count;
+            mfkey_batch_candidates_free(&ranked);
+        }
+        total_candidates += candidates;
+        printf("%-32s %7d %5d %10d  %s\n", log->name, log->nonce_count, key_count, candidates,
+               key_count > 0 || candidates > 0 ? dir : "-");
+        free(keys);
+        free(uids);
+    }
+    free(dirs);
+
+    // Combined summary
+    int run = 0, skipped = 0, shared = 0, unfinished = 0, stored = 0;
+    for(int j = 0; j < batch.job_count; j++) {
+        const MfkeyBatchJob* job = &batch.jobs[j];
+        if(!job->done) unfinished++;
+        else if(job->cached) stored++;
+        else if(job->skipped) skipped++;
+        else run++;
+        if(job->owners > 1) shared++;
+    }
+    mfkey_dict_sort_unique(&all_keys);
+    char all_keys_file[300];
+    snprintf(all_keys_file, sizeof(all_keys_file), "%s/found_keys.txt", out_dir);
+    if(all_keys.count > 0) {
+        mfkey_dict_write_nfc(all_keys_file, &all_keys);
+    }
+
+    printf("\nBatch summary\n");
+    printf("  Logs:        %d loaded", batch.log_count);
+    if(failed_logs) printf(", %d failed", failed_logs);
+    printf("\n  Nonces:      %d loaded, %d unique (%d shared by several lines or logs)\n",
+           total_nonces, batch.job_count, shared);
+    printf("  Jobs:        %d recovered, %d skipped (key already found)", run, skipped);
+    if(config->results_dir) printf(", %d from %s", stored, config->results_dir);
+    if(unfinished) printf(", %d not finished", unfinished);
+    printf("\n  Keys:        %zu unique", all_keys.count);
+    if(all_keys.count > 0) printf(" (%s)", all_keys_file);
+    printf("\n  Candidates:  %d in %d dictionaries\n", total_candidates, total_dicts);
+    printf("  Time:        %.1f s on %d thread%s\n", elapsed, batch.threads, batch.threads == 1 ? "" : "s");
+    printf("  Parallelism: %.1f CPUs busy of %d usable", parallelism, governor.budget.usable);
+    if(governor.max_backoff > 0) {
+        printf(", up to %d worker%s parked for other load (load average %.1f)", governor.max_backoff,
+               governor.max_backoff == 1 ? "" : "s", governor.load);
+    }
+    printf("\n");
+    if(show_stats) {
+        print_stats(&batch.stats);
+    }
+    bool cross_failed = cross_check_failed(&batch.stats);
+
+    mfkey_dict_free(&all_keys);
+    mfkey_batch_free(&batch);
+    return completed && failed_logs == 0 && !cross_failed ? 0 : 1;
+}
+
 // Add signal handling for Ctrl+C
 void signal_handler(int sig) {
     if(sig == SIGINT) {
         printf("\n\nReceived interrupt signal. Stopping attack gracefully...\n");
-        stop_attack = true;
+        mfkey_cancel(&cancel_token);
     }
 }
 
@@ -932,26 +952,202 @@ int main(int argc, char* argv[]) {
         }
     }
     
-    // Now check for minimum arguments
-    if(argc < 2) {
-        print_usage(argv[0]);
-        return 1;
-    }
-    
     // Parse arguments
-    const char* input_file = argv[1];
+    int ret = 1;
+    MfkeyContext* ctx = NULL;
+    const char* input_file = NULL;
     const char* output_file = "found_keys.txt";
     const char* dict_output_dir = NULL;
+    bool output_file_set = false;
+    int merge_output = 0;
+    const char* bench_name = NULL;
+    const char* build_cache_dir = NULL;
+    bool show_cpu_features = false;
+    const char* trace_file = NULL;
+    const char* metrics_file = NULL;
+    int metrics_interval = 5;
+    bool batch_mode = false;
+    bool plan_only = false;
+    const char* batch_out_dir = ".";
+    int threads = 0;
+    int max_cpu_percent = 100;
+    bool background = false;
+    bool pin = true;
+    MfkeyConfig config;
+    mfkey_config_init(&config);
+    
+    dict_options.merge_files = (const char**)malloc(sizeof(char*) * argc);
+    const char** extra_logs = (const char**)malloc(sizeof(char*) * argc);
+    int extra_log_count = 0;
+    char** batch_inputs = (char**)malloc(sizeof(char*) * argc);
+    int batch_input_count = 0;
+    const char** attack_dict_files = (const char**)malloc(sizeof(char*) * argc);
+    int attack_dict_count = 0;
     
     // Check for UI options and other arguments
-    for(int i = 2; i < argc; i++) {
+    for(int i = 1; i < argc; i++) {
         if(strcmp(argv[i], "--no-ui") == 0) {
             ui_options.no_ui = true;
-        } else if(strcmp(output_file, "found_keys.txt") == 0) {
-            output_file = argv[i];
-        } else if(dict_output_dir == NULL) {
-            dict_output_dir = argv[i];
+        } else if(strcmp(argv[i], "--binary-dict") == 0) {
+            dict_options.binary = true;
+        } else if(strcmp(argv[i], "--shared-key-filter") == 0 || strcmp(argv[i], "--cross-filter") == 0) {
+            dict_options.shared_key_filter = true;
+        } else if(strcmp(argv[i], "--top-k") == 0 && i + 1 < argc) {
+            dict_options.top_k = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--cpu-features") == 0) {
+            show_cpu_features = true;
+        } else if((strcmp(argv[i], "--engine") == 0 || strcmp(argv[i], "--force-isa") == 0) && i + 1 < argc) {
+            config.force_isa = argv[++i];
+        } else if(strcmp(argv[i], "--cross-check") == 0 && i + 1 < argc) {
+            config.cross_check = atof(argv[++i]);
+        } else if(strcmp(argv[i], "--stats") == 0) {
+            show_stats = true;
+        } else if(strcmp(argv[i], "--plan") == 0) {
+            plan_only = true;
+        } else if(strcmp(argv[i], "--batch") == 0) {
+            batch_mode = true;
+        } else if(strcmp(argv[i], "--batch-out") == 0 && i + 1 < argc) {
+            batch_out_dir = argv[++i];
+        } else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            config.search_threads = threads;
+        } else if(strcmp(argv[i], "--max-cpu-percent") == 0 && i + 1 < argc) {
+            max_cpu_percent = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--background") == 0) {
+            background = true;
+        } else if(strcmp(argv[i], "--no-pin") == 0) {
+            pin = false;
+        } else if(strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+            config.cache_dir = argv[++i];
+        } else if(strcmp(argv[i], "--results-db") == 0 && i + 1 < argc) {
+            config.results_dir = argv[++i];
+        } else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else if(strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+            metrics_file = argv[++i];
+        } else if(strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc) {
+            metrics_interval = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--build-cache") == 0 && i + 1 < argc) {
+            build_cache_dir = argv[++i];
+        } else if(strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            bench_name = argv[++i];
+        } else if(strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            extra_logs[extra_log_count++] = argv[++i];
+        } else if(strcmp(argv[i], "--dict") == 0 && i + 1 < argc) {
+            attack_dict_files[attack_dict_count++] = argv[++i];
+        } else if(strcmp(argv[i], "--merge-dict") == 0 && i + 1 < argc) {
+            dict_options.merge_files[dict_options.merge_count++] = argv[++i];
+        } else if(strcmp(argv[i], "--merge") == 0 && i + 2 < argc) {
+            merge_output = i + 1;
+            break;
+        } else {
+            // Batch mode takes any number of logs and directories
+            batch_inputs[batch_input_count++] = argv[i];
+            if(input_file == NULL) {
+                input_file = argv[i];
+            } else if(!output_file_set) {
+                output_file = argv[i];
+                output_file_set = true;
+            } else if(dict_output_dir == NULL) {
+                dict_output_dir = argv[i];
+            }
+        }
+    }
+    
+    if(config.results_dir) {
+        make_directory(config.results_dir);
+    }
+    // Fail once here rather than on every cache entry written
+    const char* cache_dirs[] = {config.cache_dir, build_cache_dir};
+    for(int i = 0; i < 2; i++) {
+        if(cache_dirs[i] && !ensure_directory(cache_dirs[i])) {
+            printf("Cannot create cache directory: %s\n", cache_dirs[i]);
+            goto cleanup;
+        }
+    }
+    if(trace_file) {
+        mfkey_trace_start(MFKEY_TRACE_DEFAULT_CAPACITY);
+        mfkey_trace_thread_name("main");
+    }
+    
+    if(!mfkey_governor_init(&governor, max_cpu_percent, background, pin)) {
+        printf("Memory allocation failed!\n");
+        goto cleanup;
+    }
+    config.governor = &governor;
+    
+    MfkeyCallbacks callbacks = {on_found_key, NULL, on_recover_progress, NULL};
+    ctx = mfkey_context_new(&config, &callbacks, &cancel_token);
+    if(!ctx) {
+        goto cleanup;
+    }
+    
+    if(show_cpu_features) {
+        print_cpu_features(ctx);
+        ret = 0;
+        goto cleanup;
+    }
+    
+    if(bench_name) {
+        if(strcmp(bench_name, "filter") == 0) {
+            ret = mfkey_bench_filter();
+        } else if(strcmp(bench_name, "crypto1") == 0) {
+            ret = mfkey_bench_crypto1();
+        } else if(strcmp(bench_name, "leaf") == 0) {
+            ret = mfkey_bench_leaf();
+        } else if(strcmp(bench_name, "extend") == 0) {
+            ret = mfkey_bench_extend(config.force_isa);
+        } else if(strcmp(bench_name, "engines") == 0) {
+            ret = mfkey_bench_engines(config.force_isa);
+        } else {
+            printf("Unknown benchmark: %s\n", bench_name);
+        }
+        goto cleanup;
+    }
+    
+    if(build_cache_dir) {
+        ret = build_odd_cache(ctx, build_cache_dir);
+        goto cleanup;
+    }
+    
+    if(merge_output) {
+        ret = merge_dictionaries(argv[merge_output], &argv[merge_output + 1], argc - merge_output - 1);
+        goto cleanup;
+    }
+    
+    if(attack_dict_count > 0 && !load_attack_dict(attack_dict_files, attack_dict_count)) {
+        goto cleanup;
+    }
+    if(!load_merge_dict()) {
+        goto cleanup;
+    }
+    
+    if(batch_mode) {
+        mfkey_context_free(ctx);
+        ctx = NULL;
+        for(int f = 0; f < extra_log_count; f++) {
+            batch_inputs[batch_input_count++] = (char*)extra_logs[f];
+        }
+        if(batch_input_count == 0) {
+            print_usage(argv[0]);
+        } else {
+            if(threads <= 0) {
+                threads = governor.workers;
+            }
+            if(!plan_only) mfkey_metrics_start(metrics_file, metrics_interval);
+            ret = run_batch(&config, batch_inputs, batch_input_count, batch_out_dir, threads, plan_only);
+            mfkey_metrics_stop();
+        }
+        if(trace_file && mfkey_trace_write(trace_file)) {
+            printf("Trace written to %s\n", trace_file);
         }
+        goto cleanup;
+    }
+    
+    // Now check for minimum arguments
+    if(input_file == NULL) {
+        print_usage(argv[0]);
+        goto cleanup;
     }
     
     // Initialize pixel UI
@@ -964,128 +1160,102 @@ int main(int argc, char* argv[]) {
     MfClassicNonce* nonces = NULL;
     int nonce_count = 0;
     
-    // Show loading message
-    pixel_ui_show_loading(input_file);
-    
-    if(!load_nested_nonces(input_file, &nonces, &nonce_count)) {
+    // Nested and mfkey32 logs are loaded into one nonce list
+    bool load_ok = true;
+    for(int f = -1; f < extra_log_count && load_ok; f++) {
+        const char* log_file = f < 0 ? input_file : extra_logs[f];
+        
+        // Show loading message
+        pixel_ui_show_loading(log_file);
+        load_ok = mfkey_load_nonces(log_file, &nonces, &nonce_count, on_nonce_loaded, NULL) >= 0;
+    }
+    if(load_ok) {
+        pixel_ui_show_loading_complete(nonce_count);
+    }
+    if(!load_ok || nonce_count == 0) {
         printf("Failed to load nonces from file!\n");
-        return 1;
+        free(nonces);
+        goto cleanup;
     }
     
-    total_nonces = nonce_count;
-    global_total_nonces = nonce_count;
-    
-    // 分阶段处理：
-    // 1) 先处理 static_nested（可直接恢复出密钥）
-    // 2) 再按 UID 分组处理 static_encrypted，每个 UID 生成独立字典
-
-    pixel_ui_show_start();
-
-    // 全局进度：累计处理的 nonce 数量（所有类型合计）
-    int processed_total = 0;
-
-    // 第一阶段：处理非 static_encrypted 的 nonce（例如 static_nested）
-    for(int i = 0; i < nonce_count && !stop_attack; i++) {
-        if(nonces[i].attack == static_encrypted) continue;
-        processed_total++;
-        current_nonce = processed_total;
-        global_current_nonce = processed_total;
-        // 全局总数固定为总 nonce 数
-        global_total_nonces = nonce_count;
-
-        MfClassicNonce* nonce = &nonces[i];
-        uint32_t ks_enc = 0, nt_xor_uid = 0;
-        switch(nonce->attack) {
-            case static_nested:
-                ks_enc = nonce->ks1_2_enc;
-                nt_xor_uid = nonce->uid_xor_nt1;
-                break;
-            default:
-                printf("Unsupported attack type: %d\n", nonce->attack);
-                continue;
-        }
-        recover(nonce, ks_enc, nt_xor_uid);
+    // 规划阶段：所有日志合并为一个批次，相同的 nonce 只恢复一次，
+    // 按 UID/扇区/密钥类型分组，估计每个 nonce 的代价后排序：
+    // 每个未解出的组先运行其代价最低的 nonce，static_encrypted 最后
+    MfkeyBatch batch;
+    mfkey_batch_init(&batch, &config, &cancel_token, threads > 0 ? threads : 1);
+    batch.callbacks = callbacks;
+    batch.shared_key_filter = dict_options.shared_key_filter;
+    batch.dictionary = attack_dict.count > 0 ? &attack_dict : NULL;
+    bool planned = mfkey_batch_add_log(&batch, input_file, nonces, nonce_count) && mfkey_batch_plan(&batch);
+    free(nonces);
+    if(!planned) {
+        printf("Memory allocation failed!\n");
+        mfkey_batch_free(&batch);
+        goto cleanup;
     }
-
-    // 第二阶段：按 UID 分组处理 static_encrypted
-    // 统计 unique UID 列表
-    uint32_t* unique_uids = NULL;
-    int unique_count = 0;
-    for(int i = 0; i < nonce_count; i++) {
-        if(nonces[i].attack != static_encrypted) continue;
-        uint32_t uid = nonces[i].uid;
-        bool exists = false;
-        for(int j = 0; j < unique_count; j++) {
-            if(unique_uids[j] == uid) { exists = true; break; }
-        }
-        if(!exists) {
-            unique_uids = realloc(unique_uids, sizeof(uint32_t) * (unique_count + 1));
-            unique_uids[unique_count++] = uid;
-        }
+    if(plan_only) {
+        printf("%d nonces loaded: %d unique, %d sector groups\n", nonce_count, batch.job_count, batch.group_count);
+        print_plan(&batch);
+        mfkey_batch_free(&batch);
+        ret = 0;
+        goto cleanup;
     }
 
-    // 保存每个 UID 的字典输出信息
+    // 进度按去重后的 nonce 计数
+    global_total_nonces = batch.job_count;
+    global_current_nonce = batch.job_count > 0 ? 1 : 0;
+    pixel_ui_show_start();
+    mfkey_metrics_start(metrics_file, metrics_interval);
+    int reported = 0;
+    mfkey_governor_start(&governor);
+    mfkey_batch_run(&batch, on_single_update, &reported);
+    double parallelism = mfkey_governor_parallelism(&governor);
+
+    // 每个 UID 的候选合并后生成独立字典
     typedef struct { uint32_t uid; int count; char path[256]; } DictOutput;
     DictOutput* dict_outputs = NULL;
     int dict_outputs_count = 0;
     int candidate_total_count = 0;
-
-    for(int u = 0; u < unique_count && !stop_attack; u++) {
+    uint32_t* unique_uids = NULL;
+    int unique_count = 0;
+    mfkey_batch_log_uids(&batch, 0, &unique_uids, &unique_count);
+    for(int u = 0; u < unique_count; u++) {
         uint32_t uid = unique_uids[u];
-
-        // 统计该 UID 的 nonce 数，用于进度显示
-        int group_total = 0;
-        for(int i = 0; i < nonce_count; i++) {
-            if(nonces[i].attack == static_encrypted && nonces[i].uid == uid) group_total++;
-        }
-        if(group_total == 0) continue;
-
-        // 清空候选集合，开始本 UID 的候选生成
-        if(candidate_keys) { free(candidate_keys); candidate_keys = NULL; }
-        candidate_key_count = 0;
-
-        for(int i = 0; i < nonce_count && !stop_attack; i++) {
-            MfClassicNonce* nonce = &nonces[i];
-            if(nonce->attack != static_encrypted || nonce->uid != uid) continue;
-
-            // 使用全局累计进度，避免显示为 1/1
-            processed_total++;
-            current_nonce = processed_total;
-            global_current_nonce = processed_total;
-            global_total_nonces = nonce_count;
-
-            uint32_t ks_enc = nonce->ks1_1_enc;
-            uint32_t nt_xor_uid = nonce->uid_xor_nt0;
-            recover(nonce, ks_enc, nt_xor_uid);
-        }
-
-        // 为该 UID 写出字典（若存在候选）
-        if(candidate_key_count > 0) {
+        MfkeyBatchCandidates ranked;
+        if(!mfkey_batch_log_candidates(&batch, 0, uid, &ranked)) continue;
+        if(ranked.count > 0) {
             char dict_filename[256];
-            if(dict_output_dir) {
-                snprintf(dict_filename, sizeof(dict_filename), "%s/mf_classic_dict_%08x.nfc", dict_output_dir, uid);
-            } else {
-                snprintf(dict_filename, sizeof(dict_filename), "mf_classic_dict_%08x.nfc", uid);
-            }
-            save_candidate_keys_to_dict(uid, dict_output_dir);
+            build_dict_path(dict_filename, sizeof(dict_filename), dict_output_dir, uid, "nfc");
+            int written = save_candidates(dict_output_dir, uid, &batch, &ranked);
 
             // 记录输出信息
-            dict_outputs = realloc(dict_outputs, sizeof(DictOutput) * (dict_outputs_count + 1));
-            dict_outputs[dict_outputs_count].uid = uid;
-            dict_outputs[dict_outputs_count].count = candidate_key_count;
-            snprintf(dict_outputs[dict_outputs_count].path, sizeof(dict_outputs[dict_outputs_count].path), "%s", dict_filename);
-            dict_outputs_count++;
+            if(written > 0) {
+                dict_outputs = realloc(dict_outputs, sizeof(DictOutput) * (dict_outputs_count + 1));
+                dict_outputs[dict_outputs_count].uid = uid;
+                dict_outputs[dict_outputs_count].count = written;
+                snprintf(dict_outputs[dict_outputs_count].path, sizeof(dict_outputs[dict_outputs_count].path), "%s", dict_filename);
+                dict_outputs_count++;
+            }
 
-            candidate_total_count += candidate_key_count;
+            candidate_total_count += ranked.count;
         }
-
-        // 清空，为下一个 UID 做准备
-        if(candidate_keys) { free(candidate_keys); candidate_keys = NULL; }
-        candidate_key_count = 0;
+        for(int i = 0; i < ranked.sector_count; i++) {
+            char text[128];
+            describe_shared_key_sector(&ranked.sectors[i], text, sizeof(text));
+            printf("UID %08X sector %d shared-key filter: %s\n", uid, ranked.sectors[i].sector, text);
+        }
+        mfkey_batch_candidates_free(&ranked);
     }
 
     // 展示汇总（候选数量为所有 UID 的总和）
+    MfClassicKey* found_keys = NULL;
+    int found_key_count = 0;
+    mfkey_batch_log_keys(&batch, 0, &found_keys, &found_key_count);
     pixel_ui_show_summary(nonce_count, found_key_count, candidate_total_count);
+    pixel_ui_show_parallelism(parallelism, governor.budget.usable);
+    if(show_stats) {
+        print_stats(&batch.stats);
+    }
 
     // 展示并保存已恢复密钥
     if(found_key_count > 0) {
@@ -1095,7 +1265,7 @@ int main(int argc, char* argv[]) {
         }
         pixel_ui_show_found_keys_list(keys_array, found_key_count);
         free(keys_array);
-        save_keys_to_file(output_file);
+        save_keys_to_file(output_file, found_keys, found_key_count);
     }
 
     // 显示保存文件：密钥文件（若有）
@@ -1121,13 +1291,27 @@ int main(int argc, char* argv[]) {
         pixel_ui_show_no_keys_found();
     }
 
+    mfkey_metrics_stop();
+    free(found_keys);
     if(unique_uids) free(unique_uids);
     if(dict_outputs) free(dict_outputs);
+    bool cross_failed = cross_check_failed(&batch.stats);
+    mfkey_batch_free(&batch);
     
-    // Cleanup
-    if(nonces) free(nonces);
-    if(found_keys) free(found_keys);
-    if(candidate_keys) free(candidate_keys);
+    if(trace_file && mfkey_trace_write(trace_file)) {
+        printf("Trace written to %s\n", trace_file);
+    }
     
-    return 0;
+    ret = cross_failed ? 1 : 0;
+    
+cleanup:
+    mfkey_context_free(ctx);
+    free(extra_logs);
+    free(batch_inputs);
+    free(dict_options.merge_files);
+    mfkey_dict_free(&dict_options.merged);
+    free(attack_dict_files);
+    mfkey_dictattack_free(&attack_dict);
+    mfkey_governor_free(&governor);
+    return ret;
 }
@@ -0,0 +1,303 @@
+#include "mfkey_dict.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Output buffer for the bulk hex writer (multiple of one 13-byte .nfc line)
+#define DICT_WRITE_BUFFER_SIZE (13 * 5040)
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+uint64_t mfkey_dict_pack(const uint8_t key[6]) {
+    uint64_t packed = 0;
+    for(int i = 0; i < 6; i++) {
+        packed = packed << 8 | key[i];
+    }
+    return packed;
+}
+
+void mfkey_dict_unpack(uint64_t packed, uint8_t key[6]) {
+    for(int i = 5; i >= 0; i--) {
+        key[i] = packed & 0xFF;
+        packed >>= 8;
+    }
+}
+
+void mfkey_dict_init(MfkeyDict* dict) {
+    dict->keys = NULL;
+    dict->count = 0;
+    dict->capacity = 0;
+}
+
+void mfkey_dict_free(MfkeyDict* dict) {
+    free(dict->keys);
+    mfkey_dict_init(dict);
+}
+
+static bool dict_reserve(MfkeyDict* dict, size_t capacity) {
+    if(capacity <= dict->capacity) {
+        return true;
+    }
+    size_t new_capacity = dict->capacity ? dict->capacity : 256;
+    while(new_capacity < capacity) {
+        new_capacity *= 2;
+    }
+    uint64_t* keys = realloc(dict->keys, sizeof(uint64_t) * new_capacity);
+    if(!keys) {
+        return false;
+    }
+    dict->keys = keys;
+    dict->capacity = new_capacity;
+    return true;
+}
+
+bool mfkey_dict_append(MfkeyDict* dict, const uint8_t key[6]) {
+    if(!dict_reserve(dict, dict->count + 1)) {
+        return false;
+    }
+    dict->keys[dict->count++] = mfkey_dict_pack(key);
+    return true;
+}
+
+bool mfkey_dict_append_array(MfkeyDict* dict, const uint8_t keys[][6], size_t count) {
+    if(!dict_reserve(dict, dict->count + count)) {
+        return false;
+    }
+    for(size_t i = 0; i < count; i++) {
+        dict->keys[dict->count++] = mfkey_dict_pack(keys[i]);
+    }
+    return true;
+}
+
+static int compare_keys(const void* a, const void* b) {
+    uint64_t ka = *(const uint64_t*)a;
+    uint64_t kb = *(const uint64_t*)b;
+    return (ka > kb) - (ka < kb);
+}
+
+void mfkey_dict_sort_unique(MfkeyDict* dict) {
+    if(dict->count < 2) {
+        return;
+    }
+    qsort(dict->keys, dict->count, sizeof(uint64_t), compare_keys);
+    size_t out = 1;
+    for(size_t i = 1; i < dict->count; i++) {
+        if(dict->keys[i] != dict->keys[out - 1]) {
+            dict->keys[out++] = dict->keys[i];
+        }
+    }
+    dict->count = out;
+}
+
+bool mfkey_dict_merge(MfkeyDict* dst, const MfkeyDict* src) {
+    if(src->count == 0) {
+        return true;
+    }
+
+    uint64_t* merged = malloc(sizeof(uint64_t) * (dst->count + src->count));
+    if(!merged) {
+        return false;
+    }
+
+    // Both inputs are sorted and unique, so one linear pass keeps the result sorted and unique
+    size_t i = 0, j = 0, out = 0;
+    while(i < dst->count && j < src->count) {
+        if(dst->keys[i] < src->keys[j]) {
+            merged[out++] = dst->keys[i++];
+        } else if(dst->keys[i] > src->keys[j]) {
+            merged[out++] = src->keys[j++];
+        } else {
+            merged[out++] = dst->keys[i++];
+            j++;
+        }
+    }
+    while(i < dst->count) merged[out++] = dst->keys[i++];
+    while(j < src->count) merged[out++] = src->keys[j++];
+
+    free(dst->keys);
+    dst->keys = merged;
+    dst->count = out;
+    dst->capacity = dst->count + src->count;
+    return true;
+}
+
+static int hex_value(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool load_bin(FILE* file, MfkeyDict* dict) {
+    uint8_t header[8];
+    if(fread(header, 1, sizeof(header), file) != sizeof(header) ||
+       header[4] != MFKEY_DICT_BIN_VERSION) {
+        return false;
+    }
+
+    uint8_t count_bytes[4];
+    if(fread(count_bytes, 1, sizeof(count_bytes), file) != sizeof(count_bytes)) {
+        return false;
+    }
+    size_t count = (size_t)count_bytes[0] | (size_t)count_bytes[1] << 8 |
+                   (size_t)count_bytes[2] << 16 | (size_t)count_bytes[3] << 24;
+    if(!dict_reserve(dict, dict->count + count)) {
+        return false;
+    }
+
+    uint8_t key[6];
+    for(size_t i = 0; i < count; i++) {
+        if(fread(key, 1, sizeof(key), file) != sizeof(key)) {
+            return false;
+        }
+        dict->keys[dict->count++] = mfkey_dict_pack(key);
+    }
+    return true;
+}
+
+static bool load_nfc(FILE* file, MfkeyDict* dict) {
+    char line[256];
+    while(fgets(line, sizeof(line), file)) {
+        // Skip comments and anything that is not a 12-digit hex key
+        if(line[0] == '#') {
+            continue;
+        }
+        uint64_t packed = 0;
+        int i;
+        for(i = 0; i < 12; i++) {
+            int v = hex_value(line[i]);
+            if(v < 0) break;
+            packed = packed << 4 | (uint64_t)v;
+        }
+        if(i != 12 || hex_value(line[12]) >= 0) {
+            continue;
+        }
+        if(!dict_reserve(dict, dict->count + 1)) {
+            return false;
+        }
+        dict->keys[dict->count++] = packed;
+    }
+    return true;
+}
+
+bool mfkey_dict_load(const char* filename, MfkeyDict* dict) {
+    FILE* file = fopen(filename, "rb");
+    if(!file) {
+        fprintf(stderr, "Failed to open dictionary file: %s\n", filename);
+        return false;
+    }
+
+    char magic[4] = {0};
+    size_t n = fread(magic, 1, sizeof(magic), file);
+    rewind(file);
+
+    bool ok;
+    if(n == sizeof(magic) && memcmp(magic, MFKEY_DICT_BIN_MAGIC, sizeof(magic)) == 0) {
+        ok = load_bin(file, dict);
+    } else {
+        ok = load_nfc(file, dict);
+    }
+    fclose(file);
+
+    if(!ok) {
+        fprintf(stderr, "Failed to read dictionary file: %s\n", filename);
+    }
+    return ok;
+}
+
+// Format keys into one large buffer and flush it with a single fwrite per fill
+static bool write_hex_lines(FILE* file, const uint64_t* packed, const uint8_t (*keys)[6], size_t count) {
+    char* buffer = malloc(DICT_WRITE_BUFFER_SIZE);
+    if(!buffer) {
+        return false;
+    }
+
+    size_t len = 0;
+    bool ok = true;
+    for(size_t i = 0; i < count && ok; i++) {
+        uint64_t key = packed ? packed[i] : mfkey_dict_pack(keys[i]);
+        char* p = buffer + len;
+        for(int j = 11; j >= 0; j--) {
+            p[j] = hex_digits[key & 0xF];
+            key >>= 4;
+        }
+        p[12] = '\n';
+        len += 13;
+        if(len == DICT_WRITE_BUFFER_SIZE) {
+            ok = fwrite(buffer, 1, len, file) == len;
+            len = 0;
+        }
+    }
+    if(ok && len > 0) {
+        ok = fwrite(buffer, 1, len, file) == len;
+    }
+
+    free(buffer);
+    return ok;
+}
+
+static bool write_nfc(const char* filename, const uint64_t* packed, const uint8_t (*keys)[6], size_t count) {
+    FILE* file = fopen(filename, "wb");
+    if(!file) {
+        fprintf(stderr, "Failed to create dictionary file: %s\n", filename);
+        return false;
+    }
+    bool ok = write_hex_lines(file, packed, keys, count);
+    if(fclose(file) != 0) {
+        ok = false;
+    }
+    if(!ok) {
+        fprintf(stderr, "Failed to write dictionary file: %s\n", filename);
+    }
+    return ok;
+}
+
+bool mfkey_dict_write_nfc(const char* filename, const MfkeyDict* dict) {
+    return write_nfc(filename, dict->keys, NULL, dict->count);
+}
+
+bool mfkey_dict_write_nfc_keys(const char* filename, const uint8_t keys[][6], size_t count) {
+    return write_nfc(filename, NULL, keys, count);
+}
+
+bool mfkey_dict_write_bin(const char* filename, const MfkeyDict* dict) {
+    FILE* file = fopen(filename, "wb");
+    if(!file) {
+        fprintf(stderr, "Failed to create key file: %s\n", filename);
+        return false;
+    }
+
+    uint8_t header[12];
+    memcpy(header, MFKEY_DICT_BIN_MAGIC, 4);
+    header[4] = MFKEY_DICT_BIN_VERSION;
+    header[5] = header[6] = header[7] = 0;
+    uint32_t count = (uint32_t)dict->count;
+    for(int i = 0; i < 4; i++) {
+        header[8 + i] = (count >> (8 * i)) & 0xFF;
+    }
+    bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header);
+
+    uint8_t* buffer = malloc(DICT_WRITE_BUFFER_SIZE);
+    size_t len = 0;
+    ok = ok && buffer;
+    for(size_t i = 0; i < dict->count && ok; i++) {
+        mfkey_dict_unpack(dict->keys[i], buffer + len);
+        len += 6;
+        if(len + 6 > DICT_WRITE_BUFFER_SIZE) {
+            ok = fwrite(buffer, 1, len, file) == len;
+            len = 0;
+        }
+    }
+    if(ok && len > 0) {
+        ok = fwrite(buffer, 1, len, file) == len;
+    }
+    free(buffer);
+
+    if(fclose(file) != 0) {
+        ok = false;
+    }
+    if(!ok) {
+        fprintf(stderr, "Failed to write key file: %s\n", filename);
+    }
+    return ok;
+}
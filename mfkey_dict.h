@@ -0,0 +1,53 @@
+#ifndef MFKEY_DICT_H
+#define MFKEY_DICT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sorted binary key file: magic, version, 3 reserved bytes and a little-endian
+// uint32 key count, followed by ascending 6-byte big-endian keys
+#define MFKEY_DICT_BIN_MAGIC   "MFKD"
+#define MFKEY_DICT_BIN_VERSION 1
+#define MFKEY_DICT_BIN_EXT     "mfkd"
+
+// Growable list of 48-bit keys packed into uint64_t (byte 0 is the MSB)
+typedef struct {
+    uint64_t* keys;
+    size_t count;
+    size_t capacity;
+} MfkeyDict;
+
+// Pack / unpack a 6-byte key
+uint64_t mfkey_dict_pack(const uint8_t key[6]);
+void mfkey_dict_unpack(uint64_t packed, uint8_t key[6]);
+
+// Initialize / free a dictionary
+void mfkey_dict_init(MfkeyDict* dict);
+void mfkey_dict_free(MfkeyDict* dict);
+
+// Append a key (no deduplication)
+bool mfkey_dict_append(MfkeyDict* dict, const uint8_t key[6]);
+
+// Append an array of keys (no deduplication)
+bool mfkey_dict_append_array(MfkeyDict* dict, const uint8_t keys[][6], size_t count);
+
+// Sort ascending and drop duplicates
+void mfkey_dict_sort_unique(MfkeyDict* dict);
+
+// Merge a sorted unique dictionary into another one by linear sorted merge
+bool mfkey_dict_merge(MfkeyDict* dst, const MfkeyDict* src);
+
+// Load keys from a Flipper .nfc dictionary or a binary key file (detected by magic)
+bool mfkey_dict_load(const char* filename, MfkeyDict* dict);
+
+// Write keys as Flipper-compatible .nfc dictionary (one 12-digit hex key per line)
+bool mfkey_dict_write_nfc(const char* filename, const MfkeyDict* dict);
+
+// Write raw 6-byte keys as Flipper-compatible .nfc dictionary
+bool mfkey_dict_write_nfc_keys(const char* filename, const uint8_t keys[][6], size_t count);
+
+// Write a sorted unique dictionary as binary key file
+bool mfkey_dict_write_bin(const char* filename, const MfkeyDict* dict);
+
+#endif // MFKEY_DICT_H
@@ -0,0 +1,81 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mfkey_dictattack.h"
+#include <stdlib.h>
+#include <string.h>
+#include "crypto1.h"
+#include "mfkey_cpu.h"
+
+bool mfkey_dictattack_load(MfkeyDictKeys* dict, const MfClassicKey* keys, size_t count) {
+    memset(dict, 0, sizeof(*dict));
+    dict->block_count = (count + MFKEY_DICT_LANES - 1) / MFKEY_DICT_LANES;
+    dict->keys = malloc(sizeof(MfClassicKey) * (count + 1));
+    dict->planes = mfkey_aligned_alloc(sizeof(MfkeyDictLanes), sizeof(MfkeyDictLanes) * 48 * (dict->block_count + 1));
+    if(!dict->keys || !dict->planes) {
+        free(dict->keys);
+        mfkey_aligned_free(dict->planes);
+        dict->keys = NULL;
+        dict->planes = NULL;
+        return false;
+    }
+    memset(dict->planes, 0, sizeof(MfkeyDictLanes) * 48 * dict->block_count);
+    memcpy(dict->keys, keys, sizeof(MfClassicKey) * count);
+    dict->count = count;
+
+    for(size_t i = 0; i < count; i++) {
+        struct Crypto1State s;
+        crypto1_set_lfsr(&s, &keys[i]);
+        MfkeyDictLanes* block = dict->planes + (i / MFKEY_DICT_LANES) * 48;
+        const int lane = i % MFKEY_DICT_LANES;
+        const uint64_t bit = 1ULL << (lane & 63);
+        for(int k = 0; k < 24; k++) {
+            if(BIT(s.odd, k)) block[47 - 2 * k][lane >> 6] |= bit;
+            if(BIT(s.even, k)) block[46 - 2 * k][lane >> 6] |= bit;
+        }
+    }
+    return true;
+}
+
+void mfkey_dictattack_free(MfkeyDictKeys* dict) {
+    free(dict->keys);
+    mfkey_aligned_free(dict->planes);
+    memset(dict, 0, sizeof(*dict));
+}
+
+bool mfkey_dictattack_check(const MfClassicNonce* n, const MfClassicKey* key) {
+    struct Crypto1State k, s;
+    crypto1_set_lfsr(&k, key);
+    switch(n->attack) {
+    case mfkey32:
+        s = k;
+        crypt_word_noret(&s, n->uid_xor_nt0, 0);
+        crypt_word_noret(&s, n->nr0_enc, 1);
+        if(crypt_word_ret(&s, 0, 0) != (n->ar0_enc ^ n->p64)) return false;
+        if(n->has_at0 && crypt_word_ret(&s, 0, 0) != (n->at0_enc ^ n->p96)) return false;
+        if(n->has_nt1) {
+            s = k;
+            crypt_word_noret(&s, n->uid_xor_nt1, 0);
+            crypt_word_noret(&s, n->nr1_enc, 1);
+            if(crypt_word_ret(&s, 0, 0) != (n->ar1_enc ^ n->p64b)) return false;
+        }
+        return true;
+    case static_nested: {
+        s = k;
+        if(crypt_word_ret(&s, n->uid_xor_nt1, 0) != n->ks1_2_enc) return false;
+        const uint32_t nt_enc = n->nt0 ^ n->ks1_1_enc;
+        for(int i = -1; i < n->nt0_alt_count; i++) {
+            uint32_t nt0 = i < 0 ? n->nt0 : n->nt0_alt[i];
+            s = k;
+            if(crypt_word_ret(&s, n->uid ^ nt0, 0) == (nt_enc ^ nt0)) return true;
+        }
+        return false;
+    }
+    case static_encrypted: {
+        uint8_t par;
+        s = k;
+        return crypt_word_par(&s, n->uid_xor_nt0, 0, n->nt0, &par) == n->ks1_1_enc && par == n->par_1;
+    }
+    case hardnested:
+        return mfkey_hardnested_check(n, &k);
+    }
+    return false;
+}
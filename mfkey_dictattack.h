@@ -0,0 +1,41 @@
+#ifndef MFKEY_DICTATTACK_H
+#define MFKEY_DICTATTACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mfkey.h"
+#include "mfkey_hardnested.h"
+
+// Dictionary attack: every key of a dictionary is tried on a nonce before it is
+// recovered. Keys are loaded into Crypto1 states once and stored bit-transposed,
+// so the bitsliced kernel of a kernel variant runs MFKEY_DICT_LANES keys through
+// the words of a nonce at once; the few lanes left are confirmed by the scalar
+// Crypto1.
+
+// Lanes of a block of keys: the same 512-lane blocks as the hardnested search
+typedef MfkeyHardLanes MfkeyDictLanes;
+#define MFKEY_DICT_LANES MFKEY_HARD_LANES
+
+// Keys of a dictionary. planes[block * 48 + t] holds bit t of the LFSR bit
+// sequence of each lane's key state (the Crypto1Slice layout at time 0); unused
+// lanes of the last block hold the zero key.
+struct MfkeyDictKeys {
+    MfClassicKey* keys;
+    size_t count;
+    MfkeyDictLanes* planes;
+    size_t block_count;
+};
+
+// Check every key of a block against a nonce. Sets the bits of the lanes still
+// consistent with it in alive[MFKEY_DICT_LANES / 64].
+typedef void (*MfkeyDictCheckFn)(const MfClassicNonce* n, const MfkeyDictLanes* planes, uint64_t* alive);
+
+// Load keys into a dictionary. Returns false on allocation failure.
+bool mfkey_dictattack_load(MfkeyDictKeys* dict, const MfClassicKey* keys, size_t count);
+void mfkey_dictattack_free(MfkeyDictKeys* dict);
+
+// Scalar check of one key against a nonce
+bool mfkey_dictattack_check(const MfClassicNonce* n, const MfClassicKey* key);
+
+#endif // MFKEY_DICTATTACK_H
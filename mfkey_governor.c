@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include "mfkey_governor.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Milliseconds a parked worker sleeps between admission checks
+#define GOVERNOR_PARK_MS 200
+
+static double seconds_between(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// User and system CPU time of all threads of the process
+static double process_cpu_seconds(void) {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if(!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+        return 0;
+    }
+    // FILETIME counts 100 ns ticks
+    uint64_t ticks = ((uint64_t)kernel.dwHighDateTime << 32 | kernel.dwLowDateTime) +
+                     ((uint64_t)user.dwHighDateTime << 32 | user.dwLowDateTime);
+    return ticks / 1e7;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+// 1-minute load average of the system. Windows has none: returns false and the
+// governor keeps its initial worker count.
+static bool system_load(double* load) {
+#ifdef _WIN32
+    (void)load;
+    return false;
+#else
+    return getloadavg(load, 1) == 1;
+#endif
+}
+
+// Lowest scheduling priority, for --background
+static void lower_priority(void) {
+#ifdef _WIN32
+    SetPriorityClass(GetCurrentProcess(), IDLE_PRIORITY_CLASS);
+#else
+    setpriority(PRIO_PROCESS, 0, 19);
+#endif
+}
+
+bool mfkey_governor_init(MfkeyGovernor* gov, int max_cpu_percent, bool background, bool pin) {
+    memset(gov, 0, sizeof(*gov));
+    gov->budget = *mfkey_cpu_budget();
+    gov->max_cpu_percent = max_cpu_percent >= 1 && max_cpu_percent <= 100 ? max_cpu_percent : 100;
+    gov->background = background;
+    gov->pin = pin && !background;
+    gov->workers = gov->budget.usable * gov->max_cpu_percent / 100;
+    if(background) gov->workers /= 2;
+    if(gov->workers < 1) gov->workers = 1;
+
+    gov->cpus = malloc(sizeof(int) * (gov->budget.online + 1));
+    if(!gov->cpus) {
+        return false;
+    }
+    gov->cpu_count = mfkey_cpu_affinity_list(gov->cpus, gov->budget.online);
+    if(background) {
+        lower_priority();
+    }
+    pthread_mutex_init(&gov->lock, NULL);
+    mfkey_governor_start(gov);
+    return true;
+}
+
+void mfkey_governor_free(MfkeyGovernor* gov) {
+    if(gov->cpus) {
+        pthread_mutex_destroy(&gov->lock);
+    }
+    free(gov->cpus);
+    gov->cpus = NULL;
+}
+
+void mfkey_governor_pin(const MfkeyGovernor* gov, int slot) {
+    if(gov->pin && gov->cpu_count > 0) {
+        mfkey_cpu_pin_thread(gov->cpus[slot % gov->cpu_count]);
+    }
+}
+
+// Re-evaluate the back-off once per check interval. The load of other processes
+// is the 1-minute load average minus the CPUs this process used since the last
+// check; the workers that no longer fit on the usable CPUs left are parked. The
+// back-off moves one step per check, since the load average lags by a minute.
+static void governor_refresh(MfkeyGovernor* gov) {
+    if(pthread_mutex_trylock(&gov->lock) != 0) {
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double elapsed = seconds_between(&gov->checked, &now);
+    double load;
+    if(elapsed >= MFKEY_GOVERNOR_CHECK_SECONDS && system_load(&load)) {
+        const double cpu = process_cpu_seconds();
+        double others = load - (cpu - gov->checked_cpu) / elapsed;
+        if(others < 0) others = 0;
+        int target = (int)(gov->workers - (gov->budget.usable - others) + 0.5);
+        if(target < 0) target = 0;
+        if(target > gov->workers - 1) target = gov->workers - 1;
+        int backoff = gov->backoff;
+        if(target > backoff) backoff++;
+        else if(target < backoff) backoff--;
+        __atomic_store_n(&gov->backoff, backoff, __ATOMIC_RELAXED);
+        if(backoff > gov->max_backoff) gov->max_backoff = backoff;
+        gov->load = load;
+        gov->checked = now;
+        gov->checked_cpu = cpu;
+    }
+    pthread_mutex_unlock(&gov->lock);
+}
+
+bool mfkey_governor_admit(MfkeyGovernor* gov, int slot, int threads, const MfkeyCancelToken* cancel) {
+    const struct timespec park = {0, GOVERNOR_PARK_MS * 1000000L};
+    for(;;) {
+        governor_refresh(gov);
+        if(slot == 0 || slot < threads - __atomic_load_n(&gov->backoff, __ATOMIC_RELAXED)) {
+            return true;
+        }
+        if(cancel && mfkey_cancel_requested(cancel)) {
+            return false;
+        }
+        nanosleep(&park, NULL);
+    }
+}
+
+void mfkey_governor_start(MfkeyGovernor* gov) {
+    clock_gettime(CLOCK_MONOTONIC, &gov->start);
+    gov->start_cpu = process_cpu_seconds();
+    gov->checked = gov->start;
+    gov->checked_cpu = gov->start_cpu;
+}
+
+double mfkey_governor_parallelism(const MfkeyGovernor* gov) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const double elapsed = seconds_between(&gov->start, &now);
+    return elapsed > 0 ? (process_cpu_seconds() - gov->start_cpu) / elapsed : 0;
+}
@@ -0,0 +1,63 @@
+#ifndef MFKEY_GOVERNOR_H
+#define MFKEY_GOVERNOR_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+#include "mfkey.h"
+#include "mfkey_cpu.h"
+
+// CPU resource governor for shared hosts. Sizes the worker pools from the CPUs
+// the process may use (affinity mask and cgroup quota, see mfkey_cpu_budget),
+// optionally lowers the priority, pins workers to CPUs, and parks workers while
+// other processes keep the load average above the usable CPUs. Batch workers
+// and hardnested search threads ask it for admission before each unit of work.
+
+// Seconds between load average checks
+#define MFKEY_GOVERNOR_CHECK_SECONDS 5
+
+struct MfkeyGovernor {
+    MfkeyCpuBudget budget;
+    int max_cpu_percent; // Share of the usable CPUs to use, 1..100
+    bool background;     // Lowest priority and half the workers
+    bool pin;            // Pin worker slot i to cpus[i % cpu_count]
+    int workers;         // Default worker threads
+    int* cpus;           // CPUs of the affinity mask
+    int cpu_count;
+
+    // Load back-off, guarded by lock
+    pthread_mutex_t lock;
+    int backoff;         // Workers parked in each pool (0..workers - 1), read without the lock
+    int max_backoff;     // Highest value of backoff so far
+    double load;         // Last 1-minute load average
+    struct timespec checked;
+    double checked_cpu;  // Process CPU seconds at the last check
+
+    // Effective parallelism: process CPU seconds per wall second since start
+    struct timespec start;
+    double start_cpu;
+};
+
+// Set up a governor. max_cpu_percent outside 1..100 means 100. With background,
+// the process gets the lowest scheduling priority (threads created afterwards
+// inherit it) and half the workers, and workers are not pinned. Returns false on
+// allocation failure.
+bool mfkey_governor_init(MfkeyGovernor* gov, int max_cpu_percent, bool background, bool pin);
+void mfkey_governor_free(MfkeyGovernor* gov);
+
+// Pin the calling thread as worker slot (if pinning is enabled)
+void mfkey_governor_pin(const MfkeyGovernor* gov, int slot);
+
+// Wait until worker slot of a pool of threads workers may run: while other
+// processes take CPUs from the usable ones, the top slots of each pool sleep, one
+// per CPU taken (the lowest slot always runs). Returns false if cancel was set
+// while waiting.
+bool mfkey_governor_admit(MfkeyGovernor* gov, int slot, int threads, const MfkeyCancelToken* cancel);
+
+// Restart the parallelism measurement (e.g. after loading and planning)
+void mfkey_governor_start(MfkeyGovernor* gov);
+
+// Process CPU seconds per wall second since mfkey_governor_start()
+double mfkey_governor_parallelism(const MfkeyGovernor* gov);
+
+#endif // MFKEY_GOVERNOR_H
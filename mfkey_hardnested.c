@@ -0,0 +1,461 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mfkey_hardnested.h"
+#include "mfkey_cpu.h"
+#include "mfkey_governor.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Odd halves per work unit of the search (each against every even block of its pair)
+#define HARD_ODD_CHUNK 4
+// Milliseconds between progress reports
+#define HARD_PROGRESS_MS 100
+
+// Classes per depth of a function tree: 2, then c(c + 1) / 2 unordered child pairs
+static const int class_counts[5] = {2, 3, 6, 21, MFKEY_HARD_CLASSES};
+
+// Class tables, built once (build_classes)
+static uint8_t class_of[4][256];                    // Class of a truth table of depth 0..3
+static uint8_t class_low[5][MFKEY_HARD_CLASSES];    // Children of a class of depth 1..4
+static uint8_t class_high[5][MFKEY_HARD_CLASSES];
+static uint8_t odd_class[1 << 20];                  // Class of A for the 20 low odd bits
+static uint8_t even_class[1 << 19];                 // Class of B for the 19 low even bits
+static uint32_t odd_class_size[MFKEY_HARD_CLASSES]; // Low halves per class
+static uint32_t even_class_size[MFKEY_HARD_CLASSES];
+static pthread_once_t classes_once = PTHREAD_ONCE_INIT;
+
+static int class_pair(int a, int b) {
+    if(a > b) {
+        int t = a;
+        a = b;
+        b = t;
+    }
+    return b * (b + 1) / 2 + a;
+}
+
+// Truth tables are indexed by the feedback bits, the first fed bit most
+// significant, so the children of the top variable are the low and high halves
+static inline int class4(int tt) {
+    return class_pair(class_of[3][tt & 0xff], class_of[3][tt >> 8]);
+}
+
+// A: keystream bits 0, 2, 4, 6 and 8 of the first byte over y1, y3, y5, y7
+static int odd_function(uint32_t odd) {
+    int f[16], tt = 0;
+    const int f0 = filter(odd);
+    for(int y = 0; y < 16; y++) {
+        f[y] = filter(odd << 4 | y);
+    }
+    for(int y = 0; y < 16; y++) {
+        int v = f0 ^ filter(odd << 1 | y >> 3) ^ filter(odd << 2 | y >> 2) ^ filter(odd << 3 | y >> 1) ^ f[y];
+        tt |= v << y;
+    }
+    return tt;
+}
+
+// B: keystream bits 1, 3, 5 and 7 of the first byte over y0, y2, y4, y6
+static int even_function(uint32_t even) {
+    int tt = 0;
+    for(int y = 0; y < 16; y++) {
+        int v = filter(even << 1 | y >> 3) ^ filter(even << 2 | y >> 2) ^ filter(even << 3 | y >> 1) ^
+                filter(even << 4 | y);
+        tt |= v << y;
+    }
+    return tt;
+}
+
+static void build_classes(void) {
+    class_of[0][0] = 0;
+    class_of[0][1] = 1;
+    for(int d = 1; d <= 4; d++) {
+        int half = 1 << (d - 1);
+        if(d <= 3) {
+            for(int tt = 0; tt < 1 << (1 << d); tt++) {
+                class_of[d][tt] = class_pair(class_of[d - 1][tt & ((1 << half) - 1)], class_of[d - 1][tt >> half]);
+            }
+        }
+        for(int b = 0; b < class_counts[d - 1]; b++) {
+            for(int a = 0; a <= b; a++) {
+                class_low[d][class_pair(a, b)] = a;
+                class_high[d][class_pair(a, b)] = b;
+            }
+        }
+    }
+    for(uint32_t odd = 0; odd < 1 << 20; odd++) {
+        odd_class[odd] = class4(odd_function(odd));
+        odd_class_size[odd_class[odd]]++;
+    }
+    for(uint32_t even = 0; even < 1 << 19; even++) {
+        even_class[even] = class4(even_function(even));
+        even_class_size[even_class[even]]++;
+    }
+}
+
+// One misread nonce is tolerated once enough nonces are kept to outvote it
+static int hard_max_misses(const MfClassicNonce* n) {
+    return n->hard_count >= 8 ? 1 : 0;
+}
+
+void mfkey_hardnested_add(MfClassicNonce* n, uint32_t nt_enc, uint8_t par) {
+    const uint8_t b = nt_enc >> 24, bit = 1 << (b & 7);
+    const bool sum = ((par >> 3) & 1) ^ nfc_util_even_parity8(b);
+    if(n->hard_total++ == 0) {
+        n->nt0 = nt_enc;
+    }
+    if(n->hard_first_bad[b >> 3] & bit) {
+        // Already unusable
+    } else if(!(n->hard_first_seen[b >> 3] & bit)) {
+        n->hard_first_seen[b >> 3] |= bit;
+        n->hard_first_sum[b >> 3] |= sum ? bit : 0;
+    } else if(!!(n->hard_first_sum[b >> 3] & bit) != sum) {
+        // A misread nonce or parity: the byte can not be trusted either way
+        n->hard_first_seen[b >> 3] &= ~bit;
+        n->hard_first_sum[b >> 3] &= ~bit;
+        n->hard_first_bad[b >> 3] |= bit;
+    }
+
+    if(n->hard_count < MFKEY_HARD_NONCES) {
+        for(int i = 0; i < n->hard_count; i++) {
+            if(n->hard_nt_enc[i] == nt_enc && n->hard_par[i] == par) {
+                return;
+            }
+        }
+        n->hard_nt_enc[n->hard_count] = nt_enc;
+        n->hard_par[n->hard_count] = par;
+        n->hard_count++;
+    }
+}
+
+int mfkey_hardnested_first_known(const MfClassicNonce* n) {
+    int known = 0;
+    for(int i = 0; i < 32; i++) {
+        known += __builtin_popcount(n->hard_first_seen[i]);
+    }
+    return known;
+}
+
+int mfkey_hardnested_log(const MfClassicNonce* n, MfkeyHardLog* log) {
+    int known = 0;
+    memset(log, 0, sizeof(*log));
+    log->uid = n->uid;
+    memcpy(log->sum, n->hard_first_sum, sizeof(log->sum));
+    for(int b = 0; b < 256; b++) {
+        if(n->hard_first_seen[b >> 3] & (1 << (b & 7))) {
+            known++;
+            for(int level = 8; level >= 0; level--) {
+                log->known[(1 << level) | (b & ((1 << level) - 1))] = 1;
+            }
+        }
+    }
+    for(int i = 0; i < n->hard_count && log->nonce_count < MFKEY_HARD_KERNEL_NONCES; i++) {
+        const uint8_t b = n->hard_nt_enc[i] >> 24;
+        if(n->hard_first_bad[b >> 3] & (1 << (b & 7))) continue;
+        log->nt_enc[log->nonce_count] = n->hard_nt_enc[i];
+        log->par[log->nonce_count] = n->hard_par[i];
+        log->nonce_count++;
+    }
+    log->max_misses = hard_max_misses(n);
+    return known;
+}
+
+// Match the class pairs against the first byte tree of a nonce, bottom-up over
+// the levels of the tree: match[L][node][a][b] tells whether the subtree of the
+// log below node (level L, b_0 .. b_L-1) equals, up to child swaps, a function
+// with A in class a and B in class b of the depths left at that level. Level L
+// branches on y_L: B for even L, A for odd L. Sets allowed[a * CLASSES + b] for
+// the root. Returns false on allocation failure.
+static bool match_classes(const MfClassicNonce* n, bool* allowed) {
+    uint8_t* match[9];
+    int depth_a[9], depth_b[9];
+    bool ok = true;
+    for(int level = 0; level <= 8; level++) {
+        depth_a[level] = 4 - level / 2;
+        depth_b[level] = 4 - (level + 1) / 2;
+        match[level] = malloc((size_t)(1 << level) * class_counts[depth_a[level]] * class_counts[depth_b[level]]);
+        ok = ok && match[level];
+    }
+
+#define MATCH(level, node, a, b) \
+    match[level][((node) * class_counts[depth_a[level]] + (a)) * class_counts[depth_b[level]] + (b)]
+    for(int level = 8; ok && level >= 0; level--) {
+        const int count_a = class_counts[depth_a[level]], count_b = class_counts[depth_b[level]];
+        for(int node = 0; node < 1 << level; node++) {
+            const int c0 = node, c1 = node | 1 << level;
+            for(int a = 0; a < count_a; a++) {
+                for(int b = 0; b < count_b; b++) {
+                    bool m;
+                    if(level == 8) {
+                        m = !(n->hard_first_seen[node >> 3] & (1 << (node & 7))) ||
+                            !!(n->hard_first_sum[node >> 3] & (1 << (node & 7))) == (a ^ b);
+                    } else if((level & 1) == 0) {
+                        const int lo = class_low[depth_b[level]][b], hi = class_high[depth_b[level]][b];
+                        m = (MATCH(level + 1, c0, a, lo) && MATCH(level + 1, c1, a, hi)) ||
+                            (MATCH(level + 1, c0, a, hi) && MATCH(level + 1, c1, a, lo));
+                    } else {
+                        const int lo = class_low[depth_a[level]][a], hi = class_high[depth_a[level]][a];
+                        m = (MATCH(level + 1, c0, lo, b) && MATCH(level + 1, c1, hi, b)) ||
+                            (MATCH(level + 1, c0, hi, b) && MATCH(level + 1, c1, lo, b));
+                    }
+                    MATCH(level, node, a, b) = m;
+                }
+            }
+        }
+    }
+    for(int a = 0; ok && a < MFKEY_HARD_CLASSES; a++) {
+        for(int b = 0; b < MFKEY_HARD_CLASSES; b++) {
+            allowed[a * MFKEY_HARD_CLASSES + b] = MATCH(0, 0, a, b) && odd_class_size[a] && even_class_size[b];
+        }
+    }
+#undef MATCH
+
+    for(int level = 0; level <= 8; level++) {
+        free(match[level]);
+    }
+    return ok;
+}
+
+double mfkey_hardnested_states(const MfClassicNonce* n) {
+    pthread_once(&classes_once, build_classes);
+    static bool allowed[MFKEY_HARD_CLASSES * MFKEY_HARD_CLASSES];
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    double states = 0;
+    pthread_mutex_lock(&lock);
+    if(match_classes(n, allowed)) {
+        for(int a = 0; a < MFKEY_HARD_CLASSES; a++) {
+            for(int b = 0; b < MFKEY_HARD_CLASSES; b++) {
+                // The high odd (4) and even (5) bits only reach the feedback taps
+                if(allowed[a * MFKEY_HARD_CLASSES + b]) {
+                    states += (double)odd_class_size[a] * 16 * even_class_size[b] * 32;
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return states;
+}
+
+// Full halves of a class: the low bits of the class times every high bit pattern
+static bool collect_halves(MfkeyHardHalves* halves, const uint8_t* classes, int low_bits, int cls, bool planes) {
+    const uint32_t low_count = 1u << low_bits, high_count = 1u << (24 - low_bits);
+    const uint32_t size = (classes == odd_class ? odd_class_size : even_class_size)[cls];
+    halves->count = size * high_count;
+    halves->states = malloc(sizeof(uint32_t) * halves->count);
+    if(!halves->states) {
+        return false;
+    }
+    uint32_t count = 0;
+    for(uint32_t low = 0; low < low_count; low++) {
+        if(classes[low] == cls) {
+            halves->states[count++] = low;
+        }
+    }
+    for(uint32_t high = 1; high < high_count; high++) {
+        for(uint32_t i = 0; i < size; i++) {
+            halves->states[high * size + i] = high << low_bits | halves->states[i];
+        }
+    }
+    if(!planes) {
+        return true;
+    }
+
+    halves->block_count = (halves->count + MFKEY_HARD_LANES - 1) / MFKEY_HARD_LANES;
+    halves->planes = mfkey_aligned_alloc(sizeof(MfkeyHardLanes), sizeof(MfkeyHardLanes) * 24 * halves->block_count);
+    if(!halves->planes) {
+        return false;
+    }
+    memset(halves->planes, 0, sizeof(MfkeyHardLanes) * 24 * halves->block_count);
+    for(uint32_t i = 0; i < halves->count; i++) {
+        MfkeyHardLanes* block = halves->planes + (size_t)(i / MFKEY_HARD_LANES) * 24;
+        const int lane = i % MFKEY_HARD_LANES;
+        for(int k = 0; k < 24; k++) {
+            block[k][lane / 64] |= (uint64_t)BIT(halves->states[i], k) << (lane % 64);
+        }
+    }
+    return true;
+}
+
+bool mfkey_hardnested_plan(const MfClassicNonce* n, MfkeyHardPlan* plan) {
+    pthread_once(&classes_once, build_classes);
+    memset(plan, 0, sizeof(*plan));
+
+    plan->first_known = mfkey_hardnested_log(n, &plan->log);
+
+    bool* allowed = malloc(sizeof(bool) * MFKEY_HARD_CLASSES * MFKEY_HARD_CLASSES);
+    plan->pairs = malloc(sizeof(*plan->pairs) * MFKEY_HARD_CLASSES * MFKEY_HARD_CLASSES);
+    bool ok = allowed && plan->pairs && match_classes(n, allowed);
+    for(int a = 0; ok && a < MFKEY_HARD_CLASSES; a++) {
+        for(int b = 0; ok && b < MFKEY_HARD_CLASSES; b++) {
+            if(!allowed[a * MFKEY_HARD_CLASSES + b]) continue;
+            if(!plan->odd[a].states) {
+                ok = collect_halves(&plan->odd[a], odd_class, 20, a, false);
+            }
+            if(ok && !plan->even[b].states) {
+                ok = collect_halves(&plan->even[b], even_class, 19, b, true);
+            }
+            plan->pairs[plan->pair_count][0] = a;
+            plan->pairs[plan->pair_count][1] = b;
+            plan->pair_count++;
+            plan->states += (double)plan->odd[a].count * plan->even[b].count;
+        }
+    }
+    free(allowed);
+    if(!ok) {
+        mfkey_hardnested_plan_free(plan);
+    }
+    return ok;
+}
+
+void mfkey_hardnested_plan_free(MfkeyHardPlan* plan) {
+    for(int c = 0; c < MFKEY_HARD_CLASSES; c++) {
+        free(plan->odd[c].states);
+        free(plan->even[c].states);
+        mfkey_aligned_free(plan->even[c].planes);
+    }
+    free(plan->pairs);
+    memset(plan, 0, sizeof(*plan));
+}
+
+bool mfkey_hardnested_check(const MfClassicNonce* n, const struct Crypto1State* key_state) {
+    const int max_misses = hard_max_misses(n);
+    int misses = 0;
+    for(int i = 0; i < n->hard_count; i++) {
+        const uint32_t nt_enc = n->hard_nt_enc[i], in = n->uid ^ nt_enc;
+        const uint8_t b = nt_enc >> 24;
+        if(n->hard_first_bad[b >> 3] & (1 << (b & 7))) continue;
+        struct Crypto1State s = *key_state;
+        for(int byte = 0; byte < 4; byte++) {
+            uint8_t ks = 0;
+            for(int bit = 0; bit < 8; bit++) {
+                ks |= crypt_bit(&s, BEBIT(in, byte * 8 + bit), 1) << bit;
+            }
+            uint8_t plain = get_nth_byte(nt_enc, byte) ^ ks;
+            if((nfc_util_even_parity8(plain) ^ filter(s.odd)) != ((n->hard_par[i] >> (3 - byte)) & 1)) {
+                if(++misses > max_misses) {
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    const MfClassicNonce* n;
+    const MfkeyHardPlan* plan;
+    MfkeyHardSearchFn search_fn;
+    MfkeyHardSearch* search;
+    MfkeyGovernor* governor;
+    uint64_t* unit_start; // First work unit of each pair, pair_count + 1 entries
+    uint64_t next;        // Next work unit
+    int running;          // Workers not exited yet
+    int slots;            // Governor slots handed out to workers
+    int threads;
+    pthread_mutex_t lock; // Guards search->found and key_state
+} HardRun;
+
+static void* hard_worker(void* arg) {
+    HardRun* run = arg;
+    const MfkeyHardPlan* plan = run->plan;
+    MfkeyHardSearch* search = run->search;
+    const uint64_t units = run->unit_start[plan->pair_count];
+    uint64_t alive[MFKEY_HARD_LANES / 64];
+    int pair = 0;
+    const int slot = __atomic_fetch_add(&run->slots, 1, __ATOMIC_RELAXED);
+    if(run->governor) {
+        mfkey_governor_pin(run->governor, slot);
+    }
+    for(;;) {
+        if(__atomic_load_n(&search->found, __ATOMIC_RELAXED) ||
+           (search->cancel && mfkey_cancel_requested(search->cancel)) ||
+           (run->governor && !mfkey_governor_admit(run->governor, slot, run->threads, search->cancel))) {
+            break;
+        }
+        uint64_t unit = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED);
+        if(unit >= units) {
+            break;
+        }
+        while(run->unit_start[pair + 1] <= unit) pair++;
+        const MfkeyHardHalves* odd = &plan->odd[plan->pairs[pair][0]];
+        const MfkeyHardHalves* even = &plan->even[plan->pairs[pair][1]];
+        const uint32_t first = (uint32_t)(unit - run->unit_start[pair]) * HARD_ODD_CHUNK;
+        uint64_t matches = 0;
+        for(uint32_t i = first; i < first + HARD_ODD_CHUNK && i < odd->count; i++) {
+            const uint32_t odd_state = odd->states[i];
+            for(uint32_t block = 0; block < even->block_count; block++) {
+                run->search_fn(&plan->log, odd_state, even->planes + (size_t)block * 24, alive);
+                for(int w = 0; w < MFKEY_HARD_LANES / 64; w++) {
+                    while(alive[w]) {
+                        uint32_t index = block * MFKEY_HARD_LANES + w * 64 + __builtin_ctzll(alive[w]);
+                        alive[w] &= alive[w] - 1;
+                        if(index >= even->count) continue;
+                        matches++;
+                        struct Crypto1State state = {odd_state, even->states[index]};
+                        if(mfkey_hardnested_check(run->n, &state)) {
+                            pthread_mutex_lock(&run->lock);
+                            if(!search->found) {
+                                search->key_state = state;
+                                __atomic_store_n(&search->found, true, __ATOMIC_RELAXED);
+                            }
+                            pthread_mutex_unlock(&run->lock);
+                        }
+                    }
+                }
+            }
+            __atomic_fetch_add(&search->states, (uint64_t)even->count, __ATOMIC_RELAXED);
+        }
+        __atomic_fetch_add(&search->matches, matches, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_sub(&run->running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+bool mfkey_hardnested_search(
+    const MfClassicNonce* n,
+    const MfkeyHardPlan* plan,
+    MfkeyHardSearchFn search_fn,
+    int threads,
+    MfkeyGovernor* governor,
+    MfkeyHardSearch* search) {
+    if(threads <= 0) {
+        threads = mfkey_cpu_budget()->usable;
+    }
+    HardRun run = {n, plan, search_fn, search, governor, NULL, 0, 0, 0, threads, PTHREAD_MUTEX_INITIALIZER};
+    run.unit_start = malloc(sizeof(uint64_t) * (plan->pair_count + 1));
+    pthread_t* workers = malloc(sizeof(pthread_t) * threads);
+    if(!run.unit_start || !workers) {
+        free(run.unit_start);
+        free(workers);
+        return false;
+    }
+    run.unit_start[0] = 0;
+    for(int p = 0; p < plan->pair_count; p++) {
+        const uint32_t odd_count = plan->odd[plan->pairs[p][0]].count;
+        run.unit_start[p + 1] = run.unit_start[p] + (odd_count + HARD_ODD_CHUNK - 1) / HARD_ODD_CHUNK;
+    }
+
+    int started = 0;
+    run.running = threads;
+    for(; started < threads; started++) {
+        if(pthread_create(&workers[started], NULL, hard_worker, &run) != 0) {
+            break;
+        }
+    }
+    __atomic_fetch_sub(&run.running, threads - started, __ATOMIC_RELEASE);
+
+    const struct timespec pause = {0, HARD_PROGRESS_MS * 1000000L};
+    while(__atomic_load_n(&run.running, __ATOMIC_ACQUIRE) > 0) {
+        nanosleep(&pause, NULL);
+        if(search->on_progress && plan->states > 0) {
+            search->on_progress(search->user, __atomic_load_n(&search->states, __ATOMIC_RELAXED) / plan->states);
+        }
+    }
+    for(int w = 0; w < started; w++) {
+        pthread_join(workers[w], NULL);
+    }
+    pthread_mutex_destroy(&run.lock);
+    free(run.unit_start);
+    free(workers);
+    return started > 0;
+}
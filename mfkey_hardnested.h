@@ -0,0 +1,143 @@
+#ifndef MFKEY_HARDNESTED_H
+#define MFKEY_HARDNESTED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mfkey.h"
+#include "crypto1.h"
+
+// Hardnested attack: key recovery from the encrypted nonces of a card with a
+// hardened PRNG, where nothing but the encrypted nonce and its encrypted parity
+// bits is known.
+//
+// The sum bit of a first encrypted byte b (its parity bit, par bit 3, XOR the
+// parity of b) is the parity of the first keystream byte XOR the keystream bit
+// after it. It only depends on the key state and b, so every nonce starting with
+// b gives the same bit.
+// Crypto1 feeds the nonce into alternating halves: the odd keystream bits of the
+// byte depend on the odd half (its 20 low bits) and the feedback bits y1, y3, y5,
+// y7, the even ones on the even half (19 low bits) and y0, y2, y4, y6. Feedback
+// bit y_k is b_k XOR a function of b_0 .. b_k-1, so over all 256 first bytes the
+// sum bits form the tree of A(y_odd) ^ B(y_even) with the children of any node
+// possibly swapped: the generalized first byte sum property. Classes of A and B
+// under these swaps (231 each) are matched against the tree of the log, leaving
+// the halves of a couple of class pairs, which are searched by a bitsliced
+// Crypto1 walking the same tree.
+
+// Lanes of the bitsliced search: bit l of every plane belongs to candidate l
+typedef uint64_t MfkeyHardLanes __attribute__((vector_size(64)));
+#define MFKEY_HARD_LANES 512
+
+// Canonical classes of a 4-variable function under child swaps
+#define MFKEY_HARD_CLASSES 231
+
+// Kept nonces whose parity bits after the first byte are checked by the search
+// kernel; the survivors of these get the full mfkey_hardnested_check()
+#define MFKEY_HARD_KERNEL_NONCES 4
+
+// A hardnested nonce as read by the search kernel
+typedef struct {
+    uint32_t uid;
+    uint8_t sum[32];    // Sum bit of each first byte (bitmap)
+    uint8_t known[512]; // Nodes of the first byte tree with a known first byte below:
+                        // node (level, prefix of b) at (1 << level) | prefix
+    uint32_t nt_enc[MFKEY_HARD_KERNEL_NONCES];
+    uint8_t par[MFKEY_HARD_KERNEL_NONCES];
+    int nonce_count;
+    int max_misses; // Kept nonces allowed to fail (a misread nonce)
+} MfkeyHardLog;
+
+// The 24-bit halves of one class. Even halves are also stored bit-transposed in
+// blocks of MFKEY_HARD_LANES: planes[block * 24 + k] holds bit k, unused lanes of
+// the last block hold the zero half.
+typedef struct {
+    uint32_t* states;
+    uint32_t count;
+    MfkeyHardLanes* planes;
+    uint32_t block_count;
+} MfkeyHardHalves;
+
+typedef struct {
+    MfkeyHardLog log;
+    MfkeyHardHalves odd[MFKEY_HARD_CLASSES];  // Halves of the classes used by a pair
+    MfkeyHardHalves even[MFKEY_HARD_CLASSES];
+    uint8_t (*pairs)[2]; // Allowed (odd, even) class pairs
+    int pair_count;
+    double states;   // Candidate key states left
+    int first_known; // First bytes with a known sum
+} MfkeyHardPlan;
+
+// Check every candidate of a block of even halves combined with one odd half
+// against the known first byte sums and the nonces of the log. Sets the bits of
+// the lanes still alive in alive[MFKEY_HARD_LANES / 64]; these are verified with
+// mfkey_hardnested_check().
+typedef void (*MfkeyHardSearchFn)(
+    const MfkeyHardLog* log, uint32_t odd, const MfkeyHardLanes* planes, uint64_t* alive);
+
+// Search progress and result, shared with mfkey_hardnested_search()
+typedef struct {
+    MfkeyCancelToken* cancel;
+    void (*on_progress)(void* user, double fraction); // Called on the calling thread
+    void* user;
+    uint64_t states;  // Candidate states examined
+    uint64_t matches; // Candidates passing the first byte sums
+    bool found;
+    struct Crypto1State key_state;
+} MfkeyHardSearch;
+
+// Merge one logged nonce into a hardnested nonce: nt_enc is the encrypted nonce
+// and par its encrypted parity bits (as par0 of nested lines)
+void mfkey_hardnested_add(MfClassicNonce* n, uint32_t nt_enc, uint8_t par);
+
+// Number of first bytes with a known sum
+int mfkey_hardnested_first_known(const MfClassicNonce* n);
+
+// Fill the kernel's view of a nonce. Returns the first bytes with a known sum.
+int mfkey_hardnested_log(const MfClassicNonce* n, MfkeyHardLog* log);
+
+// Candidate key states left by the first byte sums (cheap after the first call,
+// which builds the class tables in about a second)
+double mfkey_hardnested_states(const MfClassicNonce* n);
+
+// Build the candidate halves of a nonce. Returns false on allocation failure.
+bool mfkey_hardnested_plan(const MfClassicNonce* n, MfkeyHardPlan* plan);
+void mfkey_hardnested_plan_free(MfkeyHardPlan* plan);
+
+// Search the plan on threads workers (one kernel call per odd half and block)
+// until the key state is found, every candidate is checked or search->cancel is
+// set. With a governor, workers are pinned and admitted before each work unit.
+// Returns false if no worker could be started.
+bool mfkey_hardnested_search(
+    const MfClassicNonce* n,
+    const MfkeyHardPlan* plan,
+    MfkeyHardSearchFn search_fn,
+    int threads,
+    MfkeyGovernor* governor,
+    MfkeyHardSearch* search);
+
+// Check a key state against every nonce kept for the final check
+bool mfkey_hardnested_check(const MfClassicNonce* n, const struct Crypto1State* key_state);
+
+// Keystream bit of the lanes at time u, with the same bit sequence layout as
+// Crypto1Slice (odd bit k of the state at time u is a[u + 47 - 2k])
+#define MFKEY_HARD_FILTER(a, u)                                                                     \
+    MFKEY_HARD_FC(MFKEY_HARD_FA((a)[(u) + 9], (a)[(u) + 11], (a)[(u) + 13], (a)[(u) + 15]),           \
+                  MFKEY_HARD_FB((a)[(u) + 17], (a)[(u) + 19], (a)[(u) + 21], (a)[(u) + 23]),          \
+                  MFKEY_HARD_FB((a)[(u) + 25], (a)[(u) + 27], (a)[(u) + 29], (a)[(u) + 31]),          \
+                  MFKEY_HARD_FA((a)[(u) + 33], (a)[(u) + 35], (a)[(u) + 37], (a)[(u) + 39]),          \
+                  MFKEY_HARD_FB((a)[(u) + 41], (a)[(u) + 43], (a)[(u) + 45], (a)[(u) + 47]))
+
+// Filter subfunctions as in crypto1_slice_fa/fb/fc; macros, so that the vectors
+// are never passed by value between functions compiled for different targets
+#define MFKEY_HARD_FA(a, b, c, d) ((((a) | (b)) ^ ((a) & (d))) ^ ((c) & (((a) ^ (b)) | (d))))
+#define MFKEY_HARD_FB(a, b, c, d) ((((a) & (b)) | (c)) ^ (((a) ^ (b)) & ((c) | (d))))
+#define MFKEY_HARD_FC(a, b, c, d, e) \
+    (((a) | (((b) | (e)) & ((d) ^ (e)))) ^ (((a) ^ ((b) & (d))) & (((c) ^ (d)) | ((b) & (e)))))
+
+// XOR of the feedback taps of the lanes at time u (as crypto1_slice_taps)
+#define MFKEY_HARD_TAPS(a, u)                                                                      \
+    ((a)[(u)] ^ (a)[(u) + 5] ^ (a)[(u) + 9] ^ (a)[(u) + 10] ^ (a)[(u) + 12] ^ (a)[(u) + 14] ^          \
+     (a)[(u) + 15] ^ (a)[(u) + 17] ^ (a)[(u) + 19] ^ (a)[(u) + 24] ^ (a)[(u) + 25] ^ (a)[(u) + 27] ^   \
+     (a)[(u) + 29] ^ (a)[(u) + 35] ^ (a)[(u) + 39] ^ (a)[(u) + 41] ^ (a)[(u) + 42] ^ (a)[(u) + 43])
+
+#endif // MFKEY_HARDNESTED_H
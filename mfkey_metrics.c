@@ -0,0 +1,240 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mfkey_metrics.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+// GetProcessMemoryInfo() from kernel32, no psapi import library needed
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Milliseconds between checks for SIGUSR1 and the stop request
+#define METRICS_POLL_MS 100
+
+typedef struct {
+    uint64_t leaf_checks;
+    int nonces_total;
+    int nonces_done;
+    int nonces_running;
+    int keys_found;
+    uint32_t* uids;
+    int* candidates;
+    int uid_count;
+    int uid_capacity;
+    char thread_names[MFKEY_METRICS_MAX_THREADS][32];
+    double busy_seconds[MFKEY_METRICS_MAX_THREADS];
+    int thread_count;
+} Snapshot;
+
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static Snapshot metrics_snapshot; // Guarded by metrics_lock
+static pthread_t metrics_thread;
+static bool metrics_running = false;
+static volatile int metrics_stop_requested = 0;
+static volatile sig_atomic_t metrics_dump_requested = 0;
+static const char* metrics_path = NULL;
+static int metrics_interval_ms = 5000;
+static struct timespec metrics_start;
+
+// Rate sample of the previous write
+static double rate_time = 0;
+static uint64_t rate_checks = 0;
+static double states_per_second = 0;
+
+static double seconds_since_start(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - metrics_start.tv_sec) + (now.tv_nsec - metrics_start.tv_nsec) / 1e9;
+}
+
+#ifdef SIGUSR1
+static void on_sigusr1(int sig) {
+    (void)sig;
+    metrics_dump_requested = 1;
+}
+#endif
+
+void mfkey_metrics_publish(const MfkeyMetricsSnapshot* s) {
+    pthread_mutex_lock(&metrics_lock);
+    Snapshot* m = &metrics_snapshot;
+    m->leaf_checks = s->leaf_checks;
+    m->nonces_total = s->nonces_total;
+    m->nonces_done = s->nonces_done;
+    m->nonces_running = s->nonces_running;
+    m->keys_found = s->keys_found;
+    if(s->uid_count > m->uid_capacity) {
+        uint32_t* uids = realloc(m->uids, sizeof(uint32_t) * s->uid_count);
+        if(uids) m->uids = uids;
+        int* candidates = realloc(m->candidates, sizeof(int) * s->uid_count);
+        if(candidates) m->candidates = candidates;
+        if(uids && candidates) m->uid_capacity = s->uid_count;
+    }
+    m->uid_count = s->uid_count < m->uid_capacity ? s->uid_count : m->uid_capacity;
+    if(m->uid_count > 0) {
+        memcpy(m->uids, s->uids, sizeof(uint32_t) * m->uid_count);
+        memcpy(m->candidates, s->candidates, sizeof(int) * m->uid_count);
+    }
+    m->thread_count = s->thread_count < MFKEY_METRICS_MAX_THREADS ? s->thread_count : MFKEY_METRICS_MAX_THREADS;
+    for(int t = 0; t < m->thread_count; t++) {
+        snprintf(m->thread_names[t], sizeof(m->thread_names[t]), "%s", s->thread_names[t]);
+        m->busy_seconds[t] = s->busy_seconds[t];
+    }
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+// Peak resident set size of the process in bytes, 0 if unknown
+static uint64_t peak_rss_bytes(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    counters.cb = sizeof(counters);
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    // macOS reports ru_maxrss in bytes, Linux in KiB
+    return (uint64_t)usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+// Format the latest snapshot. Called on the metrics thread only.
+static void write_metrics(FILE* file, bool update_rate) {
+    pthread_mutex_lock(&metrics_lock);
+    const Snapshot* m = &metrics_snapshot;
+    double elapsed = seconds_since_start();
+    if(update_rate && elapsed > rate_time) {
+        states_per_second = (m->leaf_checks - rate_checks) / (elapsed - rate_time);
+        rate_time = elapsed;
+        rate_checks = m->leaf_checks;
+    }
+    uint64_t peak_rss = peak_rss_bytes();
+
+    fprintf(file, "# HELP mfkey_elapsed_seconds Time since the run started.\n");
+    fprintf(file, "# TYPE mfkey_elapsed_seconds gauge\n");
+    fprintf(file, "mfkey_elapsed_seconds %.3f\n", elapsed);
+    fprintf(file, "# HELP mfkey_states_checked_total Candidate states verified against their nonce.\n");
+    fprintf(file, "# TYPE mfkey_states_checked_total counter\n");
+    fprintf(file, "mfkey_states_checked_total %" PRIu64 "\n", m->leaf_checks);
+    fprintf(file, "# HELP mfkey_states_per_second Candidate states verified per second since the previous sample.\n");
+    fprintf(file, "# TYPE mfkey_states_per_second gauge\n");
+    fprintf(file, "mfkey_states_per_second %.0f\n", states_per_second);
+    fprintf(file, "# HELP mfkey_nonces Nonces by state.\n");
+    fprintf(file, "# TYPE mfkey_nonces gauge\n");
+    fprintf(file, "mfkey_nonces{state=\"done\"} %d\n", m->nonces_done);
+    fprintf(file, "mfkey_nonces{state=\"running\"} %d\n", m->nonces_running);
+    fprintf(file, "mfkey_nonces{state=\"pending\"} %d\n", m->nonces_total - m->nonces_done - m->nonces_running);
+    fprintf(file, "# HELP mfkey_keys_found Keys recovered.\n");
+    fprintf(file, "# TYPE mfkey_keys_found gauge\n");
+    fprintf(file, "mfkey_keys_found %d\n", m->keys_found);
+    fprintf(file, "# HELP mfkey_candidates Candidate keys collected per UID.\n");
+    fprintf(file, "# TYPE mfkey_candidates gauge\n");
+    for(int u = 0; u < m->uid_count; u++) {
+        fprintf(file, "mfkey_candidates{uid=\"%08" PRIx32 "\"} %d\n", m->uids[u], m->candidates[u]);
+    }
+    fprintf(file, "# HELP mfkey_peak_rss_bytes Peak resident set size.\n");
+    fprintf(file, "# TYPE mfkey_peak_rss_bytes gauge\n");
+    fprintf(file, "mfkey_peak_rss_bytes %" PRIu64 "\n", peak_rss);
+    fprintf(file, "# HELP mfkey_thread_busy_seconds_total Time each recovery thread spent on nonces.\n");
+    fprintf(file, "# TYPE mfkey_thread_busy_seconds_total counter\n");
+    for(int t = 0; t < m->thread_count; t++) {
+        fprintf(file, "mfkey_thread_busy_seconds_total{thread=\"%s\"} %.3f\n", m->thread_names[t], m->busy_seconds[t]);
+    }
+    fprintf(file, "# HELP mfkey_thread_utilization Busy fraction of each recovery thread since the start.\n");
+    fprintf(file, "# TYPE mfkey_thread_utilization gauge\n");
+    for(int t = 0; t < m->thread_count; t++) {
+        fprintf(file, "mfkey_thread_utilization{thread=\"%s\"} %.3f\n", m->thread_names[t],
+                elapsed > 0 ? m->busy_seconds[t] / elapsed : 0.0);
+    }
+    pthread_mutex_unlock(&metrics_lock);
+}
+
+// Rewrite the metrics file; readers only ever see complete files
+static void write_metrics_file(void) {
+    char temp_path[600];
+    snprintf(temp_path, sizeof(temp_path), "%s.%ld.tmp", metrics_path, (long)getpid());
+    FILE* file = fopen(temp_path, "w");
+    if(!file) {
+        return;
+    }
+    write_metrics(file, true);
+    if(fclose(file) != 0 || rename(temp_path, metrics_path) != 0) {
+        remove(temp_path);
+    }
+}
+
+static void* metrics_main(void* arg) {
+    (void)arg;
+    int waited_ms = 0;
+    while(!__atomic_load_n(&metrics_stop_requested, __ATOMIC_ACQUIRE)) {
+        struct timespec pause = {0, METRICS_POLL_MS * 1000000L};
+        nanosleep(&pause, NULL);
+        waited_ms += METRICS_POLL_MS;
+        if(metrics_dump_requested) {
+            metrics_dump_requested = 0;
+            fprintf(stderr, "\n");
+            write_metrics(stderr, false);
+            fflush(stderr);
+        }
+        if(metrics_path && waited_ms >= metrics_interval_ms) {
+            waited_ms = 0;
+            write_metrics_file();
+        }
+    }
+    return NULL;
+}
+
+bool mfkey_metrics_start(const char* path, int interval_seconds) {
+    metrics_path = path;
+    metrics_interval_ms = (interval_seconds > 0 ? interval_seconds : 5) * 1000;
+    metrics_stop_requested = 0;
+    clock_gettime(CLOCK_MONOTONIC, &metrics_start);
+    rate_time = 0;
+    rate_checks = 0;
+    states_per_second = 0;
+    if(metrics_path) {
+        write_metrics_file();
+    }
+#ifdef SIGUSR1
+    signal(SIGUSR1, on_sigusr1);
+#endif
+    metrics_running = pthread_create(&metrics_thread, NULL, metrics_main, NULL) == 0;
+    return metrics_running;
+}
+
+void mfkey_metrics_stop(void) {
+    if(!metrics_running) {
+        return;
+    }
+    __atomic_store_n(&metrics_stop_requested, 1, __ATOMIC_RELEASE);
+    pthread_join(metrics_thread, NULL);
+    metrics_running = false;
+    if(metrics_path) {
+        write_metrics_file();
+    }
+#ifdef SIGUSR1
+    signal(SIGUSR1, SIG_DFL);
+#endif
+    pthread_mutex_lock(&metrics_lock);
+    free(metrics_snapshot.uids);
+    free(metrics_snapshot.candidates);
+    memset(&metrics_snapshot, 0, sizeof(metrics_snapshot));
+    pthread_mutex_unlock(&metrics_lock);
+}
@@ -0,0 +1,42 @@
+#ifndef MFKEY_METRICS_H
+#define MFKEY_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Live metrics for unattended runs. The recovery side publishes snapshots; a
+// background thread rewrites a Prometheus text-format file from the latest one
+// at a fixed interval (for the node-exporter textfile collector) and dumps it
+// to stderr on SIGUSR1.
+
+#define MFKEY_METRICS_MAX_THREADS 256
+
+typedef struct {
+    uint64_t leaf_checks; // Candidate states verified so far
+    int nonces_total;
+    int nonces_done;
+    int nonces_running;
+    int keys_found;
+
+    // Candidate keys per UID (static_encrypted)
+    const uint32_t* uids;
+    const int* candidates;
+    int uid_count;
+
+    // Busy time of each recovery thread
+    const char* const* thread_names;
+    const double* busy_seconds;
+    int thread_count;
+} MfkeyMetricsSnapshot;
+
+// Start the metrics thread and the SIGUSR1 handler. path may be NULL to only
+// serve SIGUSR1. Returns false if the thread cannot be started.
+bool mfkey_metrics_start(const char* path, int interval_seconds);
+
+// Replace the published snapshot (copied)
+void mfkey_metrics_publish(const MfkeyMetricsSnapshot* snapshot);
+
+// Write the file a last time and stop the thread
+void mfkey_metrics_stop(void);
+
+#endif // MFKEY_METRICS_H
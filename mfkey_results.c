@@ -0,0 +1,168 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mfkey_results.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t fields[MFKEY_RESULTS_FIELDS];
+    uint32_t found;
+    uint32_t candidate_count;
+    uint8_t key[8]; // MF_CLASSIC_KEY_SIZE bytes, zero padded
+} ResultHeader;
+
+uint64_t mfkey_result_fingerprint(const MfClassicNonce* n, uint32_t fields[MFKEY_RESULTS_FIELDS]) {
+    memset(fields, 0, sizeof(uint32_t) * MFKEY_RESULTS_FIELDS);
+    fields[0] = n->attack;
+    fields[1] = n->uid;
+    fields[2] = n->nt0;
+    fields[3] = n->nt1;
+    if(n->attack == mfkey32) {
+        fields[4] = n->nr0_enc;
+        fields[5] = n->ar0_enc;
+        fields[6] = n->has_nt1 ? n->nr1_enc : 0;
+        fields[7] = n->has_nt1 ? n->ar1_enc : 0;
+        fields[8] = n->has_at0 ? n->at0_enc : 0;
+        fields[9] = (uint32_t)n->has_at0 | (uint32_t)n->has_nt1 << 1;
+        if(!n->has_nt1) fields[3] = 0;
+    } else if(n->attack == hardnested) {
+        // First byte sums, and the nonces kept for the final check
+        for(int i = 0; i < 32; i++) {
+            fields[4] = (fields[4] ^ n->hard_first_seen[i]) * 0x01000193;
+            fields[5] = (fields[5] ^ n->hard_first_sum[i]) * 0x01000193;
+        }
+        for(int i = 0; i < n->hard_count; i++) {
+            fields[6] = (fields[6] ^ n->hard_nt_enc[i]) * 0x01000193;
+            fields[7] = (fields[7] ^ n->hard_par[i]) * 0x01000193;
+        }
+        fields[8] = n->hard_count;
+    } else {
+        fields[4] = n->ks1_1_enc;
+        fields[5] = n->ks1_2_enc;
+        fields[6] = n->par_1;
+        fields[7] = n->par_2;
+        // nt0 alternatives of a dist > 0 line (zero for static nonces)
+        fields[8] = n->nt0_alt_count;
+        for(int i = 0; i < n->nt0_alt_count; i++) {
+            fields[9] = (fields[9] ^ n->nt0_alt[i]) * 0x01000193;
+        }
+    }
+
+    // FNV-1a over the fields
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < MFKEY_RESULTS_FIELDS; i++) {
+        for(int b = 0; b < 32; b += 8) {
+            hash ^= (fields[i] >> b) & 0xFF;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    return hash;
+}
+
+void mfkey_result_path(char* path, size_t size, const char* results_dir, const MfClassicNonce* n) {
+    uint32_t fields[MFKEY_RESULTS_FIELDS];
+    uint64_t fingerprint = mfkey_result_fingerprint(n, fields);
+    snprintf(path, size, "%s/res_%016" PRIx64 ".v%d.mfkr", results_dir, fingerprint, MFKEY_RESULTS_VERSION);
+}
+
+bool mfkey_result_load(const char* results_dir, const MfClassicNonce* n, MfkeyResult* result) {
+    char path[512];
+    uint32_t fields[MFKEY_RESULTS_FIELDS];
+    mfkey_result_fingerprint(n, fields);
+    mfkey_result_path(path, sizeof(path), results_dir, n);
+    memset(result, 0, sizeof(*result));
+
+    FILE* file = fopen(path, "rb");
+    if(!file) {
+        return false;
+    }
+
+    // Validate before use; a stale, truncated or colliding file is treated as a miss
+    ResultHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                 memcmp(header.magic, MFKEY_RESULTS_MAGIC, 4) == 0 && header.version == MFKEY_RESULTS_VERSION &&
+                 memcmp(header.fields, fields, sizeof(fields)) == 0 && header.found <= 1 &&
+                 header.candidate_count <= (1U << 24);
+    uint8_t* packed = NULL;
+    if(valid && header.candidate_count > 0) {
+        packed = malloc((size_t)header.candidate_count * MF_CLASSIC_KEY_SIZE);
+        result->candidates = malloc(sizeof(MfClassicKey) * header.candidate_count);
+        valid = packed && result->candidates &&
+                fread(packed, MF_CLASSIC_KEY_SIZE, header.candidate_count, file) == header.candidate_count;
+    }
+    valid = valid && fgetc(file) == EOF;
+    fclose(file);
+    if(!valid) {
+        free(packed);
+        mfkey_result_free(result);
+        return false;
+    }
+
+    result->found = header.found;
+    memcpy(result->key.data, header.key, MF_CLASSIC_KEY_SIZE);
+    result->candidate_count = header.candidate_count;
+    for(uint32_t i = 0; i < header.candidate_count; i++) {
+        memcpy(result->candidates[i].data, packed + (size_t)i * MF_CLASSIC_KEY_SIZE, MF_CLASSIC_KEY_SIZE);
+    }
+    free(packed);
+    return true;
+}
+
+bool mfkey_result_store(const char* results_dir, const MfClassicNonce* n, const MfkeyResult* result) {
+    char path[512], temp_path[600];
+    mfkey_result_path(path, sizeof(path), results_dir, n);
+    // Unique per writer: worker threads of one process may store concurrently
+    static atomic_uint store_counter;
+    snprintf(temp_path, sizeof(temp_path), "%s.%ld.%u.tmp", path, (long)getpid(),
+             atomic_fetch_add(&store_counter, 1));
+
+    FILE* file = fopen(temp_path, "wb");
+    if(!file) {
+        fprintf(stderr, "Failed to create result file: %s\n", temp_path);
+        return false;
+    }
+
+    ResultHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MFKEY_RESULTS_MAGIC, 4);
+    header.version = MFKEY_RESULTS_VERSION;
+    mfkey_result_fingerprint(n, header.fields);
+    header.found = result->found;
+    header.candidate_count = result->candidate_count;
+    memcpy(header.key, result->key.data, MF_CLASSIC_KEY_SIZE);
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for(uint32_t i = 0; ok && i < result->candidate_count; i++) {
+        ok = fwrite(result->candidates[i].data, MF_CLASSIC_KEY_SIZE, 1, file) == 1;
+    }
+    if(fclose(file) != 0) {
+        ok = false;
+    }
+
+    // Readers only ever see complete files
+#ifdef _WIN32
+    if(ok) remove(path);
+#endif
+    if(!ok || rename(temp_path, path) != 0) {
+        remove(temp_path);
+        fprintf(stderr, "Failed to write result file: %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+void mfkey_result_free(MfkeyResult* result) {
+    free(result->candidates);
+    memset(result, 0, sizeof(*result));
+}
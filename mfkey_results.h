@@ -0,0 +1,41 @@
+#ifndef MFKEY_RESULTS_H
+#define MFKEY_RESULTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mfkey.h"
+
+// Result database: one file per recovered nonce in a directory, named after a
+// fingerprint of everything the recovery reads (attack, UID, nonces, encrypted
+// keystream words and parities). Sector and key type labels are not part of it.
+//
+// Result file: magic, version, the fingerprinted fields, found flag, key and
+// candidate count (native byte order), followed by the candidate keys, 6 bytes each
+#define MFKEY_RESULTS_MAGIC   "MFKR"
+#define MFKEY_RESULTS_VERSION 1
+#define MFKEY_RESULTS_FIELDS  12
+
+typedef struct {
+    bool found;                // The key was recovered (mfkey32, static_nested)
+    MfClassicKey key;
+    MfClassicKey* candidates;  // static_encrypted candidates, in discovery order
+    uint32_t candidate_count;
+} MfkeyResult;
+
+// Fingerprint of a nonce and the fields it is computed from
+uint64_t mfkey_result_fingerprint(const MfClassicNonce* n, uint32_t fields[MFKEY_RESULTS_FIELDS]);
+
+// Path of the result file for a nonce
+void mfkey_result_path(char* path, size_t size, const char* results_dir, const MfClassicNonce* n);
+
+// Load the stored result of a nonce. Returns false if missing, stale or for another
+// nonce with the same fingerprint. The caller releases it with mfkey_result_free().
+bool mfkey_result_load(const char* results_dir, const MfClassicNonce* n, MfkeyResult* result);
+
+// Store the result of a completed recovery (written to a temporary file and renamed into place)
+bool mfkey_result_store(const char* results_dir, const MfClassicNonce* n, const MfkeyResult* result);
+
+void mfkey_result_free(MfkeyResult* result);
+
+#endif // MFKEY_RESULTS_H
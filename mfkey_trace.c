@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mfkey_trace.h"
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    const char* name;
+    const char* arg_name;
+    int64_t arg;
+    uint64_t start; // ns
+    uint64_t duration;
+} TraceSpan;
+
+// Ring buffer of one thread. Only the owning thread writes to it.
+typedef struct TraceBuffer {
+    TraceSpan* spans;
+    size_t capacity;
+    uint64_t recorded; // Spans recorded so far; the newest is at (recorded - 1) % capacity
+    int tid;
+    char thread_name[32];
+    struct TraceBuffer* next;
+} TraceBuffer;
+
+volatile int mfkey_trace_active = 0;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceBuffer* trace_buffers = NULL; // All buffers, newest first
+static int trace_thread_count = 0;
+static size_t trace_capacity = MFKEY_TRACE_DEFAULT_CAPACITY;
+static uint64_t trace_origin = 0;
+static uint64_t trace_generation = 0; // Bumped by every start, so stale thread buffers are replaced
+
+static __thread TraceBuffer* local_buffer = NULL;
+static __thread uint64_t local_generation = 0;
+
+uint64_t mfkey_trace_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void mfkey_trace_start(size_t capacity) {
+    pthread_mutex_lock(&trace_lock);
+    trace_capacity = capacity > 0 ? capacity : MFKEY_TRACE_DEFAULT_CAPACITY;
+    trace_origin = mfkey_trace_now();
+    trace_generation++;
+    pthread_mutex_unlock(&trace_lock);
+    __atomic_store_n(&mfkey_trace_active, 1, __ATOMIC_RELEASE);
+}
+
+// Buffer of the calling thread, created on its first span. NULL if out of memory.
+static TraceBuffer* thread_buffer(void) {
+    if(local_buffer && local_generation == trace_generation) {
+        return local_buffer;
+    }
+    TraceBuffer* buffer = calloc(1, sizeof(TraceBuffer));
+    pthread_mutex_lock(&trace_lock);
+    if(buffer && (buffer->spans = malloc(sizeof(TraceSpan) * trace_capacity)) != NULL) {
+        buffer->capacity = trace_capacity;
+        buffer->tid = ++trace_thread_count;
+        buffer->next = trace_buffers;
+        trace_buffers = buffer;
+    } else {
+        free(buffer);
+        buffer = NULL;
+    }
+    local_generation = trace_generation;
+    pthread_mutex_unlock(&trace_lock);
+    local_buffer = buffer;
+    return buffer;
+}
+
+void mfkey_trace_thread_name(const char* name) {
+    if(!mfkey_trace_active) return;
+    TraceBuffer* buffer = thread_buffer();
+    if(buffer) {
+        snprintf(buffer->thread_name, sizeof(buffer->thread_name), "%s", name);
+    }
+}
+
+void mfkey_trace_record(uint64_t start, const char* name, const char* arg_name, int64_t arg) {
+    uint64_t end = mfkey_trace_now();
+    TraceBuffer* buffer = thread_buffer();
+    if(!buffer) return;
+    TraceSpan* span = &buffer->spans[buffer->recorded++ % buffer->capacity];
+    span->name = name;
+    span->arg_name = arg_name;
+    span->arg = arg;
+    span->start = start;
+    span->duration = end - start;
+}
+
+bool mfkey_trace_write(const char* path) {
+    __atomic_store_n(&mfkey_trace_active, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&trace_lock);
+    TraceBuffer* buffers = trace_buffers;
+    trace_buffers = NULL;
+    trace_thread_count = 0;
+    trace_generation++;
+    pthread_mutex_unlock(&trace_lock);
+
+    FILE* file = fopen(path, "w");
+    if(!file) {
+        fprintf(stderr, "Failed to create trace file: %s\n", path);
+    } else {
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"mfkey\"}}");
+    }
+    uint64_t dropped = 0;
+    for(TraceBuffer* buffer = buffers; buffer;) {
+        if(file) {
+            if(buffer->thread_name[0]) {
+                fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                        buffer->tid, buffer->thread_name);
+            }
+            // Oldest kept span first
+            uint64_t first = buffer->recorded > buffer->capacity ? buffer->recorded - buffer->capacity : 0;
+            dropped += first;
+            for(uint64_t i = first; i < buffer->recorded; i++) {
+                const TraceSpan* span = &buffer->spans[i % buffer->capacity];
+                if(span->start < trace_origin) continue; // Started before tracing did
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                        span->name, buffer->tid, (span->start - trace_origin) / 1000.0, span->duration / 1000.0);
+                if(span->arg_name) {
+                    fprintf(file, ",\"args\":{\"%s\":%" PRId64 "}", span->arg_name, span->arg);
+                }
+                fprintf(file, "}");
+            }
+        }
+        TraceBuffer* next = buffer->next;
+        free(buffer->spans);
+        free(buffer);
+        buffer = next;
+    }
+    if(!file) {
+        return false;
+    }
+    fprintf(file, "\n]}\n");
+    if(fclose(file) != 0) {
+        fprintf(stderr, "Failed to write trace file: %s\n", path);
+        return false;
+    }
+    if(dropped > 0) {
+        fprintf(stderr, "Trace buffers wrapped: %" PRIu64 " oldest spans dropped\n", dropped);
+    }
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef MFKEY_TRACE_H
+#define MFKEY_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Timeline tracing in the Chrome Trace Event format (also read by Perfetto).
+//
+// Spans are recorded into a ring buffer per thread, without locking, and written
+// as complete ("X") events once the traced work has finished. When a ring is full
+// the oldest spans of that thread are overwritten. While tracing is off, a span
+// costs one load and branch.
+//
+//     uint64_t start = mfkey_trace_begin();
+//     ...
+//     mfkey_trace_end(start, "join", "msb_round", round);
+
+// Spans per thread kept by default
+#define MFKEY_TRACE_DEFAULT_CAPACITY (1 << 20)
+
+extern volatile int mfkey_trace_active;
+
+// Monotonic time in nanoseconds
+uint64_t mfkey_trace_now(void);
+
+// Start recording. capacity is the number of spans kept per thread.
+void mfkey_trace_start(size_t capacity);
+
+// Name the calling thread in the trace
+void mfkey_trace_thread_name(const char* name);
+
+// Record a span from start until now on the calling thread. name and arg_name
+// must be string literals or otherwise outlive the trace; arg_name may be NULL.
+void mfkey_trace_record(uint64_t start, const char* name, const char* arg_name, int64_t arg);
+
+// Stop recording, write every thread's spans to path and release the buffers.
+// Traced threads must be idle. Returns false if the file cannot be written.
+bool mfkey_trace_write(const char* path);
+
+// Start of a span, 0 if tracing is off
+static inline uint64_t mfkey_trace_begin(void) {
+    return mfkey_trace_active ? mfkey_trace_now() : 0;
+}
+
+static inline void mfkey_trace_end(uint64_t start, const char* name, const char* arg_name, int64_t arg) {
+    if(start) {
+        mfkey_trace_record(start, name, arg_name, arg);
+    }
+}
+
+#endif // MFKEY_TRACE_H
@@ -304,6 +304,15 @@ void pixel_ui_show_summary(int total_nonces, int found_keys, int candidate_keys)
     if (ui_options.use_colors) printf(COLOR_RESET);
 }
 
+void pixel_ui_show_parallelism(double busy_cpus, int usable_cpus) {
+    if (ui_options.no_ui) {
+        printf("Parallelism: %.1f CPUs busy of %d usable\n", busy_cpus, usable_cpus);
+        return;
+    }
+    
+    printf("▸ Parallelism: %.1f CPUs busy of %d usable\n", busy_cpus, usable_cpus);
+}
+
 void pixel_ui_show_found_keys_list(const uint8_t keys[][6], int count) {
     if (count == 0) return;
     
@@ -386,6 +395,26 @@ void pixel_ui_show_saved_files(const char* keys_file, int keys_count,
     }
 }
 
+void pixel_ui_show_stats_header(void) {
+    if (ui_options.no_ui) {
+        printf("\nStatistics:\n");
+        return;
+    }
+    
+    if (ui_options.use_colors) printf(COLOR_CYAN);
+    printf("\nStatistics:\n");
+    if (ui_options.use_colors) printf(COLOR_RESET);
+}
+
+void pixel_ui_show_stat(const char* label, const char* value) {
+    if (ui_options.no_ui) {
+        printf("  %-22s %s\n", label, value);
+        return;
+    }
+    
+    printf("  ▸ %-20s %s\n", label, value);
+}
+
 void pixel_ui_show_no_keys_found(void) {
     if (ui_options.no_ui) {
         printf("No keys were recovered. This could happen if:\n");
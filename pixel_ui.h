@@ -71,6 +71,9 @@ void pixel_ui_show_candidate_key(const uint8_t* key_data);
 // Display completion summary
 void pixel_ui_show_summary(int total_nonces, int found_keys, int candidate_keys);
 
+// Display effective parallelism: CPUs kept busy during recovery
+void pixel_ui_show_parallelism(double busy_cpus, int usable_cpus);
+
 // Display found keys list
 void pixel_ui_show_found_keys_list(const uint8_t keys[][6], int count);
 
@@ -84,6 +87,12 @@ void pixel_ui_show_saved_files(const char* keys_file, int keys_count,
 // Display multiple saved candidate dictionaries (one per UID)
 void pixel_ui_show_saved_dicts(const char* dict_files[], const int dict_counts[], int num_dicts);
 
+// Display statistics section header
+void pixel_ui_show_stats_header(void);
+
+// Display one statistics line
+void pixel_ui_show_stat(const char* label, const char* value);
+
 // Display no keys found message
 void pixel_ui_show_no_keys_found(void);
 
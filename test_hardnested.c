@@ -0,0 +1,101 @@
+// Regression test of the hardnested first byte sum matching: on traces
+// generated from known keys, the class pair of the true key state must survive
+// the matching, also when one nonce of the trace is misread.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crypto1.h"
+#include "mfkey_hardnested.h"
+
+// Nonces per generated trace: enough to see every first byte
+#define TRACE_NONCES 2048
+
+static const uint8_t test_keys[][MF_CLASSIC_KEY_SIZE] = {
+    {0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5},
+    {0x4d, 0x3a, 0x99, 0xc3, 0x51, 0xdd},
+    {0x1a, 0x98, 0x2c, 0x7e, 0x45, 0x9a},
+};
+
+// Encrypted nonces of nested authentications with the key state, as a reader
+// logs them from a card with a hardened PRNG. With misread, the parity bits of
+// one nonce are flipped.
+static void generate_trace(MfClassicNonce* n, const struct Crypto1State* key_state, uint32_t seed, bool misread) {
+    memset(n, 0, sizeof(*n));
+    n->attack = hardnested;
+    n->uid = 0x2468ace0 ^ seed;
+    n->sector = 1;
+    n->key_type = 'A';
+    uint32_t nt = seed;
+    for(int i = 0; i < TRACE_NONCES; i++) {
+        struct Crypto1State s = *key_state;
+        uint8_t par;
+        nt = nt * 0x9e3779b1u + 0x7f4a7c15u;
+        uint32_t ks = crypt_word_par(&s, n->uid ^ nt, 0, nt, &par);
+        if(misread && i == TRACE_NONCES / 2) {
+            par ^= 0xf;
+        }
+        mfkey_hardnested_add(n, nt ^ ks, par);
+    }
+}
+
+static bool contains(const MfkeyHardHalves* halves, uint32_t half) {
+    for(uint32_t i = 0; i < halves->count; i++) {
+        if(halves->states[i] == half) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether an allowed class pair of the plan holds both halves of the key state
+static bool plan_has_state(const MfkeyHardPlan* plan, const struct Crypto1State* key_state) {
+    for(int i = 0; i < plan->pair_count; i++) {
+        const MfkeyHardHalves* odd = &plan->odd[plan->pairs[i][0]];
+        const MfkeyHardHalves* even = &plan->even[plan->pairs[i][1]];
+        if(contains(odd, key_state->odd & 0xffffff) && contains(even, key_state->even & 0xffffff)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool run_case(int key_index, bool misread) {
+    MfClassicKey key;
+    struct Crypto1State key_state;
+    memcpy(key.data, test_keys[key_index], MF_CLASSIC_KEY_SIZE);
+    crypto1_set_lfsr(&key_state, &key);
+
+    static MfClassicNonce n;
+    MfkeyHardPlan plan;
+    generate_trace(&n, &key_state, 0x01200145u + key_index, misread);
+    if(!mfkey_hardnested_plan(&n, &plan)) {
+        printf("FAIL key %d%s: memory allocation failed\n", key_index, misread ? " (misread)" : "");
+        return false;
+    }
+    bool ok = mfkey_hardnested_check(&n, &key_state) && plan_has_state(&plan, &key_state) &&
+              plan.states < 0x1p48;
+    printf("%s key %d%s: %d first bytes, %d class pairs, %.3g states\n",
+           ok ? "ok  " : "FAIL",
+           key_index,
+           misread ? " (misread)" : "",
+           plan.first_known,
+           plan.pair_count,
+           plan.states);
+    mfkey_hardnested_plan_free(&plan);
+    return ok;
+}
+
+int main(void) {
+    crypto1_init_tables();
+    int failed = 0;
+    for(int k = 0; k < (int)(sizeof(test_keys) / sizeof(test_keys[0])); k++) {
+        failed += !run_case(k, false);
+        failed += !run_case(k, true);
+    }
+    if(failed) {
+        printf("%d hardnested test(s) failed\n", failed);
+        return 1;
+    }
+    printf("All hardnested tests passed\n");
+    return 0;
+}